@@ -1,12 +1,21 @@
 ﻿#include <iostream>
 #include <cstdlib>
 #include <string>
+#include <csignal>
+#include <chrono>
+#include <optional>
 
 #include <boost/json.hpp>
 #include "bserv/common.hpp"
 
 #include "rendering.h"
 #include "handlers.h"
+#include "static_files.h"
+#include "asset_cache.h"
+#include "password_hashing.h"
+#include "metrics.h"
+#include "async_log.h"
+#include "db_pool.h"
 
 void show_usage(const bserv::server_config& config) {
 	std::cout << "Usage: " << config.get_name() << " [config.json]\n"
@@ -22,12 +31,33 @@ void show_config(const bserv::server_config& config) {
 		<< "\nthreads: " << config.get_num_threads()
 		<< "\nrotation: " << config.get_log_rotation_size() / 1024 / 1024
 		<< "\nlog path: " << config.get_log_path()
+		<< "\nhash-threads: " << get_password_hashing_pool().num_threads()
+		<< "\nhash-queue: " << get_password_hashing_pool().max_queue()
+		<< "\nhash-in-flight: " << password_hashing_limit()
 		<< "\ndb-conn: " << config.get_num_db_conn()
 		<< "\nconn-str: " << config.get_db_conn_str() << std::endl;
 }
 
+// registers `Handler` like `bserv::make_path`, measuring its requests
+// (see metrics.h). a handler registered under several paths is
+// reported under the first one. its connection comes from our pools
+// (see db_pool.h), so a `db_use` stands for it in `params`.
+template <auto Handler, typename ...Params>
+auto make_route(const std::string& path, Params&& ...params) {
+	using route_type = metrics::instrumented<&pooled<Handler>::call>;
+	auto& route = route_type::metrics;
+	if (route == nullptr) route = &metrics::add_route(path);
+	return bserv::make_path(path, &route_type::call,
+		std::forward<Params>(params)...);
+}
+
 int main(int argc, char* argv[]) {
 	bserv::server_config config;
+	db_pool::options pool_options;
+	std::string replica_conn_str;
+	std::chrono::seconds counts_write_back{ 10 };
+	transcoding_options transcoding;
+	std::optional<std::size_t> hash_limit;
 
 	if (argc != 2) {
 		show_usage(config);
@@ -46,8 +76,54 @@ int main(int argc, char* argv[]) {
 				config.set_num_db_conn((int)config_obj["conn-num"].as_int64());
 			if (config_obj.contains("conn-str"))
 				config.set_db_conn_str(config_obj["conn-str"].as_string().c_str());
+			if (config_obj.contains("conn-min"))
+				pool_options.min_size = (int)config_obj["conn-min"].as_int64();
+			if (config_obj.contains("conn-timeout-ms"))
+				pool_options.acquire_timeout = std::chrono::milliseconds{ config_obj["conn-timeout-ms"].as_int64() };
+			if (config_obj.contains("conn-idle-seconds"))
+				pool_options.idle_timeout = std::chrono::seconds{ config_obj["conn-idle-seconds"].as_int64() };
+			if (config_obj.contains("conn-check-seconds"))
+				pool_options.check_interval = std::chrono::seconds{ config_obj["conn-check-seconds"].as_int64() };
+			if (config_obj.contains("counts-write-back-seconds"))
+				counts_write_back = std::chrono::seconds{ config_obj["counts-write-back-seconds"].as_int64() };
+			if (config_obj.contains("ffmpeg"))
+				transcoding.ffmpeg = config_obj["ffmpeg"].as_string().c_str();
+			if (config_obj.contains("transcode-bitrates")) {
+				transcoding.bitrates.clear();
+				for (const auto& bitrate : config_obj["transcode-bitrates"].as_array())
+					transcoding.bitrates.push_back((int)bitrate.as_int64());
+			}
+			if (config_obj.contains("transcode-thread-num"))
+				transcoding.num_threads = (std::size_t)config_obj["transcode-thread-num"].as_int64();
+			if (config_obj.contains("transcode-queue-size"))
+				transcoding.max_queue = (std::size_t)config_obj["transcode-queue-size"].as_int64();
+			if (config_obj.contains("segment-seconds"))
+				transcoding.segment_seconds = config_obj["segment-seconds"].is_double()
+					? config_obj["segment-seconds"].as_double()
+					: (double)config_obj["segment-seconds"].as_int64();
+			if (config_obj.contains("stream-cache-mb"))
+				init_stream_cache((std::size_t)config_obj["stream-cache-mb"].as_int64() * 1024 * 1024);
+			if (config_obj.contains("replica-conn-str"))
+				replica_conn_str = config_obj["replica-conn-str"].as_string().c_str();
+			if (config_obj.contains("hash-thread-num") || config_obj.contains("hash-queue-size"))
+				init_password_hashing(
+					config_obj.contains("hash-thread-num") ? (std::size_t)config_obj["hash-thread-num"].as_int64() : 2,
+					config_obj.contains("hash-queue-size") ? (std::size_t)config_obj["hash-queue-size"].as_int64() : 64);
+			if (config_obj.contains("hash-in-flight"))
+				hash_limit = (std::size_t)config_obj["hash-in-flight"].as_int64();
+			if (config_obj.contains("session-file"))
+				init_sessions(config_obj["session-file"].as_string().c_str(),
+					config_obj.contains("session-capacity") ? (std::size_t)config_obj["session-capacity"].as_int64() : 1 << 20);
+			if (config_obj.contains("session-cookie-secure"))
+				set_session_cookie_secure(config_obj["session-cookie-secure"].as_bool());
 			if (config_obj.contains("log-dir"))
 				config.set_log_path(std::string{ config_obj["log-dir"].as_string() });
+			if (config_obj.contains("log-level"))
+				async_log::set_level(async_log::parse_level(config_obj["log-level"].as_string().c_str()));
+			if (config_obj.contains("query-log-sample-rate"))
+				async_log::set_query_sample_rate(config_obj["query-log-sample-rate"].is_double()
+					? config_obj["query-log-sample-rate"].as_double()
+					: (double)config_obj["query-log-sample-rate"].as_int64());
 			if (!config_obj.contains("template_root")) {
 				std::cerr << "`template_root` must be specified" << std::endl;
 				return EXIT_FAILURE;
@@ -58,162 +134,236 @@ int main(int argc, char* argv[]) {
 				return EXIT_FAILURE;
 			}
 			else init_static_root(config_obj["static_root"].as_string().c_str());
+			if (!config_obj.contains("static-cache") || config_obj["static-cache"].as_bool()) {
+				asset_cache_options asset_options;
+				if (config_obj.contains("static-max-age"))
+					asset_options.max_age = std::chrono::seconds{ config_obj["static-max-age"].as_int64() };
+				init_asset_cache(config_obj["static_root"].as_string().c_str(), asset_options);
+			}
+			if (config_obj.contains("static-mmap"))
+				set_static_mmap(config_obj["static-mmap"].as_bool());
 		}
 		catch (const std::exception& e) {
 			std::cerr << e.what() << std::endl;
 			return EXIT_FAILURE;
 		}
 	}
+	if (hash_limit.has_value()) set_password_hashing_limit(hash_limit.value());
 	show_config(config);
 
+	// `conn-num` is the most connections of each pool
+	pool_options.conn_str = config.get_db_conn_str();
+	pool_options.max_size = config.get_num_db_conn();
+	db_pool::options replica_options = pool_options;
+	replica_options.conn_str = replica_conn_str;
+	try {
+		init_db_pools(pool_options, replica_options);
+	}
+	catch (const std::exception& e) {
+		std::cerr << "failed to connect to the database: " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	// the routes no longer use bserv's own pool
+	config.set_num_db_conn(1);
+
+	try {
+		init_music_catalogue(config.get_db_conn_str(), counts_write_back);
+	}
+	catch (const std::exception& e) {
+		std::cerr << "failed to load the music catalogue: " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	init_music_transcoding(transcoding);
+
+#ifdef SIGHUP
+	// `kill -HUP` reloads the templates
+	std::signal(SIGHUP, [](int) { reload_templates(); });
+#endif
+
 	auto _ = bserv::server{ config, {
 		// rest api example
-		bserv::make_path("/hello", &hello,
+		make_route<&hello>("/hello",
+			bserv::placeholders::request,
 			bserv::placeholders::response,
 			bserv::placeholders::session),
-		bserv::make_path("/register", &user_register,
+		make_route<&user_register>("/register",
 			bserv::placeholders::request,
+			bserv::placeholders::response,
 			bserv::placeholders::json_params,
-			bserv::placeholders::db_connection_ptr),
-		bserv::make_path("/login", &user_login,
+			db_use::read_write),
+		make_route<&user_login>("/login",
 			bserv::placeholders::request,
+			bserv::placeholders::response,
 			bserv::placeholders::json_params,
-			bserv::placeholders::db_connection_ptr,
+			db_use::read_write,
 			bserv::placeholders::session),
-		bserv::make_path("/logout", &user_logout,
+		make_route<&user_logout>("/logout",
+			bserv::placeholders::request,
+			bserv::placeholders::response,
 			bserv::placeholders::session),
-		bserv::make_path("/find/<str>", &find_user,
-			bserv::placeholders::db_connection_ptr,
+		make_route<&find_user>("/find/<str>",
+			db_use::read_only,
 			bserv::placeholders::_1),
-		bserv::make_path("/send", &send_request,
+		make_route<&send_request>("/send",
 			bserv::placeholders::session,
 			bserv::placeholders::http_client_ptr,
 			bserv::placeholders::json_params),
-		bserv::make_path("/echo", &echo,
+		make_route<&echo>("/echo",
 			bserv::placeholders::json_params),
 
 		// serving static files
-		bserv::make_path("/statics/<path>", &serve_static_files,
+		make_route<&serve_static_files>("/statics/<path>",
+			bserv::placeholders::request,
 			bserv::placeholders::response,
 			bserv::placeholders::_1),
 
 		// serving html template files
-		bserv::make_path("/", &index_page,
+		make_route<&index_page>("/",
+			bserv::placeholders::request,
 			bserv::placeholders::session,
 			bserv::placeholders::response),
-		bserv::make_path("/form_login", &form_login,
+		make_route<&form_login>("/form_login",
 			bserv::placeholders::request,
 			bserv::placeholders::response,
 			bserv::placeholders::json_params,
-			bserv::placeholders::db_connection_ptr,
+			db_use::read_write,
 			bserv::placeholders::session),
-		bserv::make_path("/form_logout", &form_logout,
+		make_route<&form_logout>("/form_logout",
+			bserv::placeholders::request,
 			bserv::placeholders::session,
 			bserv::placeholders::response),
-		bserv::make_path("/users", &view_users,
-			bserv::placeholders::db_connection_ptr,
+		make_route<&view_users>("/users",
+			bserv::placeholders::request,
+			db_use::read_only,
 			bserv::placeholders::session,
 			bserv::placeholders::response,
 			std::string{"1"}),
-		bserv::make_path("/users/<int>", &view_users,
-			bserv::placeholders::db_connection_ptr,
+		make_route<&view_users>("/users/<int>",
+			bserv::placeholders::request,
+			db_use::read_only,
 			bserv::placeholders::session,
 			bserv::placeholders::response,
 			bserv::placeholders::_1),
-		bserv::make_path("/form_add_user", &form_add_user,
+		make_route<&form_add_user>("/form_add_user",
 			bserv::placeholders::request,
 			bserv::placeholders::response,
 			bserv::placeholders::json_params,
-			bserv::placeholders::db_connection_ptr,
+			db_use::read_write,
 			bserv::placeholders::session),
-		bserv::make_path("/music_repo", &view_music_repo,
-			bserv::placeholders::db_connection_ptr,
+		make_route<&view_music_repo>("/music_repo",
+			bserv::placeholders::request,
+			db_use::read_only,
 			bserv::placeholders::session,
 			bserv::placeholders::response,
 			std::string{"1"}),
-		bserv::make_path("/music_repo/<int>", &view_music_repo,
-			bserv::placeholders::db_connection_ptr,
+		make_route<&view_music_repo>("/music_repo/<int>",
+			bserv::placeholders::request,
+			db_use::read_only,
 			bserv::placeholders::session,
 			bserv::placeholders::response,
 			bserv::placeholders::_1),
-		bserv::make_path("/form_add_music", &form_add_music,
+		make_route<&form_add_music>("/form_add_music",
 			bserv::placeholders::request,
 			bserv::placeholders::response,
 			bserv::placeholders::json_params,
-			bserv::placeholders::db_connection_ptr,
+			db_use::read_write,
 			bserv::placeholders::session),
-		bserv::make_path("/music/<int>", &view_music,
-			bserv::placeholders::db_connection_ptr,
+		make_route<&view_music>("/music/<int>",
+			bserv::placeholders::request,
+			db_use::read_only,
+			bserv::placeholders::session,
+			bserv::placeholders::response,
+			bserv::placeholders::_1),
+		make_route<&view_music_comments>("/music/<int>/comments",
+			bserv::placeholders::request,
+			bserv::placeholders::response,
+			db_use::read_only,
 			bserv::placeholders::session,
+			bserv::placeholders::json_params,
+			bserv::placeholders::_1),
+		make_route<&view_music_playlist>("/music/<int>/stream/index.m3u8",
+			bserv::placeholders::request,
 			bserv::placeholders::response,
 			bserv::placeholders::_1),
-		bserv::make_path("/form_post_comment", &form_post_comment,
+		make_route<&view_music_segment>("/music/<int>/stream/<int>",
+			bserv::placeholders::request,
+			bserv::placeholders::response,
+			bserv::placeholders::_1,
+			bserv::placeholders::_2),
+		make_route<&search_music>("/search",
+			bserv::placeholders::json_params),
+		make_route<&metrics_page>("/metrics",
+			bserv::placeholders::response),
+		make_route<&form_post_comment>("/form_post_comment",
 			bserv::placeholders::request,
 			bserv::placeholders::response,
 			bserv::placeholders::json_params,
-			bserv::placeholders::db_connection_ptr,
+			db_use::read_write,
 			bserv::placeholders::session),
-		bserv::make_path("/form_delete_comment", &form_delete_comment,
+		make_route<&form_delete_comment>("/form_delete_comment",
 			bserv::placeholders::request,
 			bserv::placeholders::response,
 			bserv::placeholders::json_params,
-			bserv::placeholders::db_connection_ptr,
+			db_use::read_write,
 			bserv::placeholders::session),
-		bserv::make_path("/form_process_favorite", &form_process_favorite,
+		make_route<&form_process_favorite>("/form_process_favorite",
 			bserv::placeholders::request,
 			bserv::placeholders::response,
 			bserv::placeholders::json_params,
-			bserv::placeholders::db_connection_ptr,
+			db_use::read_write,
 			bserv::placeholders::session),
-		bserv::make_path("/view_profile", &view_profile,
-			bserv::placeholders::db_connection_ptr,
+		make_route<&view_profile>("/view_profile",
+			bserv::placeholders::request,
+			db_use::read_only,
 			bserv::placeholders::session,
 			bserv::placeholders::response),
-		bserv::make_path("/form_delete_account", &form_delete_account,
+		make_route<&form_delete_account>("/form_delete_account",
 			bserv::placeholders::request,
 			bserv::placeholders::response,
 			bserv::placeholders::json_params,
-			bserv::placeholders::db_connection_ptr,
+			db_use::read_write,
 			bserv::placeholders::session),
-		bserv::make_path("/apply_for_musician", &apply_for_musician,
+		make_route<&apply_for_musician>("/apply_for_musician",
 			bserv::placeholders::request,
 			bserv::placeholders::response,
 			bserv::placeholders::json_params,
-			bserv::placeholders::db_connection_ptr,
+			db_use::read_write,
 			bserv::placeholders::session),
-		bserv::make_path("/manage_applications", &manage_applications,
-			bserv::placeholders::db_connection_ptr,
+		make_route<&manage_applications>("/manage_applications",
+			bserv::placeholders::request,
+			db_use::read_write,
 			bserv::placeholders::session,
 			bserv::placeholders::response,
 			std::string{ "1" }),
-		bserv::make_path("/manage_applications/<int>", &manage_applications,
-			bserv::placeholders::db_connection_ptr,
+		make_route<&manage_applications>("/manage_applications/<int>",
+			bserv::placeholders::request,
+			db_use::read_write,
 			bserv::placeholders::session,
 			bserv::placeholders::response,
 			bserv::placeholders::_1),
-		bserv::make_path("/reject_application", &reject_application,
+		make_route<&reject_application>("/reject_application",
 			bserv::placeholders::request,
 			bserv::placeholders::response,
 			bserv::placeholders::json_params,
-			bserv::placeholders::db_connection_ptr,
+			db_use::read_write,
 			bserv::placeholders::session),
-		bserv::make_path("/pass_application", &pass_application,
+		make_route<&pass_application>("/pass_application",
 			bserv::placeholders::request,
 			bserv::placeholders::response,
 			bserv::placeholders::json_params,
-			bserv::placeholders::db_connection_ptr,
+			db_use::read_write,
 			bserv::placeholders::session),
-		bserv::make_path("/form_change_profile", &form_change_profile,
+		make_route<&form_change_profile>("/form_change_profile",
 			bserv::placeholders::request,
 			bserv::placeholders::response,
 			bserv::placeholders::json_params,
-			bserv::placeholders::db_connection_ptr,
+			db_use::read_write,
 			bserv::placeholders::session),
-		bserv::make_path("/delete_music", &delete_music,
+		make_route<&delete_music>("/delete_music",
 			bserv::placeholders::request,
 			bserv::placeholders::response,
 			bserv::placeholders::json_params,
-			bserv::placeholders::db_connection_ptr,
+			db_use::read_write,
 			bserv::placeholders::session),
 		}
 		, {
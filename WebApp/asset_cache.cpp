@@ -0,0 +1,226 @@
+#include "asset_cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <boost/beast/zlib/deflate_stream.hpp>
+#include <boost/crc.hpp>
+
+#include "static_files.h"
+
+namespace {
+
+	struct variant {
+		std::string body;
+		std::string etag;
+	};
+
+	struct asset {
+		std::string type;
+		std::string last_modified;
+		variant identity;
+		std::optional<variant> gzip;
+		std::optional<variant> brotli;
+	};
+
+	// only written by `init_asset_cache`, before the server starts
+	std::unordered_map<std::string, asset> assets_;
+	std::string cache_control_;
+	std::size_t bytes_ = 0;
+
+	std::atomic<std::uint64_t> hits_{ 0 };
+	std::atomic<std::uint64_t> not_modified_{ 0 };
+	std::atomic<std::uint64_t> gzip_served_{ 0 };
+	std::atomic<std::uint64_t> brotli_served_{ 0 };
+
+	bool is_text_asset(const std::filesystem::path& path) {
+		auto ext = path.extension().string();
+		for (auto& c : ext) c = (char)std::tolower((unsigned char)c);
+		return ext == ".css" || ext == ".js" || ext == ".map" || ext == ".svg"
+			|| ext == ".htm" || ext == ".html" || ext == ".txt" || ext == ".xml";
+	}
+
+	std::optional<std::string> read_file(const std::filesystem::path& path) {
+		std::ifstream fin{ path, std::ios::binary };
+		if (!fin) return std::nullopt;
+		return std::string{ std::istreambuf_iterator<char>{ fin }, std::istreambuf_iterator<char>{} };
+	}
+
+	// a strong etag of `body`, distinct for each variant of an asset
+	std::string make_etag(const std::string& body, const char* suffix) {
+		std::ostringstream etag;
+		etag << '"' << std::hex << std::hash<std::string>{}(body) << std::dec
+			<< '-' << body.size() << suffix << '"';
+		return etag.str();
+	}
+
+	std::string lowercase(std::string s) {
+		for (auto& c : s) c = (char)std::tolower((unsigned char)c);
+		return s;
+	}
+
+	// the q-value `Accept-Encoding` gives `coding`, through `*` if it
+	// is not named, 0 if neither is
+	double accepted(std::string_view header, const std::string& coding) {
+		double named = -1, star = -1;
+		while (!header.empty()) {
+			auto comma = header.find(',');
+			auto item = header.substr(0, comma);
+			header = comma == std::string_view::npos ? std::string_view{} : header.substr(comma + 1);
+			auto semicolon = item.find(';');
+			auto token = item.substr(0, semicolon);
+			auto first = token.find_first_not_of(" \t");
+			if (first == std::string_view::npos) continue;
+			token = token.substr(first, token.find_last_not_of(" \t") - first + 1);
+			double q = 1;
+			if (semicolon != std::string_view::npos) {
+				auto params = item.substr(semicolon + 1);
+				auto pos = params.find("q=");
+				if (pos != std::string_view::npos) {
+					try {
+						q = std::stod(std::string{ params.substr(pos + 2) });
+					}
+					catch (const std::exception&) {
+						q = 0;
+					}
+				}
+			}
+			std::string name = lowercase(std::string{ token });
+			if (name == coding) named = q;
+			else if (name == "*") star = q;
+		}
+		return named >= 0 ? named : std::max(star, 0.0);
+	}
+
+	void append_le32(std::string& out, std::uint32_t value) {
+		for (int i = 0; i < 4; ++i, value >>= 8) out.push_back((char)(value & 0xff));
+	}
+
+}
+
+std::string gzip_compress(std::string_view data, int level) {
+	namespace zlib = boost::beast::zlib;
+	// no file name, no modification time, unknown os
+	std::string out{ "\x1f\x8b\x08\x00\x00\x00\x00\x00\x00\xff", 10 };
+	zlib::deflate_stream stream;
+	stream.reset(level, 15, 8, zlib::Strategy::normal);
+	std::size_t header = out.size();
+	out.resize(header + stream.upper_bound(data.size()));
+	zlib::z_params zs;
+	zs.next_in = data.data();
+	zs.avail_in = data.size();
+	zs.next_out = &out[header];
+	zs.avail_out = out.size() - header;
+	boost::beast::error_code ec;
+	// enough output space for `upper_bound` finishes in one call
+	stream.write(zs, zlib::Flush::finish, ec);
+	if (ec != zlib::error::end_of_stream) {
+		throw std::runtime_error{ "deflate failed: " + ec.message() };
+	}
+	out.resize(header + zs.total_out);
+	boost::crc_32_type crc;
+	crc.process_bytes(data.data(), data.size());
+	append_le32(out, crc.checksum());
+	append_le32(out, (std::uint32_t)data.size());
+	return out;
+}
+
+void init_asset_cache(const std::string& static_root, const asset_cache_options& options) {
+	assets_.clear();
+	bytes_ = 0;
+	cache_control_ = "public, max-age=" + std::to_string(options.max_age.count()) + ", immutable";
+	std::error_code ec;
+	for (const auto& file : std::filesystem::recursive_directory_iterator{ static_root, ec }) {
+		if (!file.is_regular_file() || !is_text_asset(file.path())) continue;
+		if (file.file_size() > options.max_file_size) continue;
+		auto content = read_file(file.path());
+		if (!content.has_value()) continue;
+		asset a;
+		a.type = mime_type(file.path().string());
+		a.last_modified = last_modified(file.path().string());
+		a.identity = { std::move(content.value()), "" };
+		a.identity.etag = make_etag(a.identity.body, "");
+		auto gz = read_file(file.path().string() + ".gz");
+		std::string gzip = gz.has_value() ? std::move(gz.value()) : gzip_compress(a.identity.body);
+		if (gzip.size() < a.identity.body.size()) {
+			a.gzip = variant{ std::move(gzip), make_etag(a.identity.body, "-gz") };
+		}
+		auto br = read_file(file.path().string() + ".br");
+		if (br.has_value() && br.value().size() < a.identity.body.size()) {
+			a.brotli = variant{ std::move(br.value()), make_etag(a.identity.body, "-br") };
+		}
+		bytes_ += a.identity.body.size() + (a.gzip ? a.gzip->body.size() : 0)
+			+ (a.brotli ? a.brotli->body.size() : 0);
+		std::string name = std::filesystem::relative(file.path(), static_root).generic_string();
+		assets_.emplace(std::move(name), std::move(a));
+	}
+	lginfo << "asset cache: " << assets_.size() << " assets, " << bytes_ << " bytes";
+}
+
+bool serve_asset(
+	const bserv::request_type& request,
+	bserv::response_type& response,
+	const std::string& file) {
+	auto it = assets_.find(file);
+	if (it == assets_.end() || request.count(bserv::http::field::range)) {
+		return false;
+	}
+	const asset& a = it->second;
+	auto accept_encoding = request[bserv::http::field::accept_encoding];
+	std::string_view header{ accept_encoding.data(), accept_encoding.size() };
+	const variant* chosen = &a.identity;
+	const char* encoding = nullptr;
+	if (a.brotli && accepted(header, "br") > 0) {
+		chosen = &a.brotli.value();
+		encoding = "br";
+	}
+	else if (a.gzip && accepted(header, "gzip") > 0) {
+		chosen = &a.gzip.value();
+		encoding = "gzip";
+	}
+	++hits_;
+	response.set(bserv::http::field::etag, chosen->etag);
+	response.set(bserv::http::field::last_modified, a.last_modified);
+	response.set(bserv::http::field::cache_control, cache_control_);
+	response.set(bserv::http::field::vary, "Accept-Encoding");
+	auto if_none_match = request[bserv::http::field::if_none_match];
+	auto if_modified_since = request[bserv::http::field::if_modified_since];
+	bool not_modified = if_none_match.empty()
+		? !if_modified_since.empty() && if_modified_since == a.last_modified
+		: std::string_view{ if_none_match.data(), if_none_match.size() }.find(chosen->etag)
+			!= std::string_view::npos;
+	if (not_modified) {
+		++not_modified_;
+		response.result(bserv::http::status::not_modified);
+		response.body().clear();
+		response.prepare_payload();
+		return true;
+	}
+	if (encoding != nullptr) {
+		response.set(bserv::http::field::content_encoding, encoding);
+		++(encoding[0] == 'b' ? brotli_served_ : gzip_served_);
+	}
+	response.set(bserv::http::field::content_type, a.type);
+	response.body() = chosen->body;
+	response.prepare_payload();
+	return true;
+}
+
+asset_cache_stats get_asset_cache_stats() {
+	return {
+		assets_.size(),
+		bytes_,
+		hits_,
+		not_modified_,
+		gzip_served_,
+		brotli_served_
+	};
+}
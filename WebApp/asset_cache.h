@@ -0,0 +1,54 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "bserv/common.hpp"
+
+// the text assets of the static root (stylesheets, scripts, ...),
+// loaded into memory at startup with their compressed variants, so
+// that serving one is a lookup and a copy into the response.
+//
+// the gzip variant is compressed at load time, unless a precompressed
+// `<file>.gz` is next to the file. the brotli variant is only used if
+// a precompressed `<file>.br` is, as there is no brotli encoder in our
+// dependencies (e.g. `brotli -k -q 11 bootstrap.min.css`). a variant
+// is dropped if it is not smaller than the file.
+// the files are not watched: changing them takes a restart.
+
+struct asset_cache_options {
+	// larger files are left to `serve_file`
+	std::size_t max_file_size = 4 * 1024 * 1024;
+	// how long clients may use an asset without asking again
+	std::chrono::seconds max_age{ 24 * 60 * 60 };
+};
+
+// must be called before the first request
+void init_asset_cache(const std::string& static_root, const asset_cache_options& options = {});
+
+// serves `file` (relative to the static root) from memory, choosing
+// the variant from `Accept-Encoding`, and answers conditional
+// requests with 304. false if `file` is not cached, or for range
+// requests, which are left to `serve_file`.
+bool serve_asset(
+	const bserv::request_type& request,
+	bserv::response_type& response,
+	const std::string& file);
+
+struct asset_cache_stats {
+	std::size_t assets;
+	// of every variant
+	std::size_t bytes;
+	std::uint64_t hits;
+	std::uint64_t not_modified;
+	std::uint64_t gzip;
+	std::uint64_t brotli;
+};
+
+asset_cache_stats get_asset_cache_stats();
+
+// `data` in the gzip format (rfc 1952)
+std::string gzip_compress(std::string_view data, int level = 9);
@@ -0,0 +1,204 @@
+#include "async_log.h"
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "bserv/common.hpp"
+
+namespace async_log {
+
+	std::atomic<int> min_level_{ info };
+
+	namespace {
+
+		const std::size_t ring_capacity = 4096;
+		const std::chrono::milliseconds flush_interval{ 100 };
+
+		struct entry {
+			level lvl;
+			std::chrono::system_clock::time_point time;
+			std::string text;
+		};
+
+		// written by its thread only (`head`), read by the flusher only (`tail`)
+		struct ring {
+			std::array<entry, ring_capacity> entries;
+			alignas(64) std::atomic<std::size_t> head{ 0 };
+			alignas(64) std::atomic<std::size_t> tail{ 0 };
+			// set when the thread exits, the ring is dropped once drained
+			std::atomic<bool> orphaned{ false };
+		};
+
+		std::atomic<std::uint64_t> dropped_{ 0 };
+		std::atomic<std::uint64_t> written_{ 0 };
+		// the fraction of the query logs kept, in 1/2^32 units
+		std::atomic<std::uint64_t> sample_threshold_{ 1ull << 32 };
+
+		class flusher {
+		private:
+			std::mutex lock_;
+			std::condition_variable cv_;
+			std::vector<std::shared_ptr<ring>> rings_;
+			bool stopping_ = false;
+			std::uint64_t reported_drops_ = 0;
+			std::thread thread_;
+
+			static void append(std::string& batch, const entry& e) {
+				auto t = std::chrono::system_clock::to_time_t(e.time);
+				auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+					e.time.time_since_epoch()).count() % 1000000;
+				std::tm tm;
+#ifdef _WIN32
+				localtime_s(&tm, &t);
+#else
+				localtime_r(&t, &tm);
+#endif
+				char stamp[32];
+				std::size_t size = std::strftime(stamp, sizeof(stamp), "%H:%M:%S", &tm);
+				std::snprintf(stamp + size, sizeof(stamp) - size, ".%06lld ", (long long)us);
+				if (!batch.empty()) batch += '\n';
+				batch += stamp;
+				batch += e.text;
+			}
+
+			// moves everything queued into the log, one record per level
+			void drain(const std::vector<std::shared_ptr<ring>>& rings) {
+				std::array<std::string, 3> batches;
+				std::uint64_t count = 0;
+				for (auto& r : rings) {
+					std::size_t tail = r->tail.load(std::memory_order_relaxed);
+					std::size_t head = r->head.load(std::memory_order_acquire);
+					for (; tail != head; ++tail) {
+						entry& e = r->entries[tail % ring_capacity];
+						append(batches[e.lvl], e);
+						std::string{}.swap(e.text);
+						++count;
+					}
+					r->tail.store(tail, std::memory_order_release);
+				}
+				if (!batches[trace].empty()) lgtrace << batches[trace];
+				if (!batches[debug].empty()) lgdebug << batches[debug];
+				if (!batches[info].empty()) lginfo << batches[info];
+				written_ += count;
+				std::uint64_t drops = dropped_.load();
+				if (drops != reported_drops_) {
+					lgwarning << "async log: dropped " << drops - reported_drops_
+						<< " records (the ring buffers were full)";
+					reported_drops_ = drops;
+				}
+			}
+
+			void run() {
+				std::unique_lock<std::mutex> lock{ lock_ };
+				while (true) {
+					cv_.wait_for(lock, flush_interval, [this]() { return stopping_; });
+					bool stopping = stopping_;
+					// the rings of exited threads are dropped once empty
+					std::vector<std::shared_ptr<ring>> rings;
+					for (auto it = rings_.begin(); it != rings_.end();) {
+						bool empty = (*it)->tail.load() == (*it)->head.load();
+						if ((*it)->orphaned && empty) it = rings_.erase(it);
+						else rings.push_back(*it++);
+					}
+					lock.unlock();
+					drain(rings);
+					lock.lock();
+					if (stopping) break;
+				}
+			}
+		public:
+			flusher() : thread_{ [this]() { run(); } } {}
+			~flusher() {
+				{
+					std::lock_guard<std::mutex> lock{ lock_ };
+					stopping_ = true;
+				}
+				cv_.notify_one();
+				thread_.join();
+			}
+			void add(std::shared_ptr<ring> r) {
+				std::lock_guard<std::mutex> lock{ lock_ };
+				rings_.push_back(std::move(r));
+			}
+		};
+
+		flusher& get_flusher() {
+			static flusher instance;
+			return instance;
+		}
+
+		// the ring of the calling thread, registered on first use
+		struct thread_ring {
+			std::shared_ptr<ring> r = std::make_shared<ring>();
+			thread_ring() { get_flusher().add(r); }
+			~thread_ring() { r->orphaned = true; }
+		};
+
+		void push(level l, std::string&& text) {
+			thread_local thread_ring mine;
+			ring& r = *mine.r;
+			std::size_t head = r.head.load(std::memory_order_relaxed);
+			if (head - r.tail.load(std::memory_order_acquire) == ring_capacity) {
+				dropped_.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			entry& e = r.entries[head % ring_capacity];
+			e.lvl = l;
+			e.time = std::chrono::system_clock::now();
+			e.text = std::move(text);
+			r.head.store(head + 1, std::memory_order_release);
+		}
+
+	}
+
+	void set_level(level min_level) {
+		min_level_ = min_level;
+	}
+
+	void set_query_sample_rate(double sample_rate) {
+		if (sample_rate < 0) sample_rate = 0;
+		if (sample_rate > 1) sample_rate = 1;
+		sample_threshold_ = (std::uint64_t)(sample_rate * (double)(1ull << 32));
+	}
+
+	level parse_level(const std::string& name) {
+		if (name == "trace") return trace;
+		if (name == "debug") return debug;
+		if (name == "info") return info;
+		throw std::invalid_argument{ "unknown log level: " + name };
+	}
+
+	bool sample_query() {
+		std::uint64_t threshold = sample_threshold_.load(std::memory_order_relaxed);
+		if (threshold >= (1ull << 32)) return true;
+		// a per-thread xorshift, so that sampling shares nothing
+		thread_local std::uint32_t state = 0x9e3779b9u
+			^ (std::uint32_t)std::hash<std::thread::id>{}(std::this_thread::get_id()) | 1u;
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state < threshold;
+	}
+
+	std::uint64_t dropped() {
+		return dropped_.load();
+	}
+
+	std::uint64_t written() {
+		return written_.load();
+	}
+
+	record::~record() {
+		push(level_, std::move(text_));
+	}
+
+}
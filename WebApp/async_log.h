@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+// logging for the request threads, which never waits for the log.
+//
+// a message is only formatted if its level is enabled (the macros
+// below check it first), and is then put into a ring buffer owned by
+// the calling thread, without locking. a background thread collects
+// the rings every `flush_interval`, and writes what it found through
+// bserv's log, one record per level and batch. when a ring is full
+// the message is dropped and counted, rather than blocking.
+//
+// the logs of the queries run by the handlers (`lgquery`) can also be
+// sampled: only the given fraction of them is kept.
+//
+// warnings and errors are rare and should not be lost, so they still
+// go to bserv's log directly (`lgwarning`, `lgerror`).
+namespace async_log {
+
+	enum level { trace, debug, info };
+
+	// messages below `min_level` are skipped (default `info`)
+	void set_level(level min_level);
+
+	// the fraction of the query logs which is kept (default 1, all)
+	void set_query_sample_rate(double sample_rate);
+
+	// parses "trace", "debug" or "info"
+	level parse_level(const std::string& name);
+
+	extern std::atomic<int> min_level_;
+
+	inline bool enabled(level l) {
+		return (int)l >= min_level_.load(std::memory_order_relaxed);
+	}
+
+	// whether this query log is kept
+	bool sample_query();
+
+	// logged messages lost because a ring was full
+	std::uint64_t dropped();
+	// logged messages written
+	std::uint64_t written();
+
+	// a message being formatted, queued when it is destroyed
+	class record {
+	private:
+		level level_;
+		std::string text_;
+	public:
+		explicit record(level l) : level_{ l } {}
+		record(const record&) = delete;
+		record& operator=(const record&) = delete;
+		~record();
+		template <typename T>
+		record& operator<<(const T& value) {
+			if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+				text_ += std::string_view{ value };
+			}
+			else if constexpr (std::is_same_v<T, char>) {
+				text_ += value;
+			}
+			else if constexpr (std::is_arithmetic_v<T>) {
+				text_ += std::to_string(value);
+			}
+			else {
+				std::ostringstream out;
+				out << value;
+				text_ += out.str();
+			}
+			return *this;
+		}
+		// records are lines, `std::endl` is ignored
+		record& operator<<(std::ostream& (*)(std::ostream&)) { return *this; }
+	};
+
+}
+
+#define algtrace if (!async_log::enabled(async_log::trace)) ; else async_log::record{ async_log::trace }
+#define algdebug if (!async_log::enabled(async_log::debug)) ; else async_log::record{ async_log::debug }
+#define alginfo if (!async_log::enabled(async_log::info)) ; else async_log::record{ async_log::info }
+// the query of a db result, e.g. `lgquery << r.query();`
+#define lgquery if (!async_log::enabled(async_log::info) || !async_log::sample_query()) ; else async_log::record{ async_log::info }
@@ -0,0 +1,120 @@
+#include "blob_store.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <filesystem>
+#include <random>
+#include <stdexcept>
+
+namespace {
+
+	const std::size_t digest_length = CryptoPP::SHA256::DIGESTSIZE * 2;
+	const std::size_t max_extension_length = 8;
+
+	std::atomic<std::uint64_t> stored_{ 0 };
+	std::atomic<std::uint64_t> deduplicated_{ 0 };
+
+	const char hex_digits[] = "0123456789abcdef";
+
+	std::string random_suffix() {
+		thread_local std::mt19937_64 rng{ std::random_device{}() };
+		std::string suffix;
+		auto value = rng();
+		for (int i = 0; i < 16; ++i, value >>= 4)
+			suffix.push_back(hex_digits[value & 0xf]);
+		return suffix;
+	}
+
+	bool is_digest(const std::string& s) {
+		return s.size() == digest_length && std::all_of(s.begin(), s.end(), [](char c) {
+			return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+		});
+	}
+
+	// lowercased, empty if it is not a plain extension
+	std::string clean_extension(const std::string& extension) {
+		if (extension.size() < 2 || extension.size() > max_extension_length + 1
+			|| extension[0] != '.') {
+			return "";
+		}
+		std::string result = ".";
+		for (std::size_t i = 1; i < extension.size(); ++i) {
+			unsigned char c = extension[i];
+			if (!std::isalnum(c)) return "";
+			result.push_back((char)std::tolower(c));
+		}
+		return result;
+	}
+
+}
+
+blob_writer::blob_writer(const std::string& root, std::size_t buffer_size)
+	: root_{ root },
+	temp_path_{ root + ".upload-" + random_suffix() },
+	buffer_(buffer_size) {
+	fout_.rdbuf()->pubsetbuf(buffer_.data(), buffer_.size());
+	fout_.open(temp_path_, std::ios::out | std::ios::binary);
+	if (!fout_) throw std::runtime_error{ "failed to create " + temp_path_ };
+}
+
+blob_writer::~blob_writer() {
+	if (temp_path_ != "") {
+		fout_.close();
+		std::error_code ec;
+		std::filesystem::remove(temp_path_, ec);
+	}
+}
+
+void blob_writer::write(const char* data, std::size_t size) {
+	hash_.Update((const CryptoPP::byte*)data, size);
+	fout_.write(data, size);
+	if (!fout_) throw std::runtime_error{ "failed to write " + temp_path_ };
+	size_ += size;
+}
+
+std::string blob_writer::commit(const std::string& extension) {
+	fout_.close();
+	if (!fout_) throw std::runtime_error{ "failed to write " + temp_path_ };
+	CryptoPP::byte digest[CryptoPP::SHA256::DIGESTSIZE];
+	hash_.Final(digest);
+	std::string hex;
+	for (auto b : digest) {
+		hex.push_back(hex_digits[b >> 4]);
+		hex.push_back(hex_digits[b & 0xf]);
+	}
+	std::string dir = hex.substr(0, 2) + "/" + hex.substr(2, 2) + "/";
+	std::string name = dir + hex + clean_extension(extension);
+	std::filesystem::create_directories(root_ + dir);
+	if (std::filesystem::exists(root_ + name)) {
+		std::filesystem::remove(temp_path_);
+		++deduplicated_;
+	}
+	else {
+		// a concurrent upload of the same content may rename over it,
+		// which is harmless as the content is the same
+		std::filesystem::rename(temp_path_, root_ + name);
+		++stored_;
+	}
+	temp_path_ = "";
+	return name;
+}
+
+std::string blob_digest(const std::string& path) {
+	auto begin = path.find_last_of("/\\");
+	begin = begin == std::string::npos ? 0 : begin + 1;
+	auto end = path.find('.', begin);
+	if (end != std::string::npos && path.find('.', end + 1) != std::string::npos) {
+		return "";
+	}
+	std::string stem = path.substr(begin, end == std::string::npos ? std::string::npos : end - begin);
+	return is_digest(stem) ? stem : "";
+}
+
+std::uint64_t blobs_stored() {
+	return stored_;
+}
+
+std::uint64_t blobs_deduplicated() {
+	return deduplicated_;
+}
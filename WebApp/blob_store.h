@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <cryptopp/sha.h>
+
+// uploaded music is stored under the sha-256 digest of its content,
+// `<d0d1>/<d2d3>/<digest>.<ext>` below the music directory (two levels
+// of at most 256 directories, so no directory grows large). identical
+// uploads are stored once, and a stored file never changes, so its
+// digest is a strong etag (see `blob_digest`).
+
+// streams an upload into a temporary file in `root`, hashing it on
+// the way, and moves it to its place on `commit`. the temporary file
+// is removed if it is not committed.
+class blob_writer {
+private:
+	std::string root_;
+	std::string temp_path_;
+	std::vector<char> buffer_;
+	std::ofstream fout_;
+	CryptoPP::SHA256 hash_;
+	std::uint64_t size_ = 0;
+public:
+	blob_writer(const std::string& root, std::size_t buffer_size);
+	blob_writer(const blob_writer&) = delete;
+	blob_writer& operator=(const blob_writer&) = delete;
+	~blob_writer();
+	// throws `std::runtime_error` if the file cannot be written
+	void write(const char* data, std::size_t size);
+	// returns the name of the blob, relative to `root`. `extension`
+	// (of the uploaded file, e.g. ".mp3") is kept if it is short and
+	// alphanumeric, so that the file is served with its type.
+	std::string commit(const std::string& extension);
+	std::uint64_t size() const { return size_; }
+};
+
+// the digest of a blob, from its path, empty if it is not one.
+// renditions and segments derived from a blob (`<digest>.<...>.<ext>`)
+// are not blobs.
+std::string blob_digest(const std::string& path);
+
+// blobs stored, and uploads which were already stored
+std::uint64_t blobs_stored();
+std::uint64_t blobs_deduplicated();
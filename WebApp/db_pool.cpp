@@ -0,0 +1,252 @@
+#include "db_pool.h"
+
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+#include "statements.h"
+
+namespace {
+
+	std::unique_ptr<db_pool> primary_;
+	std::unique_ptr<db_pool> replica_;
+
+	std::uint64_t to_us(std::chrono::steady_clock::duration d) {
+		return (std::uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+	}
+
+}
+
+db_pool::db_pool(std::string name, options opts)
+	: name_{ std::move(name) }, options_{ std::move(opts) } {
+	options_.max_size = std::max(options_.max_size, 1);
+	options_.min_size = std::clamp(options_.min_size, 0, options_.max_size);
+	for (int i = 0; i < options_.min_size; ++i) {
+		idle_.push_back(open());
+		++size_;
+	}
+	checker_ = std::thread{ [this]() { check(); } };
+}
+
+db_pool::~db_pool() {
+	{
+		std::lock_guard<std::mutex> lock{ lock_ };
+		stopping_ = true;
+	}
+	stop_cv_.notify_one();
+	checker_.join();
+}
+
+std::unique_ptr<db_pool::slot> db_pool::open() {
+	auto s = std::make_unique<slot>();
+	s->manager = std::make_unique<bserv::db_connection_manager>(options_.conn_str, 1);
+	s->conn = s->manager->try_get();
+	s->idle_since = std::chrono::steady_clock::now();
+	opened_.add();
+	return s;
+}
+
+void db_pool::close(std::unique_ptr<slot> s, bool broken) {
+	// another connection may be opened at the same address
+	forget_prepared(*s->conn);
+	s.reset();
+	closed_.add();
+	if (broken) broken_.add();
+	{
+		std::lock_guard<std::mutex> lock{ lock_ };
+		--size_;
+	}
+	// there is room for a waiting request to open one
+	cv_.notify_one();
+}
+
+std::shared_ptr<bserv::db_connection> db_pool::acquire() {
+	metrics::phase_timer timer{ metrics::phase_pool };
+	auto start = std::chrono::steady_clock::now();
+	std::unique_ptr<slot> s;
+	{
+		std::unique_lock<std::mutex> lock{ lock_ };
+		auto deadline = start + options_.acquire_timeout;
+		while (idle_.empty() && size_ >= options_.max_size) {
+			if (cv_.wait_until(lock, deadline) == std::cv_status::timeout
+				&& idle_.empty() && size_ >= options_.max_size) {
+				timeouts_.add();
+				throw pool_timeout{ "no " + name_ + " database connection became free in time" };
+			}
+		}
+		if (!idle_.empty()) {
+			s = std::move(idle_.back());
+			idle_.pop_back();
+		}
+		else ++size_;
+		++busy_;
+	}
+	if (s == nullptr) {
+		try {
+			s = open();
+		}
+		catch (...) {
+			{
+				std::lock_guard<std::mutex> lock{ lock_ };
+				--size_;
+				--busy_;
+			}
+			cv_.notify_one();
+			throw;
+		}
+	}
+	wait_.record(to_us(std::chrono::steady_clock::now() - start));
+	acquired_.add();
+	slot* raw = s.release();
+	return std::shared_ptr<bserv::db_connection>(raw->conn.get(),
+		[this, raw](bserv::db_connection*) { release(raw); });
+}
+
+void db_pool::release(slot* raw) {
+	std::unique_ptr<slot> s{ raw };
+	{
+		std::lock_guard<std::mutex> lock{ lock_ };
+		--busy_;
+	}
+	// a connection lost during the request is not handed out again
+	if (!s->conn->get().is_open()) {
+		close(std::move(s), true);
+		return;
+	}
+	s->idle_since = std::chrono::steady_clock::now();
+	{
+		std::lock_guard<std::mutex> lock{ lock_ };
+		idle_.push_back(std::move(s));
+	}
+	cv_.notify_one();
+}
+
+void db_pool::check() {
+	std::unique_lock<std::mutex> lock{ lock_ };
+	while (!stop_cv_.wait_for(lock, options_.check_interval, [this]() { return stopping_; })) {
+		// the connections idle for too long are closed (down to
+		// `min_size`), the other idle ones are taken out to be pinged
+		auto now = std::chrono::steady_clock::now();
+		std::vector<std::unique_ptr<slot>> expired;
+		std::vector<std::unique_ptr<slot>> checked;
+		int remaining = size_;
+		for (auto& s : idle_) {
+			if (remaining > options_.min_size && now - s->idle_since >= options_.idle_timeout) {
+				expired.push_back(std::move(s));
+				--remaining;
+			}
+			else checked.push_back(std::move(s));
+		}
+		idle_.clear();
+		lock.unlock();
+
+		for (auto& s : expired) close(std::move(s), false);
+		std::vector<std::unique_ptr<slot>> healthy;
+		for (auto& s : checked) {
+			try {
+				pqxx::nontransaction tx{ s->conn->get() };
+				tx.exec("select 1");
+				healthy.push_back(std::move(s));
+			}
+			catch (const std::exception& e) {
+				lgwarning << name_ << " database connection failed its check: " << e.what();
+				close(std::move(s), true);
+			}
+		}
+		// replaces the broken ones, up to `min_size`
+		int missing;
+		{
+			std::lock_guard<std::mutex> guard{ lock_ };
+			missing = std::max(options_.min_size - size_, 0);
+			size_ += missing;
+		}
+		for (int i = 0; i < missing; ++i) {
+			try {
+				healthy.push_back(open());
+			}
+			catch (const std::exception& e) {
+				lgwarning << "failed to open a " << name_ << " database connection: " << e.what();
+				std::lock_guard<std::mutex> guard{ lock_ };
+				--size_;
+			}
+		}
+
+		lock.lock();
+		// before those released meanwhile, which were used more recently
+		idle_.insert(idle_.begin(),
+			std::make_move_iterator(healthy.begin()),
+			std::make_move_iterator(healthy.end()));
+		cv_.notify_all();
+	}
+}
+
+db_pool::stats db_pool::read() {
+	stats result;
+	{
+		std::lock_guard<std::mutex> lock{ lock_ };
+		result.size = size_;
+		result.busy = busy_;
+	}
+	result.max_size = options_.max_size;
+	result.acquired = acquired_.value();
+	result.timeouts = timeouts_.value();
+	result.opened = opened_.value();
+	result.closed = closed_.value();
+	result.broken = broken_.value();
+	result.wait = wait_.read();
+	return result;
+}
+
+void init_db_pools(const db_pool::options& primary, const db_pool::options& replica) {
+	primary_ = std::make_unique<db_pool>("primary", primary);
+	if (!replica.conn_str.empty()) {
+		replica_ = std::make_unique<db_pool>("replica", replica);
+	}
+}
+
+std::shared_ptr<bserv::db_connection> acquire_db(db_use use) {
+	if (use == db_use::read_only && replica_ != nullptr) return replica_->acquire();
+	return primary_->acquire();
+}
+
+void write_db_pool_metrics(std::ostream& out) {
+	std::vector<std::pair<db_pool*, db_pool::stats>> pools;
+	for (auto pool : { primary_.get(), replica_.get() }) {
+		if (pool != nullptr) pools.emplace_back(pool, pool->read());
+	}
+	auto write = [&](const char* name, const char* type, const char* help, auto value) {
+		out << "# HELP " << name << ' ' << help << '\n'
+			<< "# TYPE " << name << ' ' << type << '\n';
+		for (auto& [pool, s] : pools) {
+			out << name << "{pool=\"" << pool->name() << "\"} " << value(s) << '\n';
+		}
+	};
+	out << "# HELP webapp_db_pool_wait_seconds the time requests waited for a connection\n"
+		<< "# TYPE webapp_db_pool_wait_seconds summary\n";
+	for (auto& [pool, s] : pools) {
+		for (double q : { 0.5, 0.9, 0.99, 0.999 }) {
+			out << "webapp_db_pool_wait_seconds{pool=\"" << pool->name()
+				<< "\",quantile=\"" << q << "\"} " << s.wait.quantile(q) / 1e6 << '\n';
+		}
+		out << "webapp_db_pool_wait_seconds_sum{pool=\"" << pool->name() << "\"} " << s.wait.sum / 1e6 << '\n'
+			<< "webapp_db_pool_wait_seconds_count{pool=\"" << pool->name() << "\"} " << s.wait.count << '\n';
+	}
+	write("webapp_db_pool_connections", "gauge", "the connections open",
+		[](const db_pool::stats& s) { return (double)s.size; });
+	write("webapp_db_pool_max_connections", "gauge", "the most connections the pool opens",
+		[](const db_pool::stats& s) { return (double)s.max_size; });
+	write("webapp_db_pool_busy", "gauge", "the connections in use by requests",
+		[](const db_pool::stats& s) { return (double)s.busy; });
+	write("webapp_db_pool_utilization", "gauge", "the connections in use, out of the most the pool opens",
+		[](const db_pool::stats& s) { return (double)s.busy / s.max_size; });
+	write("webapp_db_pool_acquired_total", "counter", "the connections handed to requests",
+		[](const db_pool::stats& s) { return (double)s.acquired; });
+	write("webapp_db_pool_timeouts_total", "counter", "the requests which got no connection in time",
+		[](const db_pool::stats& s) { return (double)s.timeouts; });
+	write("webapp_db_pool_opened_total", "counter", "the connections opened",
+		[](const db_pool::stats& s) { return (double)s.opened; });
+	write("webapp_db_pool_closed_total", "counter", "the connections closed, idle or broken",
+		[](const db_pool::stats& s) { return (double)s.closed; });
+	write("webapp_db_pool_broken_total", "counter", "the connections found broken",
+		[](const db_pool::stats& s) { return (double)s.broken; });
+}
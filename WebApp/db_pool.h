@@ -0,0 +1,146 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "bserv/common.hpp"
+
+#include "metrics.h"
+
+// the database connections of the routes, in place of bserv's fixed
+// pool (whose waits nothing could see).
+//
+// a pool holds between `min_size` and `max_size` connections: it opens
+// one when a request finds them all busy, and closes those left idle
+// for `idle_timeout`. a background thread pings the idle connections
+// every `check_interval`, so a broken connection is replaced before a
+// request gets it. the time requests wait for a connection is recorded
+// (also as the `pool` phase of their route), and a request that waits
+// longer than `acquire_timeout` fails with `pool_timeout`.
+//
+// with a `replica-conn-str`, the read-only routes get their
+// connections from a second pool on the replica (see `db_use`).
+
+// thrown by `db_pool::acquire` when no connection became free in time
+struct pool_timeout : std::runtime_error {
+	using std::runtime_error::runtime_error;
+};
+
+class db_pool {
+public:
+	struct options {
+		std::string conn_str;
+		int min_size = 1;
+		int max_size = 4;
+		std::chrono::milliseconds acquire_timeout{ 5000 };
+		std::chrono::seconds idle_timeout{ 60 };
+		std::chrono::seconds check_interval{ 30 };
+	};
+	struct stats {
+		int size;
+		int busy;
+		int max_size;
+		std::uint64_t acquired;
+		std::uint64_t timeouts;
+		std::uint64_t opened;
+		std::uint64_t closed;
+		std::uint64_t broken;
+		metrics::histogram::snapshot wait;
+	};
+private:
+	// a connection, through a bserv manager of its own so that it can
+	// be opened and closed alone
+	struct slot {
+		std::unique_ptr<bserv::db_connection_manager> manager;
+		std::shared_ptr<bserv::db_connection> conn;
+		std::chrono::steady_clock::time_point idle_since;
+	};
+	std::string name_;
+	options options_;
+	std::mutex lock_;
+	// signalled when a connection is released or there is room for one
+	std::condition_variable cv_;
+	std::condition_variable stop_cv_;
+	// the most recently used last, so the others are the ones left idle
+	std::vector<std::unique_ptr<slot>> idle_;
+	// open, being opened or being checked
+	int size_ = 0;
+	int busy_ = 0;
+	bool stopping_ = false;
+	metrics::histogram wait_;
+	metrics::counter acquired_;
+	metrics::counter timeouts_;
+	metrics::counter opened_;
+	metrics::counter closed_;
+	metrics::counter broken_;
+	std::thread checker_;
+	std::unique_ptr<slot> open();
+	void close(std::unique_ptr<slot> s, bool broken);
+	void release(slot* s);
+	void check();
+public:
+	db_pool(std::string name, options opts);
+	db_pool(const db_pool&) = delete;
+	db_pool& operator=(const db_pool&) = delete;
+	~db_pool();
+	// blocks until a connection is free (or opened), which goes back to
+	// the pool when the returned pointer is destroyed
+	std::shared_ptr<bserv::db_connection> acquire();
+	const std::string& name() const { return name_; }
+	stats read();
+};
+
+// must be called before the first request. `replica` is optional
+// (an empty `conn_str`).
+void init_db_pools(const db_pool::options& primary, const db_pool::options& replica);
+
+// what a route uses the database for, in place of
+// `bserv::placeholders::db_connection_ptr` in its parameters
+enum class db_use { read_write, read_only };
+
+// a connection of the primary, or for `read_only` of the replica if there is one
+std::shared_ptr<bserv::db_connection> acquire_db(db_use use);
+
+// writes the metrics of the pools in the prometheus text format
+void write_db_pool_metrics(std::ostream& out);
+
+// `pooled<&handler>::call` takes a `db_use` where `handler` takes a
+// connection, and calls `handler` with a connection acquired for it
+template <auto Handler>
+struct pooled;
+
+template <typename Arg>
+struct pooled_arg {
+	using type = Arg;
+};
+
+template <>
+struct pooled_arg<std::shared_ptr<bserv::db_connection>> {
+	using type = db_use;
+};
+
+template <typename Ret, typename ...Args, Ret(*Handler)(Args...)>
+struct pooled<Handler> {
+	template <typename Arg>
+	static decltype(auto) resolve(typename pooled_arg<Arg>::type&& arg) {
+		if constexpr (std::is_same_v<Arg, std::shared_ptr<bserv::db_connection>>) {
+			return acquire_db(arg);
+		}
+		else {
+			return static_cast<typename pooled_arg<Arg>::type&&>(arg);
+		}
+	}
+	static Ret call(typename pooled_arg<Args>::type... args) {
+		return Handler(resolve<Args>(
+			static_cast<typename pooled_arg<Args>::type&&>(args))...);
+	}
+};
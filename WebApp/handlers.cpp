@@ -1,8 +1,31 @@
 #include "handlers.h"
 
 #include <vector>
+#include <algorithm>
+#include <filesystem>
+#include <functional>
+#include <chrono>
+#include <sstream>
+#include <string_view>
+#include <iterator>
 
 #include "rendering.h"
+#include "multipart.h"
+#include "pagination.h"
+#include "statements.h"
+#include "user_cache.h"
+#include "password_hashing.h"
+#include "search_index.h"
+#include "output_cache.h"
+#include "session_store.h"
+#include "metrics.h"
+#include "async_log.h"
+#include "db_pool.h"
+#include "music_stats.h"
+#include "transcoding.h"
+#include "segment_cache.h"
+#include "blob_store.h"
+#include "asset_cache.h"
 
 #include <fstream>
 
@@ -44,13 +67,279 @@ bserv::db_relation_to_object orm_comment{
 	bserv::make_db_field<std::string>("comment_content"),
 };
 
+// the listing pages, see `keyset_pager`
+keyset_pager users_pager{ "auth_user", "id", "is_active = true" };
+keyset_pager music_repo_pager{ "music", "music_id", "is_active = true" };
+keyset_pager applicants_pager{ "auth_user", "id", "is_musician = 1 and is_active = true" };
+
+// user records, read through by `get_user`
+user_cache cached_users;
+
 std::optional<boost::json::object> get_user(
-	bserv::db_transaction& tx,
+	db_work& tx,
 	const boost::json::string& username) {
-	bserv::db_result r = tx.exec(
-		"select * from auth_user where username = ?", username);
-	lginfo << r.query(); // this is how you log info
-	return orm_user.convert_to_optional(r);
+	auto cached = cached_users.get(username.c_str());
+	if (cached.has_value()) {
+		return cached;
+	}
+	auto generation = cached_users.generation();
+	bserv::db_result r = exec_prepared(tx, stmt::get_user, username);
+	lgquery << r.query(); // this is how you log info
+	auto user = orm_user.convert_to_optional(r);
+	if (user.has_value()) {
+		cached_users.put(user.value(), generation);
+	}
+	return user;
+}
+
+std::optional<boost::json::object> get_user(
+	db_work& tx,
+	std::int64_t id) {
+	auto cached = cached_users.get(id);
+	if (cached.has_value()) {
+		return cached;
+	}
+	auto generation = cached_users.generation();
+	bserv::db_result r = exec_prepared(tx, stmt::get_user_by_id, id);
+	lgquery << r.query();
+	auto user = orm_user.convert_to_optional(r);
+	if (user.has_value()) {
+		cached_users.put(user.value(), generation);
+	}
+	return user;
+}
+
+// the sessions of the visitors, kept across restarts (see `init_sessions`).
+// bserv's session is lost when the server restarts, so the token of the
+// visitor's `session_state` is sent in a cookie of our own (see
+// `attach_session`), and copied into bserv's session (as `sid`).
+session_store sessions;
+
+const std::string session_cookie = "music_session";
+
+// whether the cookie is only sent over https
+bool session_cookie_secure = false;
+
+void init_sessions(const std::string& path, std::size_t capacity) {
+	sessions.open(path, capacity);
+}
+
+void set_session_cookie_secure(bool secure) {
+	session_cookie_secure = secure;
+}
+
+namespace {
+
+	// the value of cookie `name` in `request`, empty if there is none
+	std::string request_cookie(const bserv::request_type& request, const std::string& name) {
+		auto range = request.equal_range(bserv::http::field::cookie);
+		for (auto it = range.first; it != range.second; ++it) {
+			std::string_view cookies{ it->value().data(), it->value().size() };
+			while (!cookies.empty()) {
+				auto end = cookies.find(';');
+				auto cookie = cookies.substr(0, end);
+				cookies = end == std::string_view::npos ? std::string_view{} : cookies.substr(end + 1);
+				while (!cookie.empty() && cookie.front() == ' ') cookie.remove_prefix(1);
+				if (cookie.size() > name.size() && cookie[name.size()] == '='
+					&& cookie.substr(0, name.size()) == name) {
+					return std::string{ cookie.substr(name.size() + 1) };
+				}
+			}
+		}
+		return {};
+	}
+
+	void set_session_cookie(bserv::response_type& response, const std::string& token) {
+		response.insert(bserv::http::field::set_cookie,
+			session_cookie + "=" + token + "; Path=/; HttpOnly; SameSite=Lax"
+			+ (session_cookie_secure ? "; Secure" : ""));
+	}
+
+	std::optional<session_token> session_sid(bserv::session_type& session) {
+		if (!session.contains("sid") || !session["sid"].is_string()) return std::nullopt;
+		return session_token::parse(session["sid"].as_string().c_str());
+	}
+
+}
+
+// makes sure the visitor has a session token, which is in `session`
+// afterwards. it must be called before the session is used.
+void attach_session(
+	const bserv::request_type& request,
+	bserv::response_type& response,
+	bserv::session_type& session) {
+	std::string cookie = request_cookie(request, session_cookie);
+	auto sid = session_sid(session);
+	if (sid.has_value()) {
+		// the visitor may have lost the cookie but kept bserv's one
+		if (cookie != session["sid"].as_string().c_str()) {
+			set_session_cookie(response, sid->to_string());
+		}
+		return;
+	}
+	auto token = session_token::parse(cookie);
+	// bserv's session is new (e.g. after a restart). only a token we
+	// issued and still keep is taken, otherwise anyone could choose
+	// the token of someone else's session
+	if (token.has_value() && sessions.get(token.value()).has_value()) {
+		session["sid"] = token->to_string();
+		return;
+	}
+	std::string generated = session_token::generate().to_string();
+	session["sid"] = generated;
+	set_session_cookie(response, generated);
+}
+
+session_state load_session(bserv::session_type& session) {
+	auto sid = session_sid(session);
+	if (sid.has_value()) {
+		auto state = sessions.get(sid.value());
+		if (state.has_value()) {
+			return state.value();
+		}
+	}
+	return {};
+}
+
+void save_session(bserv::session_type& session, const session_state& state) {
+	auto sid = session_sid(session);
+	if (sid.has_value()) {
+		sessions.put(sid.value(), state);
+	}
+}
+
+// stores `state` under a new token, and drops the old one, so that a
+// token known before a change of privileges (a login, a role change)
+// is of no use afterwards
+void renew_session(
+	bserv::response_type& response,
+	bserv::session_type& session,
+	const session_state& state) {
+	auto sid = session_sid(session);
+	auto token = session_token::generate();
+	sessions.put(token, state);
+	if (sid.has_value()) {
+		sessions.erase(sid.value());
+	}
+	session["sid"] = token.to_string();
+	set_session_cookie(response, token.to_string());
+}
+
+void end_session(bserv::session_type& session) {
+	auto sid = session_sid(session);
+	if (sid.has_value()) {
+		sessions.erase(sid.value());
+	}
+}
+
+// copies the id and roles of `user` (a row converted by `orm_user`)
+void set_session_user(session_state& state, boost::json::object& user) {
+	state.user_id = user["id"].as_int64();
+	state.is_superuser = user["is_superuser"].as_bool();
+	state.is_musician = (int)user["is_musician"].as_int64();
+	state.set_username(user["username"].as_string().c_str());
+}
+
+// the `user` of the templates (the navbar and the role checks)
+boost::json::object session_user(const session_state& state) {
+	return {
+		{"id", state.user_id},
+		{"username", state.username},
+		{"is_superuser", state.is_superuser},
+		{"is_musician", state.is_musician}
+	};
+}
+
+// the active music, searched by `search_music`
+search_index music_index;
+
+// the favorite and comment counts of the active music, and their rankings
+music_stats music_counters;
+
+// how many music the rankings of music_repo.html show
+const std::size_t ranking_size = 5;
+
+void init_music_catalogue(const std::string& conn_str, std::chrono::seconds write_back_interval) {
+	pqxx::connection conn{ conn_str };
+	pqxx::nontransaction tx{ conn };
+	// the summary columns miss the changes made since their last
+	// write-back if the server did not exit cleanly, so they are
+	// recounted first, with one grouped count of each table
+	pqxx::result resync = tx.exec(
+		"update music set favorite_count = coalesce(f.n, 0), comment_count = coalesce(c.n, 0) "
+		"from music m "
+		"left join (select music_id, count(*) as n from favorite group by music_id) f using (music_id) "
+		"left join (select music_id, count(*) as n from comment group by music_id) c using (music_id) "
+		"where music.music_id = m.music_id "
+		"and (music.favorite_count, music.comment_count) "
+		"is distinct from (coalesce(f.n, 0), coalesce(c.n, 0))");
+	if (resync.affected_rows() != 0) {
+		lginfo << "music counts: " << resync.affected_rows() << " music recounted";
+	}
+	pqxx::result r = tx.exec(
+		"select music_id, music_name, username, favorite_count, comment_count "
+		"from music join auth_user on music.musician_id = auth_user.id "
+		"where music.is_active = true order by music_id");
+	std::vector<search_index::track> tracks;
+	std::vector<music_stats::entry> counts;
+	tracks.reserve(r.size());
+	counts.reserve(r.size());
+	for (const auto& row : r) {
+		tracks.push_back({
+			row[0].as<int>(),
+			row[1].as<std::string>(),
+			row[2].as<std::string>()
+		});
+		counts.push_back({
+			row[0].as<int>(),
+			row[1].as<std::string>(),
+			row[2].as<std::string>(),
+			row[3].as<std::int64_t>(),
+			row[4].as<std::int64_t>()
+		});
+	}
+	music_index.assign(tracks);
+	lginfo << "search index: " << music_index.size() << " music, "
+		<< music_index.num_terms() << " terms";
+	music_counters.assign(counts);
+	music_counters.start_write_back(conn_str, write_back_interval);
+}
+
+// where uploaded music files are stored
+const std::string music_dir = "../templates/statics/musics/";
+
+void init_music_transcoding(transcoding_options options) {
+	options.music_dir = music_dir;
+	init_transcoding(options);
+	backfill_transcoding();
+}
+
+// the playlists and segments of streamed music, see `serve_stream_part`
+segment_cache stream_cache;
+
+// the part of the cache holding a music's playlist
+const int playlist_part = -1;
+
+void init_stream_cache(std::size_t max_bytes) {
+	stream_cache.set_max_bytes(max_bytes);
+}
+
+// uploads are parsed in chunks of this size, and written to disk
+// through a buffer of `upload_buffer_size` bytes
+const std::size_t upload_chunk_size = 64 * 1024;
+const std::size_t upload_buffer_size = 256 * 1024;
+// the longest non-file form field accepted in an upload
+const std::size_t max_field_size = 1023;
+
+// answers a request refused because the password hashing pool is saturated
+boost::json::object server_busy(
+	bserv::response_type& response) {
+	response.result(bserv::http::status::service_unavailable);
+	response.set(bserv::http::field::retry_after, "1");
+	return {
+		{"success", false},
+		{"message", "server busy, please try again"}
+	};
 }
 
 std::string get_or_empty(
@@ -63,24 +352,25 @@ std::string get_or_empty(
 // the return type should be `std::nullopt_t`,
 // and the return value should be `std::nullopt`.
 std::nullopt_t hello(
+	bserv::request_type& request,
 	bserv::response_type& response,
 	std::shared_ptr<bserv::session_type> session_ptr) {
+	attach_session(request, response, *session_ptr);
 	bserv::session_type& session = *session_ptr;
+	session_state state = load_session(session);
 	boost::json::object obj;
-	if (session.count("user")) {
+	if (state.logged_in()) {
 		// NOTE: modifications to sessions must be performed
 		// BEFORE referencing objects in them. this is because
 		// modifications might invalidate referenced objects.
 		// in this example, "count" might be added to `session`,
 		// which should be performed first.
-		// then `user` can be referenced safely.
 		if (!session.count("count")) {
 			session["count"] = 0;
 		}
-		auto& user = session["user"].as_object();
 		session["count"] = session["count"].as_int64() + 1;
 		obj = {
-			{"welcome", user["username"]},
+			{"welcome", state.username},
 			{"count", session["count"]}
 		};
 	}
@@ -98,6 +388,7 @@ std::nullopt_t hello(
 // is performed automatically.
 boost::json::object user_register(
 	bserv::request_type& request,
+	bserv::response_type& response,
 	// the json object is obtained from the request body,
 	// as well as the url parameters
 	boost::json::object&& params,
@@ -118,7 +409,7 @@ boost::json::object user_register(
 		};
 	}
 	auto username = params["username"].as_string();
-	bserv::db_transaction tx{ conn };
+	db_work tx{ prepared(conn) };
 	auto opt_user = get_user(tx, username);
 	if (opt_user.has_value()) {
 		return {
@@ -127,20 +418,23 @@ boost::json::object user_register(
 		};
 	}
 	auto password = params["password"].as_string();
-	bserv::db_result r = tx.exec(
-		"insert into ? "
-		"(?, password, is_superuser, "
-		"first_name, last_name, email, is_active) values "
-		"(?, ?, ?, ?, ?, ?, ?);", bserv::db_name("auth_user"),
-		bserv::db_name("username"),
+	std::string encoded_password;
+	try {
+		encoded_password = hash_password(password.c_str());
+	}
+	catch (const pool_saturated&) {
+		return server_busy(response);
+	}
+	bserv::db_result r = exec_prepared(tx, stmt::insert_user,
 		username,
-		bserv::utils::security::encode_password(
-			password.c_str()), false,
+		encoded_password, false,
 		get_or_empty(params, "first_name"),
 		get_or_empty(params, "last_name"),
 		get_or_empty(params, "email"), true);
-	lginfo << r.query();
+	lgquery << r.query();
 	tx.commit(); // you must manually commit changes
+	users_pager.add_rows(1);
+	bump_data_version();
 	return {
 		{"success", true},
 		{"message", "user registered"}
@@ -149,9 +443,11 @@ boost::json::object user_register(
 
 boost::json::object user_login(
 	bserv::request_type& request,
+	bserv::response_type& response,
 	boost::json::object&& params,
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr) {
+	attach_session(request, response, *session_ptr);
 	if (request.method() != boost::beast::http::verb::post) {
 		throw bserv::url_not_found_exception{};
 	}
@@ -168,7 +464,7 @@ boost::json::object user_login(
 		};
 	}
 	auto username = params["username"].as_string();
-	bserv::db_transaction tx{ conn };
+	db_work tx{ prepared(conn) };
 	auto opt_user = get_user(tx, username);
 	if (!opt_user.has_value()) {
 		return {
@@ -185,15 +481,23 @@ boost::json::object user_login(
 	}
 	auto password = params["password"].as_string();
 	auto encoded_password = user["password"].as_string();
-	if (!bserv::utils::security::check_password(
-		password.c_str(), encoded_password.c_str())) {
+	bool valid_password;
+	try {
+		valid_password = verify_password(password.c_str(), encoded_password.c_str());
+	}
+	catch (const pool_saturated&) {
+		return server_busy(response);
+	}
+	if (!valid_password) {
 		return {
 			{"success", false},
 			{"message", "invalid username/password"}
 		};
 	}
 	bserv::session_type& session = *session_ptr;
-	session["user"] = user;
+	session_state state = load_session(session);
+	set_session_user(state, user);
+	renew_session(response, session, state);
 	return {
 		{"success", true},
 		{"message", "login successfully"}
@@ -203,7 +507,7 @@ boost::json::object user_login(
 boost::json::object find_user(
 	std::shared_ptr<bserv::db_connection> conn,
 	const std::string& username) {
-	bserv::db_transaction tx{ conn };
+	db_work tx{ prepared(conn) };
 	auto user = get_user(tx, username.c_str());
 	if (!user.has_value()) {
 		return {
@@ -220,11 +524,11 @@ boost::json::object find_user(
 }
 
 boost::json::object user_logout(
+	bserv::request_type& request,
+	bserv::response_type& response,
 	std::shared_ptr<bserv::session_type> session_ptr) {
-	bserv::session_type& session = *session_ptr;
-	if (session.count("user")) {
-		session.erase("user");
-	}
+	attach_session(request, response, *session_ptr);
+	end_session(*session_ptr);
 	return {
 		{"success", true},
 		{"message", "logout successfully"}
@@ -239,15 +543,15 @@ boost::json::object add_music(
 	if (request.method() != boost::beast::http::verb::post) {
 		throw bserv::url_not_found_exception{};
 	}
-	bserv::session_type& session = *session_ptr;
-	if (!session.count("user")) {
+	session_state state = load_session(*session_ptr);
+	if (!state.logged_in()) {
 		return {
 			{"success", false},
 			{"message", "please login first"}
 		};
 	}
-	bserv::db_transaction tx{ conn };
-	auto opt_now_user = get_user(tx, session["user"].as_object()["username"].as_string());
+	db_work tx{ prepared(conn) };
+	auto opt_now_user = get_user(tx, state.user_id);
 	auto& now_user = opt_now_user.value();
 	if (now_user["is_musician"].as_int64() != 2) {
 		return {
@@ -257,22 +561,74 @@ boost::json::object add_music(
 	}
 	auto musician_id = now_user["id"].as_int64();
 
-	std::string music_name = "", music_file = "", music_path = "";
-	std::stringstream ssdata(request.body());
-	std::string tmp;
-	for (int i = 0; i < 3; ++i)
-		std::getline(ssdata, tmp);
-	std::getline(ssdata, tmp);
-	music_name = tmp;
-	if (music_name[music_name.length()-1] == '\r')
-		music_name.erase(music_name.length()-1);
-	lgdebug << "music_name: " << music_name;
-	std::getline(ssdata, tmp);
-	std::getline(ssdata, tmp);
-	tmp.erase(tmp.find_last_of('\"'));
-	tmp = tmp.substr(tmp.find_last_of('\"')+1);
-	music_file = tmp;
-	lgdebug << music_file;
+	auto content_type = request[bserv::http::field::content_type];
+	std::string boundary = get_multipart_boundary(
+		std::string{ content_type.data(), content_type.size() });
+	if (boundary == "") {
+		return {
+			{"success", false},
+			{"message", "`music_file` is required"}
+		};
+	}
+	// the file part is hashed and written to a temporary file while it
+	// is parsed, and stored under its digest once it is complete
+	std::string music_name = "", music_file = "";
+	std::optional<blob_writer> upload;
+	std::string* field = nullptr;
+	bool writing_file = false;
+	multipart_parser parser{ boundary,
+		[&](const multipart_parser::part& part) {
+			field = nullptr;
+			if (part.name == "music_name" && !part.is_file()) {
+				field = &music_name;
+			}
+			else if (part.name == "music_file" && part.is_file() && !upload.has_value()) {
+				music_file = part.filename.substr(part.filename.find_last_of("/\\") + 1);
+				upload.emplace(music_dir, upload_buffer_size);
+				writing_file = true;
+			}
+		},
+		[&](const char* data, std::size_t size) {
+			if (field != nullptr) {
+				if (field->size() + size > max_field_size) {
+					throw multipart_error{ "form field too long" };
+				}
+				field->append(data, size);
+			}
+			else if (writing_file) {
+				upload->write(data, size);
+			}
+		},
+		[&]() {
+			field = nullptr;
+			writing_file = false;
+		}
+	};
+	try {
+		const std::string& body = request.body();
+		for (std::size_t i = 0; i < body.size(); i += upload_chunk_size) {
+			parser.feed(body.data() + i, std::min(upload_chunk_size, body.size() - i));
+		}
+		if (!parser.done()) {
+			throw multipart_error{ "incomplete multipart body" };
+		}
+	}
+	catch (const multipart_error& e) {
+		algdebug << "add music: " << e.what();
+		return {
+			{"success", false},
+			{"message", "invalid upload"}
+		};
+	}
+	catch (const std::runtime_error& e) {
+		lgerror << "failed to write upload: " << e.what();
+		return {
+			{"success", false},
+			{"message", "failed to save music"}
+		};
+	}
+	algdebug << "music_name: " << music_name;
+	algdebug << music_file;
 	if (music_name == "") {
 		return {
 			{"success", false},
@@ -285,87 +641,116 @@ boost::json::object add_music(
 			{"message", "`music_file` is required"}
 		};
 	}
+	auto ext_pos = music_file.find_last_of('.');
+	try {
+		// stored before the music is inserted: a blob nothing refers to
+		// is harmless, and may be shared with another music anyway
+		music_file = upload->commit(ext_pos == std::string::npos ? "" : music_file.substr(ext_pos));
+	}
+	catch (const std::exception& e) {
+		lgerror << "failed to store upload: " << e.what();
+		return {
+			{"success", false},
+			{"message", "failed to save music"}
+		};
+	}
+	algdebug << "music_path: " << music_dir + music_file;
 
-	bserv::db_result db_res = tx.exec("select * from music_music_id_seq;");
-	int seq = 1;
-	if((*db_res.begin())[2].as<bool>())
-		seq = (*db_res.begin())[0].as<int>() + 1;
-	music_file = std::to_string(seq) + music_file.substr(music_file.find_last_of('.'));
-	music_path = "../templates/statics/musics/" + music_file;
-	lgdebug << "music_path: " << music_path;
-
-	bserv::db_result r = tx.exec(
-		"insert into ? "
-		"(musician_id, music_name, music_path)"
-		"values (?, ?, ?);", bserv::db_name("music"),
+	bserv::db_result r = exec_prepared(tx, stmt::insert_music,
 		musician_id,
 		music_name,
 		music_file);
-	lginfo << r.query();
+	lgquery << r.query();
+	int music_id = (*r.begin())[0].as<int>();
 	tx.commit(); // you must manually commit changes
-
-	std::string file_data = request.body();
-	file_data = file_data.substr(file_data.find("Content-Type: "));
-	file_data = file_data.substr(file_data.find('\n')+1);
-	file_data = file_data.substr(file_data.find('\n')+1);
-
-	for (int i = 0; i < 2; ++i) {
-		int pos = file_data.find_last_of('\n');
-		file_data.erase(pos);
+	music_repo_pager.add_rows(1);
+	music_index.add({ music_id, music_name, now_user["username"].as_string().c_str() });
+	music_counters.add(music_id, music_name, now_user["username"].as_string().c_str());
+	bump_data_version();
+	// identical uploads share their blob, and so its processing
+	if (get_media_info(music_file) == nullptr && !submit_transcoding(music_file)) {
+		// picked up by the backfill of the next start
+		lgwarning << "transcoding queue full, not processing " << music_file;
 	}
-	if (file_data[file_data.length() - 1] == '\r')
-		file_data.erase(file_data.length() - 1);
-
-	std::ofstream fout;
-	fout.open(music_path, std::ios::out | std::ios::binary);
-	for (char i : file_data)
-		fout << i;
-	fout.close();
 	return {
 		{"success", true},
 		{"message", "music added"}
 	};
 }
 
-boost::json::object load_music(
-	std::shared_ptr<bserv::db_connection> conn,
-	std::shared_ptr<bserv::session_type> session_ptr,
-	int music_id,
-	boost::json::object &context) {
-	boost::json::object json_music;
-	bserv::db_transaction tx{ conn };
-	bserv::db_result db_res;
-	db_res = tx.exec("select music_id, username musician, music_name, music_path, music.is_active"
-		" from music join auth_user on music.musician_id=auth_user.id where music_id = ?;", music_id);
-	lginfo << db_res.query();
-	auto opt_music = orm_music.convert_to_optional(db_res);
-	if (!opt_music.has_value()) {
-		return {
-			{"success", false},
-			{"message", "no such music"}
-		};
+// a json column, null if the column is null
+boost::json::value parse_json(const pqxx::field& field) {
+	if (field.is_null()) return nullptr;
+	return boost::json::parse(field.c_str());
+}
+
+// the kbit/s the client's connection suits, from its client hints
+// (see `redirect_to_music`): 0 asks for the lowest bitrate, none if
+// the client gave no hints
+std::optional<int> bitrate_budget(const bserv::request_type& request) {
+	if (request["Save-Data"] == "on") return 0;
+	auto ect = request["ECT"];
+	if (ect == "slow-2g") return 32;
+	if (ect == "2g") return 64;
+	if (ect == "3g") return 128;
+	auto downlink = request["Downlink"];
+	if (!downlink.empty()) {
+		try {
+			// Mbit/s, half of it left for the rest of the page
+			return (int)(std::stod(std::string{ downlink.data(), downlink.size() }) * 1000 / 2);
+		}
+		catch (const std::exception&) {}
 	}
-	auto& music = opt_music.value();
-	if (!music["is_active"].as_bool()) {
-		return {
-			{"success", false},
-			{"message", "no such music"}
-		};
+	return std::nullopt;
+}
+
+// "m:ss"
+std::string format_duration(double seconds) {
+	int total = (int)(seconds + 0.5);
+	std::string secs = std::to_string(total % 60);
+	return std::to_string(total / 60) + ":" + (secs.size() == 1 ? "0" : "") + secs;
+}
+
+// the `music` of music.html, from a music as selected by `get_music`
+// (null if there is no such music). the file is the original if it
+// fits `budget`, otherwise the best rendition that does.
+// false if there is no such active music.
+bool set_music(const boost::json::value& row, boost::json::object& context,
+	std::optional<int> budget) {
+	if (!row.is_object() || !row.as_object().at("is_active").as_bool()) {
+		return false;
 	}
-	lgdebug << "music_name: " << music["music_name"].as_string();
-	json_music["music_name"] = music["music_name"].as_string();
-	lgdebug << "musician: " << music["musician"];
-	json_music["musician"] = music["musician"];
-	std::string music_path = "/statics/musics/";
-	music_path += music["music_path"].as_string();
-	lgdebug << "music_path: " << music_path;
+	const auto& music = row.as_object();
+	boost::json::object json_music;
+	algdebug << "music_name: " << music.at("music_name").as_string();
+	json_music["music_name"] = music.at("music_name");
+	algdebug << "musician: " << music.at("musician");
+	json_music["musician"] = music.at("musician");
+	std::string music_file = music.at("music_path").as_string().c_str();
+	auto info = get_media_info(music_file);
+	if (info != nullptr) {
+		if (info->duration > 0) json_music["duration"] = format_duration(info->duration);
+		if (budget.has_value() && !info->renditions.empty()
+			&& (info->bitrate == 0 || info->bitrate > budget.value())) {
+			int bitrate = info->renditions.front();
+			for (int rendition : info->renditions) {
+				if (rendition <= budget.value()) bitrate = rendition;
+			}
+			music_file = rendition_file(music_file, bitrate);
+		}
+		// the segments are cut from the original
+		else if (info->segments != 0) {
+			json_music["playlist"] = "/music/" + std::to_string(music.at("music_id").as_int64())
+				+ "/stream/index.m3u8";
+		}
+	}
+	std::string music_path = "/statics/musics/" + music_file;
+	algdebug << "music_path: " << music_path;
 	json_music["music_path"] = music_path;
-	json_music["music_id"] = music["music_id"].as_int64();
-	bserv::session_type& session = *session_ptr;
-	lgdebug << json_music;
-	session["music"] = json_music;
+	json_music["music_id"] = music.at("music_id").as_int64();
+	algdebug << json_music;
 	context["music"] = json_music;
-	return context;
+	return true;
 }
 
 boost::json::object post_comment(
@@ -377,28 +762,25 @@ boost::json::object post_comment(
 	if (request.method() != boost::beast::http::verb::post) {
 		throw bserv::url_not_found_exception{};
 	}
-	bserv::session_type& session = *session_ptr;
-	boost::json::object json_music = session["music"].as_object();
-	music_id = json_music["music_id"].as_int64();
-	if (!session.count("user")) {
+	session_state state = load_session(*session_ptr);
+	music_id = (int)state.music_id;
+	if (!state.logged_in()) {
 		return {
 			{"success", false},
 			{"message", "please login first"}
 		};
 	}
-	boost::json::object json_user = session["user"].as_object();
-	int user_id = json_user["id"].as_int64();
+	auto user_id = state.user_id;
 	std::time_t now = std::time(NULL);
-	bserv::db_transaction tx{ conn };
-	bserv::db_result r = tx.exec(
-		"insert into comment(user_id, music_id, comment_time, comment_content) values "
-		"(?, ?, to_timestamp(?), ?);",
+	db_work tx{ prepared(conn) };
+	bserv::db_result r = exec_prepared(tx, stmt::insert_comment,
 		user_id,
 		music_id,
 		now,
 		request.body());
-	lginfo << r.query();
+	lgquery << r.query();
 	tx.commit();
+	music_counters.add_comments(music_id, 1);
 	return {
 		{"success", true},
 		{"message", "comment posted"}
@@ -454,10 +836,10 @@ std::nullopt_t ws_echo(
 
 
 std::nullopt_t serve_static_files(
+	bserv::request_type& request,
 	bserv::response_type& response,
 	const std::string& path) {
-	response.set(bserv::http::field::accept_ranges, "bytes");
-	return serve(response, path);
+	return serve(request, response, path);
 }
 
 
@@ -466,18 +848,88 @@ std::nullopt_t index(
 	std::shared_ptr<bserv::session_type> session_ptr,
 	bserv::response_type& response,
 	boost::json::object& context) {
-	bserv::session_type& session = *session_ptr;
-	if (session.contains("user")) {
-		context["user"] = session["user"];
+	session_state state = load_session(*session_ptr);
+	if (state.logged_in() && !context.contains("user")) {
+		context["user"] = session_user(state);
 	}
 	return render(response, template_path, context);
 }
 
+// pages which look the same to every visitor, see `render_shared`
+output_cache shared_pages;
+
+// the navbar (user_nav.html) is the only per-user part of these pages
+const std::string user_slot = "<!--user-nav-->";
+
+// a page version also expires after this long, so that changes not
+// made through this server (which do not bump the data version) show
+// up, and validated copies are not reused forever
+const std::chrono::seconds shared_page_max_age{ 60 };
+
+// serves the page rendered from `template_path` with the context made
+// by `make_context`, which must only depend on the data version.
+// the page is taken from `shared_pages` if it is current, and only
+// the navbar is rendered for the visitor. the strong etag is derived
+// from the key, the versions and the visitor, so a revalidation is
+// answered with 304 without rendering or looking the page up.
+std::nullopt_t render_shared(
+	bserv::request_type& request,
+	bserv::response_type& response,
+	std::shared_ptr<bserv::session_type> session_ptr,
+	const std::string& key,
+	const std::string& template_path,
+	const std::function<boost::json::object()>& make_context) {
+	session_state state = load_session(*session_ptr);
+	boost::json::object user_context;
+	std::string username = "";
+	if (state.logged_in()) {
+		user_context["user"] = session_user(state);
+		username = state.get_username();
+	}
+	auto window = std::chrono::duration_cast<std::chrono::seconds>(
+		std::chrono::system_clock::now().time_since_epoch()) / shared_page_max_age;
+	std::string version = std::to_string(data_version())
+		+ "-" + std::to_string(template_generation())
+		+ "-" + std::to_string(window);
+	std::ostringstream etag;
+	etag << '"' << std::hex << std::hash<std::string>{}(key + '\n' + username)
+		<< '-' << version << '"';
+	response.set(bserv::http::field::etag, etag.str());
+	response.set(bserv::http::field::cache_control, "private, no-cache");
+	auto if_none_match = request[bserv::http::field::if_none_match];
+	if (std::string{ if_none_match.data(), if_none_match.size() }.find(etag.str()) != std::string::npos) {
+		response.result(bserv::http::status::not_modified);
+		response.body().clear();
+		response.prepare_payload();
+		return std::nullopt;
+	}
+	auto parts = shared_pages.get(key, version);
+	if (parts == nullptr) {
+		boost::json::object context = make_context();
+		context["user_slot"] = user_slot;
+		parts = shared_pages.put(key, version,
+			split_slots(render_to_string(template_path, context), user_slot));
+	}
+	std::string nav = render_to_string("user_nav.html", user_context);
+	metrics::phase_timer timer{ metrics::phase_serialize };
+	std::string& body = response.body();
+	body = (*parts)[0];
+	for (std::size_t i = 1; i < parts->size(); ++i) {
+		body += nav;
+		body += (*parts)[i];
+	}
+	response.set(bserv::http::field::content_type, "text/html");
+	response.prepare_payload();
+	return std::nullopt;
+}
+
 std::nullopt_t index_page(
+	bserv::request_type& request,
 	std::shared_ptr<bserv::session_type> session_ptr,
 	bserv::response_type& response) {
-	boost::json::object context;
-	return index("index.html", session_ptr, response, context);
+	attach_session(request, response, *session_ptr);
+	return render_shared(request, response, session_ptr, "index", "index.html",
+		[]() { return boost::json::object{}; });
 }
 
 std::nullopt_t form_login(
@@ -486,17 +938,20 @@ std::nullopt_t form_login(
 	boost::json::object&& params,
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr) {
-	lgdebug << params << std::endl;
-	auto context = user_login(request, std::move(params), conn, session_ptr);
-	lginfo << "login: " << context << std::endl;
+	attach_session(request, response, *session_ptr);
+	algdebug << params << std::endl;
+	auto context = user_login(request, response, std::move(params), conn, session_ptr);
+	alginfo << "login: " << context << std::endl;
 	return index("index.html", session_ptr, response, context);
 }
 
 std::nullopt_t form_logout(
+	bserv::request_type& request,
 	std::shared_ptr<bserv::session_type> session_ptr,
 	bserv::response_type& response) {
-	auto context = user_logout(session_ptr);
-	lginfo << "logout: " << context << std::endl;
+	attach_session(request, response, *session_ptr);
+	auto context = user_logout(request, response, session_ptr);
+	alginfo << "logout: " << context << std::endl;
 	return index("index.html", session_ptr, response, context);
 }
 
@@ -506,159 +961,179 @@ std::nullopt_t redirect_to_users(
 	bserv::response_type& response,
 	int page_id,
 	boost::json::object&& context) {
-	lgdebug << "view users: " << page_id << std::endl;
-	bserv::db_transaction tx{ conn };
-	bserv::db_result db_res = tx.exec("select count(*) from auth_user;");
-	lginfo << db_res.query();
-	std::size_t total_users = (*db_res.begin())[0].as<std::size_t>();
-	lgdebug << "total users: " << total_users << std::endl;
-	int total_pages = (int)total_users / 10;
-	if (total_users % 10 != 0) ++total_pages;
-	lgdebug << "total pages: " << total_pages << std::endl;
-	db_res = tx.exec("select * from auth_user where is_active=true order by id limit 10 offset ?;", (page_id - 1) * 10);
-	lginfo << db_res.query();
-	auto users = orm_user.convert_to_vector(db_res);
+	algdebug << "view users: " << page_id << std::endl;
+	auto page = users_pager.locate(conn, page_id);
+	algdebug << "total users: " << page.total_rows << std::endl;
+	algdebug << "total pages: " << page.total_pages << std::endl;
 	boost::json::array json_users;
-	for (auto& user : users) {
-		json_users.push_back(user);
-	}
-	boost::json::object pagination;
-	if (total_pages != 0) {
-		pagination["total"] = total_pages;
-		if (page_id > 1) {
-			pagination["previous"] = page_id - 1;
-		}
-		if (page_id < total_pages) {
-			pagination["next"] = page_id + 1;
-		}
-		int lower = page_id - 3;
-		int upper = page_id + 3;
-		if (page_id - 3 > 2) {
-			pagination["left_ellipsis"] = true;
+	if (page.after.has_value()) {
+		bserv::db_result db_res = exec_single(prepared(conn), stmt::list_users,
+			page.after.value(), keyset_pager::page_size);
+		lgquery << db_res.query();
+		auto users = orm_user.convert_to_vector(db_res);
+		for (auto& user : users) {
+			json_users.push_back(user);
 		}
-		else {
-			lower = 1;
+		if (!users.empty()) {
+			users_pager.page_ended(page_id, users.back()["id"].as_int64());
 		}
-		if (page_id + 3 < total_pages - 1) {
-			pagination["right_ellipsis"] = true;
-		}
-		else {
-			upper = total_pages;
-		}
-		pagination["current"] = page_id;
-		boost::json::array pages_left;
-		for (int i = lower; i < page_id; ++i) {
-			pages_left.push_back(i);
-		}
-		pagination["pages_left"] = pages_left;
-		boost::json::array pages_right;
-		for (int i = page_id + 1; i <= upper; ++i) {
-			pages_right.push_back(i);
-		}
-		pagination["pages_right"] = pages_right;
-		context["pagination"] = pagination;
+	}
+	if (page.total_pages != 0) {
+		context["pagination"] = make_pagination(page_id, page.total_pages);
 	}
 	context["users"] = json_users;
 	return index("users.html", session_ptr, response, context);
 }
 
-std::nullopt_t redirect_to_music_repo(
+// adds the music on page `page_id` and the pagination to `context`
+void load_music_repo(
 	std::shared_ptr<bserv::db_connection> conn,
-	std::shared_ptr<bserv::session_type> session_ptr,
-	bserv::response_type& response,
 	int page_id,
-	boost::json::object&& context) {
-	lgdebug << "view music_repo: " << page_id << std::endl;
-	bserv::db_transaction tx{ conn };
-	bserv::db_result db_res = tx.exec("select count(*) from music where is_active = true;");
-	lginfo << db_res.query();
-	std::size_t total_music_repo = (*db_res.begin())[0].as<std::size_t>();
-	lgdebug << "total music_repo: " << total_music_repo << std::endl;
-	int total_pages = (int)total_music_repo / 10;
-	if (total_music_repo % 10 != 0) ++total_pages;
-	lgdebug << "total pages: " << total_pages << std::endl;
-	db_res = tx.exec("select music_id, username musician, music_name, music_path, music.is_active"
-		" from music join auth_user on music.musician_id=auth_user.id where music.is_active = true limit 10 offset ?;", (page_id - 1) * 10);
-	lginfo << db_res.query();
-	auto music_repo = orm_music.convert_to_vector(db_res);
+	boost::json::object& context) {
+	algdebug << "view music_repo: " << page_id << std::endl;
+	auto page = music_repo_pager.locate(conn, page_id);
+	algdebug << "total music_repo: " << page.total_rows << std::endl;
+	algdebug << "total pages: " << page.total_pages << std::endl;
 	boost::json::array json_music_repo;
-	for (auto& music : music_repo) {
-		json_music_repo.push_back(music);
-	}
-	boost::json::object pagination;
-	if (total_pages != 0) {
-		pagination["total"] = total_pages;
-		if (page_id > 1) {
-			pagination["previous"] = page_id - 1;
-		}
-		if (page_id < total_pages) {
-			pagination["next"] = page_id + 1;
-		}
-		int lower = page_id - 3;
-		int upper = page_id + 3;
-		if (page_id - 3 > 2) {
-			pagination["left_ellipsis"] = true;
-		}
-		else {
-			lower = 1;
-		}
-		if (page_id + 3 < total_pages - 1) {
-			pagination["right_ellipsis"] = true;
+	if (page.after.has_value()) {
+		bserv::db_result db_res = exec_single(prepared(conn), stmt::list_music,
+			page.after.value(), keyset_pager::page_size);
+		lgquery << db_res.query();
+		auto music_repo = orm_music.convert_to_vector(db_res);
+		if (!music_repo.empty()) {
+			music_repo_pager.page_ended(page_id, music_repo.back()["music_id"].as_int64());
 		}
-		else {
-			upper = total_pages;
+		for (auto& music : music_repo) {
+			auto counts = music_counters.get((int)music["music_id"].as_int64());
+			music["favorites"] = counts.has_value() ? counts.value().favorites : 0;
+			music["comments"] = counts.has_value() ? counts.value().comments : 0;
+			json_music_repo.push_back(music);
 		}
-		pagination["current"] = page_id;
-		boost::json::array pages_left;
-		for (int i = lower; i < page_id; ++i) {
-			pages_left.push_back(i);
-		}
-		pagination["pages_left"] = pages_left;
-		boost::json::array pages_right;
-		for (int i = page_id + 1; i <= upper; ++i) {
-			pages_right.push_back(i);
-		}
-		pagination["pages_right"] = pages_right;
-		context["pagination"] = pagination;
+	}
+	if (page.total_pages != 0) {
+		context["pagination"] = make_pagination(page_id, page.total_pages);
 	}
 	context["music_repo"] = json_music_repo;
+	auto make_ranking = [](music_stats::ranking r) {
+		boost::json::array ranking;
+		for (auto& music : music_counters.top(r, ranking_size)) {
+			ranking.push_back({
+				{"music_id", music.music_id},
+				{"music_name", music.music_name},
+				{"musician", music.musician},
+				{"favorites", music.favorites},
+				{"comments", music.comments}
+			});
+		}
+		return ranking;
+	};
+	context["most_favorited"] = make_ranking(music_stats::by_favorites);
+	context["most_discussed"] = make_ranking(music_stats::by_comments);
+}
+
+std::nullopt_t redirect_to_music_repo(
+	std::shared_ptr<bserv::db_connection> conn,
+	std::shared_ptr<bserv::session_type> session_ptr,
+	bserv::response_type& response,
+	int page_id,
+	boost::json::object&& context) {
+	load_music_repo(conn, page_id, context);
 	return index("music_repo.html", session_ptr, response, context);
 }
 
+// comments are paged by the (comment_time, comment_id) of the last
+// comment on the previous page, newest first
+const int comments_page_size = 20;
+
+struct comment_cursor {
+	std::string comment_time;
+	int comment_id;
+};
+
+// `s` as a row id, none if it is not one
+std::optional<int> parse_id(const std::string& s) {
+	if (s.empty() || s.size() > 9) return std::nullopt;
+	for (char c : s) {
+		if (c < '0' || c > '9') return std::nullopt;
+	}
+	return std::stoi(s);
+}
+
+// returns `comments` and, if there are more, the cursor of the next
+// page as `next`. one more comment than a page is fetched to find out
+// whether there is a next page.
+boost::json::object make_comments_page(boost::json::array comments) {
+	boost::json::object result;
+	if (comments.size() > (std::size_t)comments_page_size) {
+		comments.pop_back();
+		auto& last = comments.back().as_object();
+		result["next"] = {
+			{"before_time", last["comment_time"]},
+			{"before_id", last["comment_id"]}
+		};
+	}
+	result["comments"] = std::move(comments);
+	return result;
+}
+
+boost::json::object load_comments(
+	std::shared_ptr<bserv::db_connection> conn,
+	int music_id,
+	const std::optional<comment_cursor>& before) {
+	bserv::db_result db_res = before.has_value()
+		? exec_single(prepared(conn), stmt::list_comments_before, music_id,
+			before.value().comment_time, before.value().comment_id, comments_page_size + 1)
+		: exec_single(prepared(conn), stmt::list_comments, music_id, comments_page_size + 1);
+	lgquery << db_res.query();
+	boost::json::array comments;
+	for (auto& comment : orm_comment.convert_to_vector(db_res)) {
+		comments.push_back(std::move(comment));
+	}
+	return make_comments_page(std::move(comments));
+}
+
 std::nullopt_t redirect_to_music(
+	const bserv::request_type& request,
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr,
 	bserv::response_type& response,
 	int music_id,
 	boost::json::object&& context) {
-	bserv::session_type& session = *session_ptr;
-	if (!session.count("user")) {
+	session_state state = load_session(*session_ptr);
+	if (!state.logged_in()) {
 		context = {
 			{"success", false},
 			{"message", "please login first"}
 		};
 		return index("index.html", session_ptr, response, context);
 	}
-	auto& now_user = session["user"].as_object();
-
-	lgdebug << "view music: " << music_id << std::endl;
-	load_music(conn, session_ptr, music_id, context);
-	bserv::db_transaction tx{ conn };
-	bserv::db_result db_res = tx.exec("select comment_id, username, comment_time, comment_content"
-		" from comment join auth_user on comment.user_id=auth_user.id where music_id = ? order by comment_time desc;", music_id);
-	lginfo << db_res.query();
-	auto comments = orm_comment.convert_to_vector(db_res);
-	boost::json::array json_comments;
-	for (auto& comment : comments) {
-		lgdebug << comment;
-		json_comments.push_back(comment);
-	}
-	context["comments"] = json_comments;
-
-	db_res = tx.exec("select create_time from favorite where user_id=? and music_id=?", now_user["id"].as_int64(), music_id);
-	lginfo << db_res.query();
-	context["is_favorite"] = !(*db_res.begin())[0].is_null();
-	session["is_favorite"] = context["is_favorite"];
+
+	algdebug << "view music: " << music_id << std::endl;
+	// the music, its comments and the favorite in one round trip.
+	// only the first page of comments is rendered,
+	// the page loads the rest from `/music/<int>/comments`
+	bserv::db_result db_res = exec_single(prepared(conn), stmt::music_page,
+		music_id, state.user_id, comments_page_size + 1);
+	lgquery << db_res.query();
+	auto row = db_res[0];
+	bool found = set_music(parse_json(row[0]), context, bitrate_budget(request));
+	auto comments_page = make_comments_page(parse_json(row[1]).as_array());
+	context["comments"] = comments_page["comments"];
+	if (comments_page.contains("next")) {
+		context["comments_next"] = comments_page["next"];
+	}
+	bool is_favorite = row[2].as<bool>();
+	context["is_favorite"] = is_favorite;
+	// comments and favorites go to the music last viewed,
+	// which must exist and be active
+	if (found) {
+		state.music_id = music_id;
+		state.is_favorite = is_favorite;
+		save_session(*session_ptr, state);
+	}
+	// asks for the hints `bitrate_budget` reads
+	response.set("Accept-CH", "Save-Data, ECT, Downlink");
+	response.set(bserv::http::field::vary, "Save-Data, ECT, Downlink");
 	return index("music.html", session_ptr, response, context);
 }
 
@@ -667,48 +1142,49 @@ std::nullopt_t redirect_to_profile(
 	std::shared_ptr<bserv::session_type> session_ptr,
 	bserv::response_type& response,
 	boost::json::object&& context) {
-	bserv::session_type& session = *session_ptr;
-	if (!session.count("user")) {
+	session_state state = load_session(*session_ptr);
+	if (!state.logged_in()) {
 		context = {
 			{"success", false},
 			{"message", "please login first"}
 		};
 		return index("userprofile.html", session_ptr, response, context);
 	}
-	auto& now_user = session["user"].as_object();
-	auto now_username = now_user["username"].as_string();
-	bserv::db_transaction tx{ conn };
-	auto opt_user = get_user(tx, now_username);
-	auto& user = opt_user.value();
-	session["user"] = user;
-	bserv::db_result db_res = tx.exec("select favorite.music_id, username, music_name, music_path, music.is_active"
-		" from favorite join music on favorite.music_id=music.music_id join auth_user on music.musician_id=auth_user.id"
-		" where user_id = ? and music.is_active=true order by create_time desc;", user["id"].as_int64());
-	lginfo << db_res.query();
-	auto favorite = orm_music.convert_to_vector(db_res);
-	boost::json::array json_favorite;
-	for (auto& music : favorite) {
-		json_favorite.push_back(music);
-	}
-	context["favorite"] = json_favorite;
-	db_res = tx.exec("select music_id, username, music_name, music_path, music.is_active"
-		" from music join auth_user on music.musician_id=auth_user.id"
-		" where id = ? and music.is_active=true order by music_id;", user["id"].as_int64());
-	lginfo << db_res.query();
-	auto mymusic = orm_music.convert_to_vector(db_res);
-	boost::json::array json_mymusic;
-	for (auto& music : mymusic) {
-		json_mymusic.push_back(music);
-	}
-	context["mymusic"] = json_mymusic;
+	// the user, its favorites and its music in one round trip
+	bserv::db_result db_res = exec_single(prepared(conn), stmt::profile_page, state.user_id);
+	lgquery << db_res.query();
+	auto row = db_res[0];
+	if (row[0].is_null()) {
+		end_session(*session_ptr);
+		context = {
+			{"success", false},
+			{"message", "please login first"}
+		};
+		return index("userprofile.html", session_ptr, response, context);
+	}
+	boost::json::object user = parse_json(row[0]).as_object();
+	// the roles might have been changed by a superuser
+	session_state previous = state;
+	set_session_user(state, user);
+	if (state.is_superuser != previous.is_superuser || state.is_musician != previous.is_musician) {
+		renew_session(response, *session_ptr, state);
+	}
+	else save_session(*session_ptr, state);
+	boost::json::object json_user = user;
+	json_user.erase("password");
+	context["user"] = json_user;
+	context["favorite"] = parse_json(row[1]);
+	context["mymusic"] = parse_json(row[2]);
 	return index("userprofile.html", session_ptr, response, context);
 }
 
 std::nullopt_t view_users(
+	bserv::request_type& request,
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr,
 	bserv::response_type& response,
 	const std::string& page_num) {
+	attach_session(request, response, *session_ptr);
 	int page_id = std::stoi(page_num);
 	boost::json::object context;
 	return redirect_to_users(conn, session_ptr, response, page_id, std::move(context));
@@ -720,18 +1196,26 @@ std::nullopt_t form_add_user(
 	boost::json::object&& params,
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr) {
-	boost::json::object context = user_register(request, std::move(params), conn);
+	attach_session(request, response, *session_ptr);
+	boost::json::object context = user_register(request, response, std::move(params), conn);
 	return index("index.html", session_ptr, response, context);
 }
 
 std::nullopt_t view_music_repo(
+	bserv::request_type& request,
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr,
 	bserv::response_type& response,
 	const std::string& page_num) {
+	attach_session(request, response, *session_ptr);
 	int page_id = std::stoi(page_num);
-	boost::json::object context;
-	return redirect_to_music_repo(conn, session_ptr, response, page_id, std::move(context));
+	return render_shared(request, response, session_ptr,
+		"music_repo/" + std::to_string(page_id), "music_repo.html",
+		[&]() {
+			boost::json::object context;
+			load_music_repo(conn, page_id, context);
+			return context;
+		});
 }
 
 std::nullopt_t form_add_music(
@@ -740,17 +1224,257 @@ std::nullopt_t form_add_music(
 	boost::json::object&& params,
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr) {
+	attach_session(request, response, *session_ptr);
 	boost::json::object context = add_music(request, std::move(params), conn, session_ptr);
 	return redirect_to_music_repo(conn, session_ptr, response, 1, std::move(context));
 }
 
 std::nullopt_t view_music(
+	bserv::request_type& request,
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr,
 	bserv::response_type& response,
 	const std::string& music_id) {
+	attach_session(request, response, *session_ptr);
 	boost::json::object context;
-	return redirect_to_music(conn, session_ptr, response, std::stoi(music_id), std::move(context));
+	return redirect_to_music(request, conn, session_ptr, response, std::stoi(music_id), std::move(context));
+}
+
+// the playlist (`playlist_part`) or a segment of a music, from memory
+// when it is there. the parts never change, so they are cached by
+// clients too, and revalidated by the music and part alone, as long
+// as the music is active (`music_counters` holds the active music).
+// a cached part is still copied into the response, as bserv only sends
+// string bodies: the cache saves the database lookup and the disk read.
+std::nullopt_t serve_stream_part(
+	const bserv::request_type& request,
+	bserv::response_type& response,
+	int music_id,
+	int part) {
+	if (!music_counters.get(music_id).has_value()) {
+		throw bserv::url_not_found_exception{};
+	}
+	std::string etag = "\"" + std::to_string(music_id) + "." + std::to_string(part) + "\"";
+	response.set(bserv::http::field::etag, etag);
+	response.set(bserv::http::field::cache_control, "public, max-age=86400");
+	if (request[bserv::http::field::if_none_match] == etag) {
+		response.result(bserv::http::status::not_modified);
+		response.prepare_payload();
+		return std::nullopt;
+	}
+	auto content = stream_cache.get(music_id, part);
+	if (content == nullptr) {
+		std::string music_file;
+		{
+			// taken from the pool here, so that a hit never waits for one
+			auto conn = prepared(acquire_db(db_use::read_only));
+			bserv::db_result r = exec_single(conn, stmt::get_music, music_id);
+			lgquery << r.query();
+			if (r.size() == 0 || !r[0][4].as<bool>()) {
+				throw bserv::url_not_found_exception{};
+			}
+			music_file = r[0][3].as<std::string>();
+		}
+		std::string path = music_dir
+			+ (part == playlist_part ? playlist_file(music_file) : segment_file(music_file, part));
+		std::ifstream fin{ path, std::ios::binary };
+		if (!fin) {
+			// not processed yet, or not an mp3 file
+			throw bserv::url_not_found_exception{};
+		}
+		content = stream_cache.put(music_id, part, std::string{
+			std::istreambuf_iterator<char>{ fin }, std::istreambuf_iterator<char>{} });
+		// the music may have been deleted meanwhile, after its parts were dropped
+		if (!music_counters.get(music_id).has_value()) {
+			stream_cache.erase(music_id);
+			throw bserv::url_not_found_exception{};
+		}
+	}
+	response.set(bserv::http::field::content_type,
+		part == playlist_part ? "application/vnd.apple.mpegurl" : "audio/mpeg");
+	response.body() = *content;
+	response.prepare_payload();
+	return std::nullopt;
+}
+
+std::nullopt_t view_music_playlist(
+	bserv::request_type& request,
+	bserv::response_type& response,
+	const std::string& music_id) {
+	return serve_stream_part(request, response, std::stoi(music_id), playlist_part);
+}
+
+std::nullopt_t view_music_segment(
+	bserv::request_type& request,
+	bserv::response_type& response,
+	const std::string& music_id,
+	const std::string& segment) {
+	return serve_stream_part(request, response, std::stoi(music_id), std::stoi(segment));
+}
+
+boost::json::object view_music_comments(
+	bserv::request_type& request,
+	bserv::response_type& response,
+	std::shared_ptr<bserv::db_connection> conn,
+	std::shared_ptr<bserv::session_type> session_ptr,
+	boost::json::object&& params,
+	const std::string& music_id) {
+	attach_session(request, response, *session_ptr);
+	if (!load_session(*session_ptr).logged_in()) {
+		return {
+			{"success", false},
+			{"message", "please login first"}
+		};
+	}
+	std::optional<comment_cursor> before;
+	std::string before_time = get_or_empty(params, "before_time");
+	std::string before_id = get_or_empty(params, "before_id");
+	if (before_time != "" && before_id != "") {
+		auto comment_id = parse_id(before_id);
+		if (!comment_id.has_value()) {
+			return {
+				{"success", false},
+				{"message", "invalid cursor"}
+			};
+		}
+		before = comment_cursor{ before_time, comment_id.value() };
+	}
+	boost::json::object result;
+	try {
+		result = load_comments(conn, std::stoi(music_id), before);
+	}
+	// `before_time` is not a timestamp
+	catch (const pqxx::data_exception&) {
+		return {
+			{"success", false},
+			{"message", "invalid cursor"}
+		};
+	}
+	result["success"] = true;
+	return result;
+}
+
+// at most this many results are returned by `search_music`
+const std::size_t max_search_results = 50;
+
+boost::json::object search_music(
+	boost::json::object&& params) {
+	std::string query = get_or_empty(params, "q");
+	std::size_t limit = 20;
+	std::string str_limit = get_or_empty(params, "limit");
+	if (str_limit != "") {
+		limit = std::min<std::size_t>(std::stoul(str_limit), max_search_results);
+	}
+	boost::json::array results;
+	for (auto& track : music_index.search(query, limit)) {
+		results.push_back({
+			{"music_id", track.music_id},
+			{"music_name", track.music_name},
+			{"musician", track.musician}
+		});
+	}
+	return {
+		{"success", true},
+		{"results", results}
+	};
+}
+
+std::nullopt_t metrics_page(
+	bserv::response_type& response) {
+	std::ostringstream out;
+	out.precision(15);
+	metrics::write_routes(out);
+	write_db_pool_metrics(out);
+	auto templates = get_template_cache_stats();
+	metrics::write_value(out, "webapp_template_cache_hits_total", "counter",
+		"the templates found parsed", (double)templates.hits);
+	metrics::write_value(out, "webapp_template_cache_misses_total", "counter",
+		"the templates parsed", (double)templates.misses);
+	metrics::write_value(out, "webapp_template_reloads_total", "counter",
+		"the times the parsed templates were dropped", (double)templates.reloads);
+	metrics::write_value(out, "webapp_template_cache_size", "gauge",
+		"the parsed templates", (double)templates.size);
+	auto assets = get_asset_cache_stats();
+	metrics::write_value(out, "webapp_asset_cache_assets", "gauge",
+		"the static assets held in memory", (double)assets.assets);
+	metrics::write_value(out, "webapp_asset_cache_bytes", "gauge",
+		"the bytes of the static assets and their variants", (double)assets.bytes);
+	metrics::write_value(out, "webapp_asset_cache_hits_total", "counter",
+		"the static assets served from memory", (double)assets.hits);
+	metrics::write_value(out, "webapp_asset_cache_not_modified_total", "counter",
+		"the static assets answered with 304", (double)assets.not_modified);
+	metrics::write_value(out, "webapp_asset_cache_gzip_total", "counter",
+		"the static assets served gzipped", (double)assets.gzip);
+	metrics::write_value(out, "webapp_asset_cache_brotli_total", "counter",
+		"the static assets served brotli compressed", (double)assets.brotli);
+	auto& hashing = get_password_hashing_pool();
+	metrics::write_value(out, "webapp_hash_pool_threads", "gauge",
+		"the threads hashing passwords", (double)hashing.num_threads());
+	metrics::write_value(out, "webapp_hash_pool_busy", "gauge",
+		"the passwords being hashed", (double)hashing.busy());
+	metrics::write_value(out, "webapp_hash_pool_queue_depth", "gauge",
+		"the passwords waiting to be hashed", (double)hashing.queue_depth());
+	metrics::write_value(out, "webapp_hash_pool_max_queue_depth", "gauge",
+		"the deepest the hashing queue has been", (double)hashing.max_queue_depth());
+	metrics::write_value(out, "webapp_hash_pool_completed_total", "counter",
+		"the passwords hashed", (double)hashing.completed());
+	metrics::write_value(out, "webapp_hash_pool_rejected_total", "counter",
+		"the hashes refused because the queue was full", (double)hashing.rejected());
+	metrics::write_value(out, "webapp_hash_in_flight", "gauge",
+		"the hashes network threads are waiting for", (double)password_hashes_in_flight());
+	metrics::write_value(out, "webapp_hash_refused_total", "counter",
+		"the hashes refused because too many were in flight", (double)password_hashes_refused());
+	metrics::write_value(out, "webapp_user_cache_hits_total", "counter",
+		"the users found in the cache", (double)cached_users.hits());
+	metrics::write_value(out, "webapp_user_cache_misses_total", "counter",
+		"the users loaded from the database", (double)cached_users.misses());
+	metrics::write_value(out, "webapp_output_cache_hits_total", "counter",
+		"the shared pages served from the cache", (double)shared_pages.hits());
+	metrics::write_value(out, "webapp_output_cache_misses_total", "counter",
+		"the shared pages rendered", (double)shared_pages.misses());
+	metrics::write_value(out, "webapp_output_cache_size", "gauge",
+		"the shared pages cached", (double)shared_pages.size());
+	metrics::write_value(out, "webapp_search_index_music", "gauge",
+		"the music in the search index", (double)music_index.size());
+	metrics::write_value(out, "webapp_search_index_terms", "gauge",
+		"the terms in the search index", (double)music_index.num_terms());
+	metrics::write_value(out, "webapp_music_counts_pending", "gauge",
+		"the music whose changed counts are not written back yet", (double)music_counters.pending());
+	metrics::write_value(out, "webapp_music_counts_written_total", "counter",
+		"the music counts written back", (double)music_counters.written());
+	metrics::write_value(out, "webapp_music_counts_write_failures_total", "counter",
+		"the failed write-backs of the music counts", (double)music_counters.write_failures());
+	auto& transcoding = get_transcoding_pool();
+	metrics::write_value(out, "webapp_transcode_pool_busy", "gauge",
+		"the music files being processed", (double)transcoding.busy());
+	metrics::write_value(out, "webapp_transcode_pool_queue_depth", "gauge",
+		"the music files waiting to be processed", (double)transcoding.queue_depth());
+	metrics::write_value(out, "webapp_transcode_pool_rejected_total", "counter",
+		"the music files not queued because the queue was full", (double)transcoding.rejected());
+	metrics::write_value(out, "webapp_stream_cache_hits_total", "counter",
+		"the stream parts served from memory", (double)stream_cache.hits());
+	metrics::write_value(out, "webapp_stream_cache_misses_total", "counter",
+		"the stream parts read from disk", (double)stream_cache.misses());
+	metrics::write_value(out, "webapp_stream_cache_bytes", "gauge",
+		"the bytes of the stream parts in memory", (double)stream_cache.bytes());
+	metrics::write_value(out, "webapp_blobs_stored_total", "counter",
+		"the music files stored", (double)blobs_stored());
+	metrics::write_value(out, "webapp_blobs_deduplicated_total", "counter",
+		"the uploads already stored", (double)blobs_deduplicated());
+	metrics::write_value(out, "webapp_transcoded_total", "counter",
+		"the music files processed", (double)transcoded());
+	metrics::write_value(out, "webapp_transcode_failures_total", "counter",
+		"the music files which failed to process", (double)transcoding_failures());
+	metrics::write_value(out, "webapp_session_capacity", "gauge",
+		"the sessions the session store has room for", (double)sessions.capacity());
+	metrics::write_value(out, "webapp_log_written_total", "counter",
+		"the asynchronous log records written", (double)async_log::written());
+	metrics::write_value(out, "webapp_log_dropped_total", "counter",
+		"the asynchronous log records dropped because a ring buffer was full", (double)async_log::dropped());
+	response.set(bserv::http::field::content_type, "text/plain; version=0.0.4");
+	response.body() = out.str();
+	response.prepare_payload();
+	return std::nullopt;
 }
 
 std::nullopt_t form_post_comment(
@@ -759,9 +1483,10 @@ std::nullopt_t form_post_comment(
 	boost::json::object&& params,
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr) {
+	attach_session(request, response, *session_ptr);
 	int music_id;
 	boost::json::object context = post_comment(request, conn, session_ptr, std::move(params), music_id);
-	return redirect_to_music(conn, session_ptr, response, music_id, std::move(context));
+	return redirect_to_music(request, conn, session_ptr, response, music_id, std::move(context));
 }
 
 std::nullopt_t form_delete_comment(
@@ -770,41 +1495,44 @@ std::nullopt_t form_delete_comment(
 	boost::json::object&& params,
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr) {
+	attach_session(request, response, *session_ptr);
 	boost::json::object context;
 	//ǷΪ߻superuser
-	bserv::session_type& session = *session_ptr;
-	if (!session.count("user")) {
+	session_state state = load_session(*session_ptr);
+	if (!state.logged_in()) {
 		context = {
 			{"success", false},
 			{"message", "please login first"}
 		};
-		return redirect_to_music(conn, session_ptr, response, session["music"].as_object()["music_id"].as_int64(), std::move(context));
+		return redirect_to_music(request, conn, session_ptr, response, (int)state.music_id, std::move(context));
 	}
-	bserv::db_transaction tx{ conn };
-	auto opt_now_user = get_user(tx, session["user"].as_object()["username"].as_string());
+	db_work tx{ prepared(conn) };
+	auto opt_now_user = get_user(tx, state.user_id);
 	auto& now_user = opt_now_user.value();
 	std::string str_comment_id = get_or_empty(params, "delete_comment");
-	lgdebug << "delete: " << str_comment_id;
+	algdebug << "delete: " << str_comment_id;
 	int comment_id = std::stoi(str_comment_id);
-	bserv::db_result db_res = tx.exec("select user_id from comment where comment_id = ?;", comment_id);
-	lginfo << db_res.query();
+	bserv::db_result db_res = exec_prepared(tx, stmt::get_comment_owner, comment_id);
+	lgquery << db_res.query();
 	int comment_user_id = (*db_res.begin())[0].as<int>();
+	int comment_music_id = (*db_res.begin())[1].as<int>();
 	if (!(now_user["id"].as_int64() == comment_user_id || now_user["is_superuser"].as_bool())) {
 		context = {
 			{"success", false},
 			{"message", "not allowed"}
 		};
 		tx.abort();
-		return redirect_to_music(conn, session_ptr, response, session["music"].as_object()["music_id"].as_int64(), std::move(context));
+		return redirect_to_music(request, conn, session_ptr, response, (int)state.music_id, std::move(context));
 	}
-	db_res = tx.exec("delete from comment where comment_id=?;", comment_id);
-	lginfo << db_res.query();
+	db_res = exec_prepared(tx, stmt::delete_comment, comment_id);
+	lgquery << db_res.query();
 	context = {
 		{"success", true},
 		{"message", "comment deleted"}
 	};
 	tx.commit();
-	return redirect_to_music(conn, session_ptr, response, session["music"].as_object()["music_id"].as_int64(), std::move(context));
+	music_counters.add_comments(comment_music_id, -(std::int64_t)db_res.affected_rows());
+	return redirect_to_music(request, conn, session_ptr, response, (int)state.music_id, std::move(context));
 }
 
 std::nullopt_t form_process_favorite(
@@ -813,18 +1541,24 @@ std::nullopt_t form_process_favorite(
 	boost::json::object&& params,
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr) {
+	attach_session(request, response, *session_ptr);
 	boost::json::object context;
-	lgdebug << request.body();
-	bserv::session_type& session = *session_ptr;
-	bool is_favorite = session["is_favorite"].as_bool();
-	auto& now_user = session["user"].as_object();
-	auto& now_music = session["music"].as_object();
-	bserv::db_transaction tx{ conn };
+	algdebug << request.body();
+	session_state state = load_session(*session_ptr);
+	if (!state.logged_in()) {
+		context = {
+			{"success", false},
+			{"message", "please login first"}
+		};
+		return index("index.html", session_ptr, response, context);
+	}
+	db_work tx{ prepared(conn) };
 	bserv::db_result db_res;
-	if (is_favorite) {
-		db_res = tx.exec("delete from favorite where user_id=? and music_id=?;", now_user["id"].as_int64(), now_music["music_id"].as_int64());
-		lginfo << db_res.query();
+	if (state.is_favorite) {
+		db_res = exec_prepared(tx, stmt::delete_favorite, state.user_id, state.music_id);
+		lgquery << db_res.query();
 		tx.commit();
+		music_counters.add_favorites((int)state.music_id, -(std::int64_t)db_res.affected_rows());
 		context = {
 			{"success", true},
 			{"message", "music deleted from favorite"}
@@ -832,22 +1566,25 @@ std::nullopt_t form_process_favorite(
 	}
 	else {
 		std::time_t now = std::time(NULL);
-		db_res = tx.exec("insert into favorite values(?,?,to_timestamp(?));", now_user["id"].as_int64(), now_music["music_id"].as_int64(), now);
-		lginfo << db_res.query();
+		db_res = exec_prepared(tx, stmt::insert_favorite, state.user_id, state.music_id, now);
+		lgquery << db_res.query();
 		tx.commit();
+		music_counters.add_favorites((int)state.music_id, (std::int64_t)db_res.affected_rows());
 		context = {
 			{"success", true},
 			{"message", "music added to favorite"}
 		};
 	}
-	return redirect_to_music(conn, session_ptr, response, now_music["music_id"].as_int64(), std::move(context));
+	return redirect_to_music(request, conn, session_ptr, response, (int)state.music_id, std::move(context));
 }
 
 
 std::nullopt_t view_profile(											
+	bserv::request_type& request,
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr,
 	bserv::response_type& response) {
+	attach_session(request, response, *session_ptr);
 	boost::json::object context;
 	return redirect_to_profile(conn, session_ptr, response, std::move(context));
 }
@@ -855,6 +1592,7 @@ std::nullopt_t view_profile(
 
 boost::json::object delete_account(
 	bserv::request_type& request,
+	bserv::response_type& response,
 	boost::json::object&& params,
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr) {
@@ -874,7 +1612,7 @@ boost::json::object delete_account(
 		};
 	}
 	auto username = params["username"].as_string();
-	bserv::db_transaction tx{ conn };
+	db_work tx{ prepared(conn) };
 	auto opt_user = get_user(tx, username);
 	if (!opt_user.has_value()) {
 		return {
@@ -891,25 +1629,30 @@ boost::json::object delete_account(
 	}
 	auto password = params["password"].as_string();
 	auto encoded_password = user["password"].as_string();
-	if (!bserv::utils::security::check_password(
-		password.c_str(), encoded_password.c_str())) {
+	bool valid_password;
+	try {
+		valid_password = verify_password(password.c_str(), encoded_password.c_str());
+	}
+	catch (const pool_saturated&) {
+		return server_busy(response);
+	}
+	if (!valid_password) {
 		return {
 			{"success", false},
 			{"message", "invalid username/password"}
 		};
 	}
 
-	bserv::db_result r = tx.exec(
-		"update auth_user "
-		"set is_active = 'false'"
-		"where username = ?", username);
-	lginfo << r.query();
+	bserv::db_result r = exec_prepared(tx, stmt::deactivate_user, username);
+	lgquery << r.query();
 	tx.commit();
+	cached_users.invalidate(username.c_str());
+	users_pager.add_rows(-(std::int64_t)r.affected_rows());
+	// the user may or may not have been an applicant
+	applicants_pager.invalidate();
+	bump_data_version();
 
-	bserv::session_type& session = *session_ptr;
-	if (session.count("user")) {
-		session.erase("user");
-	}
+	end_session(*session_ptr);
 
 	return {
 		{"success", true},
@@ -923,9 +1666,10 @@ std::nullopt_t form_delete_account(
 	boost::json::object&& params,
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr) {
-	lgdebug << params << std::endl;
-	auto context = delete_account(request, std::move(params), conn, session_ptr);
-	lginfo << "deleted: " << context << std::endl;
+	attach_session(request, response, *session_ptr);
+	algdebug << params << std::endl;
+	auto context = delete_account(request, response, std::move(params), conn, session_ptr);
+	alginfo << "deleted: " << context << std::endl;
 	return index("index.html", session_ptr, response, context);
 }
 
@@ -934,16 +1678,20 @@ boost::json::object process_application(
 	boost::json::object&& params,
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr) {
-	bserv::session_type& session = *session_ptr;
-	auto& now_user = session["user"].as_object();
-	auto username = now_user["username"].as_string();
-	bserv::db_transaction tx{ conn };
-	bserv::db_result r = tx.exec(
-		"update auth_user "
-		"set is_musician = '1' "
-		"where username = ?", username);
-	lginfo << r.query();
+	session_state state = load_session(*session_ptr);
+	if (!state.logged_in()) {
+		return {
+			{"success", false},
+			{"message", "please login first"}
+		};
+	}
+	db_work tx{ prepared(conn) };
+	bserv::db_result r = exec_prepared(tx, stmt::apply_for_musician, state.user_id);
+	lgquery << r.query();
 	tx.commit();
+	cached_users.invalidate(state.user_id);
+	applicants_pager.invalidate();
+	bump_data_version();
 	return {
 		{"success", true},
 		{"message", "application to be a musician success!"}
@@ -956,9 +1704,10 @@ std::nullopt_t apply_for_musician(
 	boost::json::object&& params,
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr) {
-	lgdebug << params << std::endl;
+	attach_session(request, response, *session_ptr);
+	algdebug << params << std::endl;
 	auto context = process_application(request, std::move(params), conn, session_ptr);
-	lginfo << "apply for musician: " << context << std::endl;
+	alginfo << "apply for musician: " << context << std::endl;
 	return redirect_to_profile(conn, session_ptr, response, std::move(context));
 }
 
@@ -969,16 +1718,16 @@ std::nullopt_t redirect_to_applicant(
 	bserv::response_type& response,
 	int page_id,
 	boost::json::object&& context) {
-	bserv::session_type& session = *session_ptr;
-	if (!session.count("user")) {
+	session_state state = load_session(*session_ptr);
+	if (!state.logged_in()) {
 		context = {
 			{"success", false},
 			{"message", "please login first"}
 		};
 		return index("index.html", session_ptr, response, context);
 	}
-	bserv::db_transaction tx{ conn };
-	auto opt_now_user = get_user(tx, session["user"].as_object()["username"].as_string());
+	db_work tx{ prepared(conn) };
+	auto opt_now_user = get_user(tx, state.user_id);
 	auto& now_user = opt_now_user.value();
 	if (!now_user["is_superuser"].as_bool()) {
 		context = {
@@ -987,66 +1736,37 @@ std::nullopt_t redirect_to_applicant(
 		};
 		return index("index.html", session_ptr, response, context);
 	}
-	lgdebug << "view users: " << page_id << std::endl;
-	bserv::db_result db_res = tx.exec("select count(*) from auth_user;");
-	lginfo << db_res.query();
-	std::size_t total_users = (*db_res.begin())[0].as<std::size_t>();
-	lgdebug << "total users: " << total_users << std::endl;
-	int total_pages = (int)total_users / 10;
-	if (total_users % 10 != 0) ++total_pages;
-	lgdebug << "total pages: " << total_pages << std::endl;
-	db_res = tx.exec("select * from auth_user where is_musician = '1' and is_active=true limit 10 offset ?;", (page_id - 1) * 10);
-	lginfo << db_res.query();
-	auto users = orm_user.convert_to_vector(db_res);
+	algdebug << "view applicants: " << page_id << std::endl;
+	auto page = applicants_pager.locate(tx.get(), page_id);
+	algdebug << "total applicants: " << page.total_rows << std::endl;
+	algdebug << "total pages: " << page.total_pages << std::endl;
 	boost::json::array json_users;
-	for (auto& user : users) {
-		json_users.push_back(user);
-	}
-	boost::json::object pagination;
-	if (total_pages != 0) {
-		pagination["total"] = total_pages;
-		if (page_id > 1) {
-			pagination["previous"] = page_id - 1;
-		}
-		if (page_id < total_pages) {
-			pagination["next"] = page_id + 1;
-		}
-		int lower = page_id - 3;
-		int upper = page_id + 3;
-		if (page_id - 3 > 2) {
-			pagination["left_ellipsis"] = true;
+	if (page.after.has_value()) {
+		bserv::db_result db_res = exec_prepared(tx, stmt::list_applicants,
+			page.after.value(), keyset_pager::page_size);
+		lgquery << db_res.query();
+		auto users = orm_user.convert_to_vector(db_res);
+		for (auto& user : users) {
+			json_users.push_back(user);
 		}
-		else {
-			lower = 1;
+		if (!users.empty()) {
+			applicants_pager.page_ended(page_id, users.back()["id"].as_int64());
 		}
-		if (page_id + 3 < total_pages - 1) {
-			pagination["right_ellipsis"] = true;
-		}
-		else {
-			upper = total_pages;
-		}
-		pagination["current"] = page_id;
-		boost::json::array pages_left;
-		for (int i = lower; i < page_id; ++i) {
-			pages_left.push_back(i);
-		}
-		pagination["pages_left"] = pages_left;
-		boost::json::array pages_right;
-		for (int i = page_id + 1; i <= upper; ++i) {
-			pages_right.push_back(i);
-		}
-		pagination["pages_right"] = pages_right;
-		context["pagination"] = pagination;
+	}
+	if (page.total_pages != 0) {
+		context["pagination"] = make_pagination(page_id, page.total_pages);
 	}
 	context["applicants"] = json_users;
 	return index("superuser.html", session_ptr, response, context);
 }
 
 std::nullopt_t manage_applications(
+	bserv::request_type& request,
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr,
 	bserv::response_type& response,
 	const std::string& page_num) {
+	attach_session(request, response, *session_ptr);
 	int page_id = std::stoi(page_num);
 	boost::json::object context;
 	return redirect_to_applicant(conn, session_ptr, response, page_id, std::move(context));
@@ -1058,8 +1778,8 @@ boost::json::object modify_musician(
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr,
 	int temp) {
-	bserv::session_type& session = *session_ptr;
-	if (!session.count("user")) {
+	session_state state = load_session(*session_ptr);
+	if (!state.logged_in()) {
 		return {
 			{"success", false},
 			{"message", "please login first"}
@@ -1074,8 +1794,8 @@ boost::json::object modify_musician(
 	std::string str_user_id = get_or_empty(params, "user_id");
 	auto user_id = std::stoi(str_user_id);
 
-	bserv::db_transaction tx{ conn };
-	auto opt_now_user = get_user(tx, session["user"].as_object()["username"].as_string());
+	db_work tx{ prepared(conn) };
+	auto opt_now_user = get_user(tx, state.user_id);
 	auto& now_user = opt_now_user.value();
 	if (!now_user["is_superuser"].as_bool()) {
 		return {
@@ -1084,12 +1804,12 @@ boost::json::object modify_musician(
 		};
 	}
 	
-	bserv::db_result r = tx.exec(
-		"update auth_user "
-		"set is_musician = ?"
-		"where id = ?", temp, user_id);
-	lginfo << r.query();
+	bserv::db_result r = exec_prepared(tx, stmt::set_musician, temp, user_id);
+	lgquery << r.query();
 	tx.commit();
+	cached_users.invalidate((std::int64_t)user_id);
+	applicants_pager.invalidate();
+	bump_data_version();
 	return {
 		{"success", true},
 		{"message", "modified successfully"}
@@ -1102,9 +1822,10 @@ std::nullopt_t reject_application(
 	boost::json::object&& params,
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr) {
-	lgdebug << params << std::endl;
+	attach_session(request, response, *session_ptr);
+	algdebug << params << std::endl;
 	auto context = modify_musician(request, std::move(params), conn, session_ptr, 0);
-	lginfo << "reject: " << context << std::endl;
+	alginfo << "reject: " << context << std::endl;
 	return redirect_to_applicant(conn, session_ptr, response, 1, std::move(context));
 }
 
@@ -1114,9 +1835,10 @@ std::nullopt_t pass_application(
 	boost::json::object&& params,
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr) {
-	lgdebug << params << std::endl;
+	attach_session(request, response, *session_ptr);
+	algdebug << params << std::endl;
 	auto context = modify_musician(request, std::move(params), conn, session_ptr, 2);
-	lginfo << "reject: " << context << std::endl;
+	alginfo << "reject: " << context << std::endl;
 	return redirect_to_applicant(conn, session_ptr, response, 1, std::move(context));
 }
 
@@ -1128,42 +1850,34 @@ boost::json::object change_profile(
 	if (request.method() != boost::beast::http::verb::post) {
 		throw bserv::url_not_found_exception{};
 	}
-	bserv::session_type& session = *session_ptr;
-	if (!session.count("user")) {
+	session_state state = load_session(*session_ptr);
+	if (!state.logged_in()) {
 		return{
 			{"success", false},
 			{"message", "please login first"}
 		};
 	}
-	auto& now_user = session["user"].as_object();
-	auto now_user_id = now_user["id"].as_int64();
-	bserv::db_transaction tx{ conn };
+	auto now_user_id = state.user_id;
+	db_work tx{ prepared(conn) };
 	bserv::db_result r;
 	if (get_or_empty(params, "first_name") != "") {
-		r = tx.exec(
-			"update auth_user "
-			"set first_name = ? "
-			"where id = ?",
+		r = exec_prepared(tx, stmt::set_first_name,
 			get_or_empty(params, "first_name"), now_user_id);
-		lginfo << r.query();
+		lgquery << r.query();
 	}
 	if (get_or_empty(params, "last_name") != "") {
-		r = tx.exec(
-			"update auth_user "
-			"set last_name = ? "
-			"where id = ?",
+		r = exec_prepared(tx, stmt::set_last_name,
 			get_or_empty(params, "last_name"), now_user_id);
-		lginfo << r.query();
+		lgquery << r.query();
 	}
 	if (get_or_empty(params, "email") != "") {
-		r = tx.exec(
-			"update auth_user "
-			"set email = ? "
-			"where id = ?",
+		r = exec_prepared(tx, stmt::set_email,
 			get_or_empty(params, "email"), now_user_id);
-		lginfo << r.query();
+		lgquery << r.query();
 	}
 	tx.commit();
+	cached_users.invalidate((std::int64_t)now_user_id);
+	bump_data_version();
 
 	return {
 		{"success", true},
@@ -1177,6 +1891,7 @@ std::nullopt_t form_change_profile(
 	boost::json::object&& params,
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr) {
+	attach_session(request, response, *session_ptr);
 	boost::json::object context = change_profile(request, std::move(params), conn, session_ptr);
 	return redirect_to_profile(conn, session_ptr, response, std::move(context));
 }
@@ -1187,24 +1902,25 @@ std::nullopt_t delete_music(
 	boost::json::object&& params,
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr) {
+	attach_session(request, response, *session_ptr);
 	boost::json::object context;
 	//ǷΪ߻superuser
-	bserv::session_type& session = *session_ptr;
-	if (!session.count("user")) {
+	session_state state = load_session(*session_ptr);
+	if (!state.logged_in()) {
 		context = {
 			{"success", false},
 			{"message", "please login first"}
 		};
 		return index("index.html", session_ptr, response, context);
 	}
-	bserv::db_transaction tx{ conn };
-	auto opt_now_user = get_user(tx, session["user"].as_object()["username"].as_string());
+	db_work tx{ prepared(conn) };
+	auto opt_now_user = get_user(tx, state.user_id);
 	auto& now_user = opt_now_user.value();
 	std::string str_music_id = get_or_empty(params, "delete_music_id");
-	lgdebug << "delete: " << str_music_id;
+	algdebug << "delete: " << str_music_id;
 	int music_id = std::stoi(str_music_id);
-	bserv::db_result db_res = tx.exec("select musician_id from music where music_id = ?;", music_id);
-	lginfo << db_res.query();
+	bserv::db_result db_res = exec_prepared(tx, stmt::get_music_owner, music_id);
+	lgquery << db_res.query();
 	int music_user_id = (*db_res.begin())[0].as<int>();
 	if (!(now_user["id"].as_int64() == music_user_id || now_user["is_superuser"].as_bool())) {
 		context = {
@@ -1212,14 +1928,19 @@ std::nullopt_t delete_music(
 			{"message", "not allowed"}
 		};
 		tx.abort();
-		return redirect_to_music(conn, session_ptr, response, session["music"].as_object()["music_id"].as_int64(), std::move(context));
+		return redirect_to_music(request, conn, session_ptr, response, (int)state.music_id, std::move(context));
 	}
-	db_res = tx.exec("update music set is_active=false where music_id=?;", music_id);
-	lginfo << db_res.query();
+	db_res = exec_prepared(tx, stmt::deactivate_music, music_id);
+	lgquery << db_res.query();
 	context = {
 		{"success", true},
 		{"message", "music deleted"}
 	};
 	tx.commit();
+	music_repo_pager.add_rows(-(std::int64_t)db_res.affected_rows());
+	music_index.remove(music_id);
+	music_counters.remove(music_id);
+	stream_cache.erase(music_id);
+	bump_data_version();
 	return redirect_to_profile(conn, session_ptr, response, std::move(context));
 }
\ No newline at end of file
@@ -2,22 +2,28 @@
 
 #include <boost/json.hpp>
 
+#include <chrono>
 #include <string>
 #include <memory>
 #include <optional>
 
 #include "bserv/common.hpp"
+
+#include "transcoding.h"
 std::nullopt_t hello(
+    bserv::request_type& request,
     bserv::response_type& response,
     std::shared_ptr<bserv::session_type> session_ptr);
 
 boost::json::object user_register(
     bserv::request_type& request,
+    bserv::response_type& response,
     boost::json::object&& params,
     std::shared_ptr<bserv::db_connection> conn);
 
 boost::json::object user_login(
     bserv::request_type& request,
+    bserv::response_type& response,
     boost::json::object&& params,
     std::shared_ptr<bserv::db_connection> conn,
     std::shared_ptr<bserv::session_type> session_ptr);
@@ -27,6 +33,8 @@ boost::json::object find_user(
     const std::string& username);
 
 boost::json::object user_logout(
+    bserv::request_type& request,
+    bserv::response_type& response,
     std::shared_ptr<bserv::session_type> session_ptr);
 
 boost::json::object send_request(
@@ -43,10 +51,12 @@ std::nullopt_t ws_echo(
     std::shared_ptr<bserv::websocket_server> ws_server);
 
 std::nullopt_t serve_static_files(
+    bserv::request_type& request,
     bserv::response_type& response,
     const std::string& path);
 
 std::nullopt_t index_page(
+    bserv::request_type& request,
     std::shared_ptr<bserv::session_type> session_ptr,
     bserv::response_type& response);
 
@@ -58,10 +68,12 @@ std::nullopt_t form_login(
     std::shared_ptr<bserv::session_type> session_ptr);
 
 std::nullopt_t form_logout(
+    bserv::request_type& request,
     std::shared_ptr<bserv::session_type> session_ptr,
     bserv::response_type& response);
 
 std::nullopt_t view_users(
+    bserv::request_type& request,
     std::shared_ptr<bserv::db_connection> conn,
     std::shared_ptr<bserv::session_type> session_ptr,
     bserv::response_type& response,
@@ -75,6 +87,7 @@ std::nullopt_t form_add_user(
     std::shared_ptr<bserv::session_type> session_ptr);
 
 std::nullopt_t view_music_repo(
+    bserv::request_type& request,
     std::shared_ptr<bserv::db_connection> conn,
     std::shared_ptr<bserv::session_type> session_ptr,
     bserv::response_type& response,
@@ -88,11 +101,61 @@ std::nullopt_t form_add_music(
     std::shared_ptr<bserv::session_type> session_ptr);
 
 std::nullopt_t view_music(
+    bserv::request_type& request,
     std::shared_ptr<bserv::db_connection> conn,
     std::shared_ptr<bserv::session_type> session_ptr,
     bserv::response_type& response,
     const std::string& music_id);
 
+// the next page of comments, as json
+boost::json::object view_music_comments(
+    bserv::request_type& request,
+    bserv::response_type& response,
+    std::shared_ptr<bserv::db_connection> conn,
+    std::shared_ptr<bserv::session_type> session_ptr,
+    boost::json::object&& params,
+    const std::string& music_id);
+
+// the hls playlist of a music, and its segments (see transcoding.h),
+// from the stream cache when they are there. they take a database
+// connection only to look a part up when it is not.
+std::nullopt_t view_music_playlist(
+    bserv::request_type& request,
+    bserv::response_type& response,
+    const std::string& music_id);
+
+std::nullopt_t view_music_segment(
+    bserv::request_type& request,
+    bserv::response_type& response,
+    const std::string& music_id,
+    const std::string& segment);
+
+// loads the search index and the music counts from the database,
+// before the server starts, and starts writing the changed counts back
+// every `write_back_interval`
+void init_music_catalogue(const std::string& conn_str, std::chrono::seconds write_back_interval);
+
+// processes the uploaded music in the background (see transcoding.h),
+// starting with the music files not processed yet
+void init_music_transcoding(transcoding_options options);
+
+// keeps at most `max_bytes` of streamed music in memory
+void init_stream_cache(std::size_t max_bytes);
+
+// keeps the sessions in the file `path` (created if needed), so that
+// they survive restarts, with room for `capacity` sessions
+void init_sessions(const std::string& path, std::size_t capacity);
+
+// adds `Secure` to the session cookie, for a server behind https
+void set_session_cookie_secure(bool secure);
+
+boost::json::object search_music(
+    boost::json::object&& params);
+
+// the route latencies and the cache statistics, for prometheus
+std::nullopt_t metrics_page(
+    bserv::response_type& response);
+
 std::nullopt_t form_post_comment(
     bserv::request_type& request,
     bserv::response_type& response,
@@ -114,6 +177,7 @@ std::nullopt_t form_process_favorite(
     std::shared_ptr<bserv::db_connection> conn,
     std::shared_ptr<bserv::session_type> session_ptr);
 std::nullopt_t view_profile(
+    bserv::request_type& request,
     std::shared_ptr<bserv::db_connection> conn,
     std::shared_ptr<bserv::session_type> session_ptr,
     bserv::response_type& response);
@@ -130,6 +194,7 @@ std::nullopt_t apply_for_musician(
     std::shared_ptr<bserv::db_connection> conn,
     std::shared_ptr<bserv::session_type> session_ptr);
 std::nullopt_t manage_applications(
+    bserv::request_type& request,
     std::shared_ptr<bserv::db_connection> conn,
     std::shared_ptr<bserv::session_type> session_ptr,
     bserv::response_type& response,
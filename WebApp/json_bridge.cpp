@@ -0,0 +1,40 @@
+#include "json_bridge.h"
+
+#include <string>
+
+inja::json to_inja_json(const boost::json::value& value) {
+	switch (value.kind()) {
+	case boost::json::kind::bool_:
+		return value.get_bool();
+	case boost::json::kind::int64:
+		return value.get_int64();
+	case boost::json::kind::uint64:
+		return value.get_uint64();
+	case boost::json::kind::double_:
+		return value.get_double();
+	case boost::json::kind::string: {
+		const auto& str = value.get_string();
+		return std::string{ str.data(), str.size() };
+	}
+	case boost::json::kind::array: {
+		const auto& arr = value.get_array();
+		inja::json data = inja::json::array();
+		auto& items = data.get_ref<inja::json::array_t&>();
+		items.reserve(arr.size());
+		for (const auto& item : arr)
+			items.push_back(to_inja_json(item));
+		return data;
+	}
+	case boost::json::kind::object:
+		return to_inja_json(value.get_object());
+	default:
+		return nullptr;
+	}
+}
+
+inja::json to_inja_json(const boost::json::object& obj) {
+	inja::json data = inja::json::object();
+	for (const auto& kv : obj)
+		data.emplace(std::string{ kv.key().data(), kv.key().size() }, to_inja_json(kv.value()));
+	return data;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <boost/json.hpp>
+#include <inja/inja.hpp>
+
+// converts a `boost::json::value` into the data tree used by inja
+// (`nlohmann::json`) by walking it directly, rather than serializing
+// it into text and parsing the text again.
+inja::json to_inja_json(const boost::json::value& value);
+
+inja::json to_inja_json(const boost::json::object& obj);
@@ -0,0 +1,191 @@
+#include "metrics.h"
+
+#include <deque>
+#include <mutex>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace metrics {
+
+	namespace {
+
+		std::mutex routes_lock_;
+		// a deque, so that the registered routes never move
+		std::deque<route> routes_;
+
+		thread_local request_scope* current_request_ = nullptr;
+
+		std::size_t floor_log2(std::uint64_t v) {
+#if defined(_MSC_VER)
+			unsigned long index;
+			_BitScanReverse64(&index, v);
+			return index;
+#else
+			return 63 - __builtin_clzll(v);
+#endif
+		}
+
+		std::uint64_t to_us(std::chrono::steady_clock::duration d) {
+			return (std::uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+		}
+
+		// prometheus label values are quoted, with `\`, `"` and newlines escaped
+		std::string escape_label(const std::string& value) {
+			std::string escaped;
+			for (char c : value) {
+				if (c == '\\' || c == '"') escaped += '\\';
+				if (c == '\n') escaped += "\\n";
+				else escaped += c;
+			}
+			return escaped;
+		}
+
+		const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+	}
+
+	std::size_t stripe_index() {
+		static std::atomic<std::size_t> next_stripe{ 0 };
+		thread_local std::size_t index = next_stripe++ % num_stripes;
+		return index;
+	}
+
+	std::int64_t counter::value() const {
+		std::int64_t total = 0;
+		for (auto& s : stripes_) total += s.value.load(std::memory_order_relaxed);
+		return total;
+	}
+
+	std::size_t histogram::bucket_of(std::uint64_t us) {
+		if (us < sub_buckets) return (std::size_t)us;
+		std::size_t exponent = floor_log2(us);
+		if (exponent >= max_exponent) return num_buckets - 1;
+		return sub_buckets * (exponent - 2) + (std::size_t)((us >> (exponent - 3)) & (sub_buckets - 1));
+	}
+
+	std::uint64_t histogram::lower_bound(std::size_t i) {
+		if (i < sub_buckets) return i;
+		std::size_t exponent = i / sub_buckets + 2;
+		return (std::uint64_t)(sub_buckets + i % sub_buckets) << (exponent - 3);
+	}
+
+	histogram::snapshot histogram::read() const {
+		snapshot result;
+		for (auto& s : stripes_) {
+			for (std::size_t i = 0; i < num_buckets; ++i) {
+				result.counts[i] += s.counts[i].load(std::memory_order_relaxed);
+			}
+			result.sum += s.sum.load(std::memory_order_relaxed);
+		}
+		for (auto count : result.counts) result.count += count;
+		return result;
+	}
+
+	double histogram::snapshot::quantile(double q) const {
+		if (count == 0) return 0;
+		std::uint64_t rank = (std::uint64_t)(q * (count - 1)) + 1;
+		std::uint64_t seen = 0;
+		for (std::size_t i = 0; i < num_buckets; ++i) {
+			seen += counts[i];
+			if (seen >= rank) {
+				if (i < sub_buckets) return (double)i;
+				return (lower_bound(i) + lower_bound(i + 1)) / 2.0;
+			}
+		}
+		return (double)lower_bound(num_buckets - 1);
+	}
+
+	const char* phase_name(phase p) {
+		switch (p) {
+		case phase_pool: return "pool";
+		case phase_db: return "db";
+		case phase_render: return "render";
+		case phase_serialize: return "serialize";
+		default: return "unknown";
+		}
+	}
+
+	route& add_route(const std::string& path) {
+		std::lock_guard<std::mutex> lock{ routes_lock_ };
+		return routes_.emplace_back(path);
+	}
+
+	request_scope::request_scope(route& r)
+		: route_{ r },
+		start_{ std::chrono::steady_clock::now() },
+		outer_{ current_request_ },
+		exceptions_{ std::uncaught_exceptions() } {
+		route_.in_flight.add(1);
+		current_request_ = this;
+	}
+
+	request_scope::~request_scope() {
+		auto elapsed = std::chrono::steady_clock::now() - start_;
+		current_request_ = outer_;
+		route_.in_flight.add(-1);
+		route_.requests.add();
+		if (std::uncaught_exceptions() > exceptions_) route_.errors.add();
+		route_.total.record(to_us(elapsed));
+		for (std::size_t p = 0; p < num_phases; ++p) {
+			route_.phases[p].record(to_us(phases_[p]));
+		}
+	}
+
+	request_scope* current_request() {
+		return current_request_;
+	}
+
+	counter& static_bytes() {
+		static counter bytes;
+		return bytes;
+	}
+
+	void write_value(std::ostream& out, const char* name, const char* type,
+		const char* help, double value) {
+		out << "# HELP " << name << ' ' << help << '\n'
+			<< "# TYPE " << name << ' ' << type << '\n'
+			<< name << ' ' << value << '\n';
+	}
+
+	void write_routes(std::ostream& out) {
+		std::lock_guard<std::mutex> lock{ routes_lock_ };
+		auto write_summary = [&](const std::string& labels, const histogram& h) {
+			auto s = h.read();
+			for (double q : quantiles) {
+				out << "webapp_request_duration_seconds{" << labels
+					<< ",quantile=\"" << q << "\"} " << s.quantile(q) / 1e6 << '\n';
+			}
+			out << "webapp_request_duration_seconds_sum{" << labels << "} " << s.sum / 1e6 << '\n'
+				<< "webapp_request_duration_seconds_count{" << labels << "} " << s.count << '\n';
+		};
+		out << "# HELP webapp_request_duration_seconds the time spent on requests, "
+			"in total, waiting for a db connection, and on the db, the templates and serialization\n"
+			<< "# TYPE webapp_request_duration_seconds summary\n";
+		for (auto& r : routes_) {
+			std::string route_label = "route=\"" + escape_label(r.path) + "\"";
+			write_summary(route_label + ",phase=\"total\"", r.total);
+			for (std::size_t p = 0; p < num_phases; ++p) {
+				write_summary(route_label + ",phase=\"" + phase_name((phase)p) + "\"", r.phases[p]);
+			}
+		}
+		auto write_counter = [&](const char* name, const char* type, const char* help,
+			counter route::* member) {
+			out << "# HELP " << name << ' ' << help << '\n'
+				<< "# TYPE " << name << ' ' << type << '\n';
+			for (auto& r : routes_) {
+				out << name << "{route=\"" << escape_label(r.path) << "\"} "
+					<< (r.*member).value() << '\n';
+			}
+		};
+		write_counter("webapp_requests_total", "counter", "the requests handled", &route::requests);
+		write_counter("webapp_request_errors_total", "counter",
+			"the requests that ended with an exception", &route::errors);
+		write_counter("webapp_requests_in_flight", "gauge",
+			"the requests being handled", &route::in_flight);
+		write_value(out, "webapp_static_bytes_total", "counter",
+			"the bytes of static files sent", (double)static_bytes().value());
+	}
+
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// low-overhead instrumentation of the routes, exported in the
+// prometheus text format by `/metrics`.
+//
+// recording never locks: every counter is split into `num_stripes`
+// cache-line sized stripes, and a thread only adds (relaxed) to its
+// own stripe, so as long as there are no more than `num_stripes`
+// threads they never touch the same cache line. reading sums the
+// stripes, which is only done by the exporter.
+namespace metrics {
+
+	constexpr std::size_t num_stripes = 16;
+
+	// the stripe of the calling thread
+	std::size_t stripe_index();
+
+	class counter {
+	private:
+		struct alignas(64) stripe {
+			std::atomic<std::int64_t> value{ 0 };
+		};
+		std::array<stripe, num_stripes> stripes_;
+	public:
+		void add(std::int64_t n = 1) {
+			stripes_[stripe_index()].value.fetch_add(n, std::memory_order_relaxed);
+		}
+		std::int64_t value() const;
+	};
+
+	// latencies in microseconds, in log-linear buckets (as in hdr
+	// histograms): exact below 8 us, then 8 buckets per power of two,
+	// so a quantile is off by at most 12.5%. values from 2^26 us
+	// (about 67 s) on are counted in the last bucket.
+	class histogram {
+	public:
+		static constexpr std::size_t sub_buckets = 8;
+		static constexpr std::size_t max_exponent = 26;
+		static constexpr std::size_t num_buckets = sub_buckets * (max_exponent - 2);
+		struct snapshot {
+			std::array<std::uint64_t, num_buckets> counts{};
+			std::uint64_t count = 0;
+			std::uint64_t sum = 0;
+			// in microseconds, the middle of the bucket holding quantile `q`
+			double quantile(double q) const;
+		};
+	private:
+		struct alignas(64) stripe {
+			std::array<std::atomic<std::uint64_t>, num_buckets> counts{};
+			std::atomic<std::uint64_t> sum{ 0 };
+		};
+		std::array<stripe, num_stripes> stripes_;
+	public:
+		static std::size_t bucket_of(std::uint64_t us);
+		// the values of bucket `i` are in [lower_bound(i), lower_bound(i + 1))
+		static std::uint64_t lower_bound(std::size_t i);
+		void record(std::uint64_t us) {
+			auto& s = stripes_[stripe_index()];
+			s.counts[bucket_of(us)].fetch_add(1, std::memory_order_relaxed);
+			s.sum.fetch_add(us, std::memory_order_relaxed);
+		}
+		snapshot read() const;
+	};
+
+	// what the time of a request is spent on, apart from the handler's own work
+	enum phase {
+		// waiting for a database connection
+		phase_pool,
+		phase_db,
+		// the templates
+		phase_render,
+		// converting the contexts for the templates and assembling bodies
+		phase_serialize,
+		num_phases
+	};
+
+	const char* phase_name(phase p);
+
+	struct route {
+		std::string path;
+		histogram total;
+		std::array<histogram, num_phases> phases;
+		counter requests;
+		counter errors;
+		counter in_flight;
+		explicit route(std::string path) : path{ std::move(path) } {}
+	};
+
+	// registers a route, the returned reference stays valid
+	route& add_route(const std::string& path);
+
+	// measures a request of `r` (with the phases recorded meanwhile on
+	// this thread), from construction to destruction. a request that
+	// ends with an exception is counted as an error.
+	class request_scope {
+	private:
+		route& route_;
+		std::chrono::steady_clock::time_point start_;
+		std::array<std::chrono::steady_clock::duration, num_phases> phases_{};
+		request_scope* outer_;
+		int exceptions_;
+	public:
+		explicit request_scope(route& r);
+		request_scope(const request_scope&) = delete;
+		request_scope& operator=(const request_scope&) = delete;
+		~request_scope();
+		void add(phase p, std::chrono::steady_clock::duration d) { phases_[p] += d; }
+	};
+
+	// the request being measured on this thread, if any
+	request_scope* current_request();
+
+	// adds the time from construction to destruction to phase `p` of the
+	// current request. outside of a request it does nothing.
+	class phase_timer {
+	private:
+		phase phase_;
+		request_scope* request_;
+		std::chrono::steady_clock::time_point start_;
+	public:
+		explicit phase_timer(phase p) : phase_{ p }, request_{ current_request() } {
+			if (request_ != nullptr) start_ = std::chrono::steady_clock::now();
+		}
+		phase_timer(const phase_timer&) = delete;
+		phase_timer& operator=(const phase_timer&) = delete;
+		~phase_timer() {
+			if (request_ != nullptr)
+				request_->add(phase_, std::chrono::steady_clock::now() - start_);
+		}
+	};
+
+	// the bytes of static files sent
+	counter& static_bytes();
+
+	// `instrumented<&handler>::call` has the signature of `handler` and
+	// measures every call as a request of `metrics`, which must be set
+	// before the first call.
+	template <auto Handler>
+	struct instrumented;
+
+	template <typename Ret, typename ...Args, Ret(*Handler)(Args...)>
+	struct instrumented<Handler> {
+		static inline route* metrics = nullptr;
+		static Ret call(Args... args) {
+			request_scope scope{ *metrics };
+			return Handler(std::forward<Args>(args)...);
+		}
+	};
+
+	// writes the routes and `static_bytes` in the prometheus text format
+	void write_routes(std::ostream& out);
+
+	// writes a single sample, with its help and type lines
+	void write_value(std::ostream& out, const char* name, const char* type,
+		const char* help, double value);
+
+}
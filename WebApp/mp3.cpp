@@ -0,0 +1,153 @@
+#include "mp3.h"
+
+#include <algorithm>
+
+namespace mp3 {
+
+	namespace {
+
+		// layer iii bitrates by version (mpeg 1, then mpeg 2 and 2.5) and index
+		const int bitrates[2][16] = {
+			{ 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0 },
+			{ 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0 }
+		};
+
+		const int mpeg1_sample_rates[3] = { 44100, 48000, 32000 };
+
+		std::uint32_t read_u32(std::string_view data, std::size_t offset) {
+			auto p = (const unsigned char*)data.data() + offset;
+			return ((std::uint32_t)p[0] << 24) | ((std::uint32_t)p[1] << 16)
+				| ((std::uint32_t)p[2] << 8) | (std::uint32_t)p[3];
+		}
+
+		// the frame count of the xing/info or vbri tag in the first frame, 0 if none
+		std::uint64_t tagged_frames(std::string_view frame, const frame_header& h) {
+			std::size_t xing = 4 + h.side_info;
+			if (frame.size() >= xing + 12) {
+				auto id = frame.substr(xing, 4);
+				if ((id == "Xing" || id == "Info") && (read_u32(frame, xing + 4) & 1)) {
+					return read_u32(frame, xing + 8);
+				}
+			}
+			// vbri is always 32 bytes after the side information of mpeg 1 stereo
+			const std::size_t vbri = 4 + 32;
+			if (frame.size() >= vbri + 18 && frame.substr(vbri, 4) == "VBRI") {
+				return read_u32(frame, vbri + 14);
+			}
+			return 0;
+		}
+
+	}
+
+	std::optional<frame_header> parse_header(std::string_view data) {
+		if (data.size() < 4) return std::nullopt;
+		auto p = (const unsigned char*)data.data();
+		if (p[0] != 0xff || (p[1] & 0xe0) != 0xe0) return std::nullopt;
+		int version = (p[1] >> 3) & 3; // 3: mpeg 1, 2: mpeg 2, 0: mpeg 2.5
+		int layer = (p[1] >> 1) & 3;   // 1: layer iii
+		int bitrate_index = p[2] >> 4;
+		int sample_rate_index = (p[2] >> 2) & 3;
+		if (version == 1 || layer != 1 || bitrate_index == 0 || bitrate_index == 15
+			|| sample_rate_index == 3) {
+			return std::nullopt;
+		}
+		bool mpeg1 = version == 3;
+		frame_header h;
+		h.bitrate = bitrates[mpeg1 ? 0 : 1][bitrate_index];
+		h.sample_rate = mpeg1_sample_rates[sample_rate_index] >> (mpeg1 ? 0 : version == 2 ? 1 : 2);
+		h.channels = (p[3] >> 6) == 3 ? 1 : 2;
+		h.samples = mpeg1 ? 1152 : 576;
+		int padding = (p[2] >> 1) & 1;
+		h.length = (std::size_t)((mpeg1 ? 144 : 72) * h.bitrate * 1000 / h.sample_rate + padding);
+		h.side_info = mpeg1 ? (h.channels == 1 ? 17 : 32) : (h.channels == 1 ? 9 : 17);
+		return h;
+	}
+
+	std::size_t id3v2_size(std::string_view data) {
+		if (data.size() < 10 || data.substr(0, 3) != "ID3") return 0;
+		auto p = (const unsigned char*)data.data();
+		// a "syncsafe" integer, 7 bits per byte
+		std::size_t size = ((std::size_t)(p[6] & 0x7f) << 21) | ((std::size_t)(p[7] & 0x7f) << 14)
+			| ((std::size_t)(p[8] & 0x7f) << 7) | (std::size_t)(p[9] & 0x7f);
+		bool footer = (p[5] & 0x10) != 0;
+		return 10 + size + (footer ? 10 : 0);
+	}
+
+	std::size_t find_frame(std::string_view data, std::size_t offset) {
+		for (; offset + 4 <= data.size(); ++offset) {
+			auto h = parse_header(data.substr(offset));
+			if (!h.has_value()) continue;
+			std::size_t next = offset + h.value().length;
+			if (next >= data.size() || parse_header(data.substr(next)).has_value()) {
+				return offset;
+			}
+		}
+		return data.size();
+	}
+
+	std::optional<stream_info> probe(std::string_view data) {
+		std::size_t offset = find_frame(data, std::min(id3v2_size(data), data.size()));
+		if (offset == data.size()) return std::nullopt;
+		auto first = parse_header(data.substr(offset)).value();
+		stream_info info;
+		info.sample_rate = first.sample_rate;
+		info.channels = first.channels;
+		info.audio_offset = offset;
+		std::uint64_t frames = tagged_frames(data.substr(offset, first.length), first);
+		std::uint64_t audio_bytes;
+		if (frames != 0) {
+			// the tag's frame carries no audio
+			audio_bytes = data.size() - offset > first.length ? data.size() - offset - first.length : 0;
+		}
+		else {
+			audio_bytes = 0;
+			while (offset < data.size()) {
+				auto h = parse_header(data.substr(offset));
+				if (!h.has_value()) {
+					// garbage, or the id3v1 tag at the end
+					offset = find_frame(data, offset + 1);
+					continue;
+				}
+				++frames;
+				audio_bytes += h.value().length;
+				offset += h.value().length;
+			}
+		}
+		info.frames = frames;
+		info.duration = (double)frames * first.samples / first.sample_rate;
+		info.bitrate = info.duration > 0 ? (int)(audio_bytes * 8 / info.duration / 1000 + 0.5) : first.bitrate;
+		return info;
+	}
+
+	std::vector<segment> split(std::string_view data, double seconds) {
+		std::vector<segment> segments;
+		std::size_t offset = find_frame(data, std::min(id3v2_size(data), data.size()));
+		if (offset == data.size()) return segments;
+		auto first = parse_header(data.substr(offset)).value();
+		if (tagged_frames(data.substr(offset, first.length), first) != 0) {
+			offset = find_frame(data, offset + first.length);
+		}
+		segment current{ offset, 0, 0 };
+		while (offset < data.size()) {
+			auto h = parse_header(data.substr(offset));
+			if (!h.has_value()) {
+				// decoders skip garbage between frames, so it stays in
+				// the segment. the id3v1 tag at the end is left out.
+				offset = find_frame(data, offset + 1);
+				if (current.length == 0) current.offset = offset;
+				continue;
+			}
+			std::size_t end = std::min(offset + h.value().length, data.size());
+			current.length = end - current.offset;
+			current.duration += (double)h.value().samples / h.value().sample_rate;
+			offset = end;
+			if (current.duration >= seconds) {
+				segments.push_back(current);
+				current = { offset, 0, 0 };
+			}
+		}
+		if (current.length != 0) segments.push_back(current);
+		return segments;
+	}
+
+}
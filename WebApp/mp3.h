@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+// just enough of the mp3 format (mpeg 1, 2 and 2.5 audio, layer iii)
+// to find the frames of a file without decoding them: a frame header
+// gives the frame's length and how many samples it holds, so walking
+// the headers gives the duration, and frame boundaries are where a
+// file can be cut.
+namespace mp3 {
+
+	struct frame_header {
+		int bitrate;       // kbit/s
+		int sample_rate;   // hz
+		int channels;
+		int samples;       // per frame
+		std::size_t length; // bytes, header included
+		// the bytes between the header and the xing/info tag (the side information)
+		std::size_t side_info;
+	};
+
+	// the header of a frame starting at `data`, if it is one
+	std::optional<frame_header> parse_header(std::string_view data);
+
+	// the bytes taken by an id3v2 tag at the start of `data`, 0 if there is none
+	std::size_t id3v2_size(std::string_view data);
+
+	// finds the frame at or after `offset`: the first position where a
+	// valid header is followed by another valid header (or the end of
+	// `data`), so that a stray sync word is not taken for a frame.
+	// returns `data.size()` if there is none.
+	std::size_t find_frame(std::string_view data, std::size_t offset);
+
+	struct stream_info {
+		double duration;   // seconds
+		int bitrate;       // kbit/s, the average for vbr
+		int sample_rate;
+		int channels;
+		std::uint64_t frames;
+		// where the first frame starts
+		std::size_t audio_offset;
+	};
+
+	// the duration and format of the mp3 file `data`. the frame count of
+	// a xing/info or vbri tag is used if there is one, otherwise every
+	// frame is walked.
+	std::optional<stream_info> probe(std::string_view data);
+
+	struct segment {
+		std::size_t offset;
+		std::size_t length;
+		double duration;  // seconds
+	};
+
+	// cuts the mp3 file `data` at frame boundaries into runs of frames
+	// lasting at least `seconds` (the last one may be shorter), leaving
+	// out the tags and the xing/info frame, so that every segment can be
+	// played on its own. empty if `data` has no frames.
+	std::vector<segment> split(std::string_view data, double seconds);
+
+}
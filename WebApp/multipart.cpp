@@ -0,0 +1,176 @@
+#include "multipart.h"
+
+#include <cctype>
+#include <utility>
+
+namespace {
+
+	std::string to_lower(std::string s) {
+		for (auto& c : s) c = (char)std::tolower((unsigned char)c);
+		return s;
+	}
+
+	std::string trim(const std::string& s) {
+		auto first = s.find_first_not_of(" \t");
+		if (first == std::string::npos) return "";
+		auto last = s.find_last_not_of(" \t");
+		return s.substr(first, last - first + 1);
+	}
+
+	// finds `key=value` or `key="value"` among the `;` separated
+	// parameters of a header value
+	std::string get_parameter(const std::string& value, const std::string& key) {
+		std::size_t i = value.find(';');
+		while (i != std::string::npos && i < value.size()) {
+			++i;
+			while (i < value.size() && (value[i] == ' ' || value[i] == '\t')) ++i;
+			auto eq = value.find('=', i);
+			if (eq == std::string::npos) break;
+			std::string name = to_lower(trim(value.substr(i, eq - i)));
+			std::string param;
+			i = eq + 1;
+			if (i < value.size() && value[i] == '"') {
+				for (++i; i < value.size() && value[i] != '"'; ++i) {
+					if (value[i] == '\\' && i + 1 < value.size()) ++i;
+					param.push_back(value[i]);
+				}
+				i = value.find(';', i);
+			}
+			else {
+				auto end = value.find(';', i);
+				param = trim(value.substr(i, end == std::string::npos ? std::string::npos : end - i));
+				i = end;
+			}
+			if (name == key) return param;
+		}
+		return "";
+	}
+
+}
+
+std::string get_multipart_boundary(const std::string& content_type) {
+	if (to_lower(content_type).compare(0, 19, "multipart/form-data") != 0) return "";
+	return get_parameter(content_type, "boundary");
+}
+
+multipart_parser::multipart_parser(
+	const std::string& boundary,
+	part_begin_handler on_begin,
+	part_data_handler on_data,
+	part_end_handler on_end)
+	: delimiter_{ "\r\n--" + boundary },
+	// the first boundary need not be preceded by a line break
+	buffer_{ "\r\n" },
+	on_begin_{ std::move(on_begin) },
+	on_data_{ std::move(on_data) },
+	on_end_{ std::move(on_end) } {
+	if (boundary.empty() || boundary.size() > 70) {
+		throw multipart_error{ "invalid multipart boundary" };
+	}
+}
+
+void multipart_parser::parse_headers(const std::string& headers) {
+	part_ = {};
+	std::size_t begin = 0;
+	while (begin < headers.size()) {
+		auto end = headers.find("\r\n", begin);
+		if (end == std::string::npos) end = headers.size();
+		std::string line = headers.substr(begin, end - begin);
+		begin = end + 2;
+		auto colon = line.find(':');
+		if (colon == std::string::npos) {
+			throw multipart_error{ "malformed part header" };
+		}
+		std::string name = to_lower(trim(line.substr(0, colon)));
+		std::string value = trim(line.substr(colon + 1));
+		if (name == "content-disposition") {
+			part_.name = get_parameter(value, "name");
+			part_.filename = get_parameter(value, "filename");
+		}
+		else if (name == "content-type") {
+			part_.content_type = value;
+		}
+	}
+}
+
+void multipart_parser::feed(const char* data, std::size_t size) {
+	if (state_ == state::done) return;
+	buffer_.append(data, size);
+	// everything before `pos` has been consumed
+	std::size_t pos = 0;
+	bool progress = true;
+	while (progress && state_ != state::done) {
+		progress = false;
+		switch (state_) {
+		case state::preamble: {
+			auto found = buffer_.find(delimiter_, pos);
+			if (found == std::string::npos) {
+				// keep a tail which might be the start of the boundary
+				if (buffer_.size() - pos >= delimiter_.size())
+					pos = buffer_.size() - delimiter_.size() + 1;
+				break;
+			}
+			pos = found + delimiter_.size();
+			state_ = state::delimiter;
+			progress = true;
+			break;
+		}
+		case state::delimiter:
+			if (buffer_.size() - pos < 2) break;
+			if (buffer_.compare(pos, 2, "--") == 0) {
+				// the closing boundary, the epilogue is ignored
+				pos = buffer_.size();
+				state_ = state::done;
+				break;
+			}
+			if (buffer_.compare(pos, 2, "\r\n") != 0) {
+				throw multipart_error{ "malformed multipart boundary" };
+			}
+			// `pos` stays at the line break, so that a part without
+			// headers ends at "\r\n\r\n" as well
+			state_ = state::headers;
+			progress = true;
+			break;
+		case state::headers: {
+			auto end = buffer_.find("\r\n\r\n", pos);
+			if (end == std::string::npos) {
+				if (buffer_.size() - pos > max_header_size) {
+					throw multipart_error{ "multipart headers too long" };
+				}
+				break;
+			}
+			if (end - pos > max_header_size) {
+				throw multipart_error{ "multipart headers too long" };
+			}
+			parse_headers(end > pos ? buffer_.substr(pos + 2, end - pos - 2) : "");
+			pos = end + 4;
+			state_ = state::body;
+			on_begin_(part_);
+			progress = true;
+			break;
+		}
+		case state::body: {
+			auto found = buffer_.find(delimiter_, pos);
+			if (found == std::string::npos) {
+				// the last bytes might be the start of the delimiter
+				std::size_t keep = delimiter_.size() - 1;
+				if (buffer_.size() - pos > keep) {
+					std::size_t n = buffer_.size() - pos - keep;
+					on_data_(buffer_.data() + pos, n);
+					pos += n;
+				}
+				break;
+			}
+			if (found > pos) on_data_(buffer_.data() + pos, found - pos);
+			on_end_();
+			pos = found + delimiter_.size();
+			state_ = state::delimiter;
+			progress = true;
+			break;
+		}
+		case state::done:
+			break;
+		}
+	}
+	buffer_.erase(0, pos);
+}
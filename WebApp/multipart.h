@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <functional>
+#include <stdexcept>
+
+struct multipart_error : std::runtime_error {
+	using std::runtime_error::runtime_error;
+};
+
+// returns the boundary in a `multipart/form-data; boundary=...`
+// content type, or an empty string if there is none.
+std::string get_multipart_boundary(const std::string& content_type);
+
+// an incremental multipart/form-data parser.
+// the body can be fed in chunks of any size (as they arrive), and
+// the contents of each part are passed to `on_data` as soon as it is
+// certain they do not belong to a boundary, so the parser only keeps
+// the part headers and a boundary-sized tail of the input.
+class multipart_parser {
+public:
+	struct part {
+		std::string name;
+		std::string filename;
+		std::string content_type;
+		bool is_file() const { return !filename.empty(); }
+	};
+	using part_begin_handler = std::function<void(const part&)>;
+	using part_data_handler = std::function<void(const char*, std::size_t)>;
+	using part_end_handler = std::function<void()>;
+private:
+	enum class state {
+		preamble,
+		delimiter,
+		headers,
+		body,
+		done
+	};
+	state state_ = state::preamble;
+	// "\r\n--" + boundary
+	std::string delimiter_;
+	std::string buffer_;
+	part part_;
+	part_begin_handler on_begin_;
+	part_data_handler on_data_;
+	part_end_handler on_end_;
+	void parse_headers(const std::string& headers);
+public:
+	// part headers longer than this are rejected
+	static constexpr std::size_t max_header_size = 16 * 1024;
+	multipart_parser(
+		const std::string& boundary,
+		part_begin_handler on_begin,
+		part_data_handler on_data,
+		part_end_handler on_end);
+	// throws `multipart_error` if the body is malformed
+	void feed(const char* data, std::size_t size);
+	// whether the closing boundary has been seen
+	bool done() const { return state_ == state::done; }
+};
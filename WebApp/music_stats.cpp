@@ -0,0 +1,145 @@
+#include "music_stats.h"
+
+#include <algorithm>
+#include <memory>
+
+#include "bserv/common.hpp"
+
+music_stats::~music_stats() {
+	if (!writer_.joinable()) return;
+	{
+		std::lock_guard<std::mutex> lock{ writer_lock_ };
+		stopping_ = true;
+	}
+	writer_cv_.notify_one();
+	writer_.join();
+}
+
+void music_stats::assign(const std::vector<entry>& tracks) {
+	std::unique_lock<std::shared_mutex> lock{ lock_ };
+	tracks_.clear();
+	favorites_rank_.clear();
+	comments_rank_.clear();
+	dirty_.clear();
+	for (const auto& track : tracks) {
+		tracks_[track.music_id] = track;
+		favorites_rank_.emplace(track.favorites, track.music_id);
+		comments_rank_.emplace(track.comments, track.music_id);
+	}
+}
+
+void music_stats::add(int music_id, const std::string& music_name, const std::string& musician) {
+	std::unique_lock<std::shared_mutex> lock{ lock_ };
+	if (!tracks_.emplace(music_id, entry{ music_id, music_name, musician, 0, 0 }).second) return;
+	favorites_rank_.emplace(0, music_id);
+	comments_rank_.emplace(0, music_id);
+}
+
+void music_stats::remove(int music_id) {
+	std::unique_lock<std::shared_mutex> lock{ lock_ };
+	auto it = tracks_.find(music_id);
+	if (it == tracks_.end()) return;
+	favorites_rank_.erase({ it->second.favorites, music_id });
+	comments_rank_.erase({ it->second.comments, music_id });
+	tracks_.erase(it);
+	// the summary columns of inactive music are not read
+	dirty_.erase(music_id);
+}
+
+void music_stats::add_count(int music_id, std::int64_t entry::* count, rank_set& rank, std::int64_t delta) {
+	if (delta == 0) return;
+	std::unique_lock<std::shared_mutex> lock{ lock_ };
+	auto it = tracks_.find(music_id);
+	if (it == tracks_.end()) return;
+	std::int64_t& value = it->second.*count;
+	rank.erase({ value, music_id });
+	value = std::max<std::int64_t>(value + delta, 0);
+	rank.emplace(value, music_id);
+	dirty_.insert(music_id);
+}
+
+void music_stats::add_favorites(int music_id, std::int64_t delta) {
+	add_count(music_id, &entry::favorites, favorites_rank_, delta);
+}
+
+void music_stats::add_comments(int music_id, std::int64_t delta) {
+	add_count(music_id, &entry::comments, comments_rank_, delta);
+}
+
+std::optional<music_stats::entry> music_stats::get(int music_id) const {
+	std::shared_lock<std::shared_mutex> lock{ lock_ };
+	auto it = tracks_.find(music_id);
+	if (it == tracks_.end()) return std::nullopt;
+	return it->second;
+}
+
+std::vector<music_stats::entry> music_stats::top(ranking r, std::size_t k) const {
+	std::shared_lock<std::shared_mutex> lock{ lock_ };
+	const rank_set& rank = r == by_favorites ? favorites_rank_ : comments_rank_;
+	std::vector<entry> result;
+	for (auto it = rank.begin(); it != rank.end() && result.size() < k && it->first > 0; ++it) {
+		result.push_back(tracks_.at(it->second));
+	}
+	return result;
+}
+
+std::size_t music_stats::pending() const {
+	std::shared_lock<std::shared_mutex> lock{ lock_ };
+	return dirty_.size();
+}
+
+std::vector<music_stats::entry> music_stats::take_dirty() {
+	std::unique_lock<std::shared_mutex> lock{ lock_ };
+	std::vector<entry> result;
+	result.reserve(dirty_.size());
+	for (int music_id : dirty_) {
+		result.push_back(tracks_.at(music_id));
+	}
+	dirty_.clear();
+	return result;
+}
+
+void music_stats::start_write_back(const std::string& conn_str, std::chrono::seconds interval) {
+	writer_ = std::thread{ [this, conn_str, interval]() {
+		std::unique_ptr<pqxx::connection> conn;
+		std::unique_lock<std::mutex> lock{ writer_lock_ };
+		while (true) {
+			writer_cv_.wait_for(lock, interval, [this]() { return stopping_; });
+			bool stopping = stopping_;
+			lock.unlock();
+			auto changed = take_dirty();
+			if (!changed.empty()) {
+				// the counts are absolute, so writing them again is harmless
+				std::string sql = "update music set favorite_count = v.favorites, "
+					"comment_count = v.comments from (values ";
+				for (std::size_t i = 0; i < changed.size(); ++i) {
+					if (i != 0) sql += ", ";
+					sql += "(" + std::to_string(changed[i].music_id)
+						+ ", " + std::to_string(changed[i].favorites)
+						+ ", " + std::to_string(changed[i].comments) + ")";
+				}
+				sql += ") as v(music_id, favorites, comments) where music.music_id = v.music_id";
+				try {
+					if (conn == nullptr || !conn->is_open()) {
+						conn = std::make_unique<pqxx::connection>(conn_str);
+					}
+					pqxx::nontransaction tx{ *conn };
+					tx.exec(sql);
+					written_ += changed.size();
+				}
+				catch (const std::exception& e) {
+					lgwarning << "failed to write back the music counts: " << e.what();
+					++write_failures_;
+					conn.reset();
+					// tried again with the next changes
+					std::unique_lock<std::shared_mutex> guard{ lock_ };
+					for (const auto& track : changed) {
+						if (tracks_.count(track.music_id)) dirty_.insert(track.music_id);
+					}
+				}
+			}
+			lock.lock();
+			if (stopping) break;
+		}
+	} };
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// the favorite and comment counts of the active music, kept in memory
+// so that neither the listings nor the rankings count rows.
+//
+// the counts are loaded from the summary columns of `music`
+// (`favorite_count`, `comment_count`) at start, and the handlers add to
+// them as they change the favorite and comment tables. the changed
+// counts are written back to the summary columns every
+// `write_back_interval` by a background thread (and when the server
+// exits). after a crash the columns may be missing the changes of the
+// last interval, so the server recounts them from the tables before
+// loading them (see `init_music_catalogue`).
+//
+// every count is also kept in an ordered set, largest first, so the
+// top k of a ranking are its first k entries and an update moves a
+// single entry (log n) instead of sorting.
+class music_stats {
+public:
+	struct entry {
+		int music_id;
+		std::string music_name;
+		std::string musician;
+		std::int64_t favorites;
+		std::int64_t comments;
+	};
+	enum ranking { by_favorites, by_comments };
+private:
+	// (count, music_id), the newer music first among equal counts
+	using rank_set = std::set<std::pair<std::int64_t, int>, std::greater<>>;
+	mutable std::shared_mutex lock_;
+	std::unordered_map<int, entry> tracks_;
+	rank_set favorites_rank_;
+	rank_set comments_rank_;
+	// the music whose counts changed since the last write-back
+	std::unordered_set<int> dirty_;
+	std::atomic<std::uint64_t> written_{ 0 };
+	std::atomic<std::uint64_t> write_failures_{ 0 };
+	std::mutex writer_lock_;
+	std::condition_variable writer_cv_;
+	bool stopping_ = false;
+	std::thread writer_;
+	void add_count(int music_id, std::int64_t entry::* count, rank_set& rank, std::int64_t delta);
+	std::vector<entry> take_dirty();
+	void write_back(const std::string& conn_str);
+public:
+	music_stats() = default;
+	music_stats(const music_stats&) = delete;
+	music_stats& operator=(const music_stats&) = delete;
+	// writes the last changes back
+	~music_stats();
+	// replaces all the counts
+	void assign(const std::vector<entry>& tracks);
+	// starts writing the changed counts back to the database at `conn_str`
+	void start_write_back(const std::string& conn_str, std::chrono::seconds interval);
+	// a new music, with no favorites or comments yet
+	void add(int music_id, const std::string& music_name, const std::string& musician);
+	void remove(int music_id);
+	// changes to music which is not (or no longer) active are ignored
+	void add_favorites(int music_id, std::int64_t delta);
+	void add_comments(int music_id, std::int64_t delta);
+	std::optional<entry> get(int music_id) const;
+	// the (at most) `k` music with the most favorites or comments,
+	// those with none left out
+	std::vector<entry> top(ranking r, std::size_t k) const;
+	// the music whose changed counts are not written back yet
+	std::size_t pending() const;
+	// the counts written back
+	std::uint64_t written() const { return written_; }
+	std::uint64_t write_failures() const { return write_failures_; }
+};
@@ -0,0 +1,75 @@
+#include "output_cache.h"
+
+#include <chrono>
+#include <utility>
+
+namespace {
+
+	std::atomic<std::uint64_t> data_version_{
+		(std::uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count() };
+
+}
+
+std::uint64_t data_version() {
+	return data_version_;
+}
+
+void bump_data_version() {
+	++data_version_;
+}
+
+output_cache::output_cache(std::size_t max_entries)
+	: max_entries_{ max_entries } {}
+
+std::shared_ptr<const output_cache::parts_type> output_cache::get(
+	const std::string& key,
+	const std::string& version) {
+	std::lock_guard<std::mutex> lock{ lock_ };
+	auto it = entries_.find(key);
+	if (it == entries_.end() || it->second.version != version) {
+		++misses_;
+		return nullptr;
+	}
+	++hits_;
+	lru_.splice(lru_.begin(), lru_, it->second.lru);
+	return it->second.parts;
+}
+
+std::shared_ptr<const output_cache::parts_type> output_cache::put(
+	const std::string& key,
+	const std::string& version,
+	parts_type parts) {
+	auto shared = std::make_shared<const parts_type>(std::move(parts));
+	std::lock_guard<std::mutex> lock{ lock_ };
+	auto it = entries_.find(key);
+	if (it != entries_.end()) {
+		it->second.version = version;
+		it->second.parts = shared;
+		lru_.splice(lru_.begin(), lru_, it->second.lru);
+		return shared;
+	}
+	lru_.push_front(key);
+	entries_.emplace(key, entry{ version, shared, lru_.begin() });
+	if (entries_.size() > max_entries_) {
+		entries_.erase(lru_.back());
+		lru_.pop_back();
+	}
+	return shared;
+}
+
+std::size_t output_cache::size() {
+	std::lock_guard<std::mutex> lock{ lock_ };
+	return entries_.size();
+}
+
+output_cache::parts_type split_slots(const std::string& page, const std::string& slot) {
+	output_cache::parts_type parts;
+	std::size_t begin = 0;
+	for (auto pos = page.find(slot); pos != std::string::npos; pos = page.find(slot, begin)) {
+		parts.push_back(page.substr(begin, pos - begin));
+		begin = pos + slot.size();
+	}
+	parts.push_back(page.substr(begin));
+	return parts;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// the version of the data shown by the shared pages. it starts at the
+// time the server starts (so versions are not reused after a restart)
+// and is bumped by the writes which change what these pages show.
+std::uint64_t data_version();
+void bump_data_version();
+
+// rendered pages that look the same to every visitor, apart from a
+// few per-user slots. a page is stored as the parts between its slots,
+// under a key (the route) and the version it was rendered at, and is
+// served by joining the parts with the slots rendered for the visitor.
+// an entry with an outdated version is simply rendered again, and the
+// least recently used entries are dropped beyond `max_entries`.
+class output_cache {
+public:
+	using parts_type = std::vector<std::string>;
+private:
+	struct entry {
+		std::string version;
+		std::shared_ptr<const parts_type> parts;
+		std::list<std::string>::iterator lru;
+	};
+	std::size_t max_entries_;
+	std::mutex lock_;
+	std::unordered_map<std::string, entry> entries_;
+	std::list<std::string> lru_;
+	std::atomic<std::uint64_t> hits_{ 0 };
+	std::atomic<std::uint64_t> misses_{ 0 };
+public:
+	explicit output_cache(std::size_t max_entries = 256);
+	std::shared_ptr<const parts_type> get(const std::string& key, const std::string& version);
+	std::shared_ptr<const parts_type> put(const std::string& key, const std::string& version, parts_type parts);
+	std::uint64_t hits() const { return hits_; }
+	std::uint64_t misses() const { return misses_; }
+	std::size_t size();
+};
+
+// splits `page` at every occurrence of `slot`
+output_cache::parts_type split_slots(const std::string& page, const std::string& slot);
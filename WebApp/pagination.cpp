@@ -0,0 +1,183 @@
+#include "pagination.h"
+
+#include <algorithm>
+#include <climits>
+#include <mutex>
+
+#include "metrics.h"
+#include "async_log.h"
+
+boost::json::object make_pagination(int page_id, int total_pages) {
+	boost::json::object pagination;
+	pagination["total"] = total_pages;
+	if (page_id > 1) {
+		pagination["previous"] = page_id - 1;
+	}
+	if (page_id < total_pages) {
+		pagination["next"] = page_id + 1;
+	}
+	int lower = page_id - 3;
+	int upper = page_id + 3;
+	if (page_id - 3 > 2) {
+		pagination["left_ellipsis"] = true;
+	}
+	else {
+		lower = 1;
+	}
+	if (page_id + 3 < total_pages - 1) {
+		pagination["right_ellipsis"] = true;
+	}
+	else {
+		upper = total_pages;
+	}
+	pagination["current"] = page_id;
+	boost::json::array pages_left;
+	for (int i = lower; i < page_id; ++i) {
+		pages_left.push_back(i);
+	}
+	pagination["pages_left"] = pages_left;
+	boost::json::array pages_right;
+	for (int i = page_id + 1; i <= upper; ++i) {
+		pages_right.push_back(i);
+	}
+	pagination["pages_right"] = pages_right;
+	return pagination;
+}
+
+keyset_pager::keyset_pager(
+	const std::string& table,
+	const std::string& key,
+	const std::string& condition,
+	std::chrono::steady_clock::duration max_age)
+	: count_query_{ "select count(*) from " + table + " where " + condition + ";" },
+	seek_query_{ "select " + key + " from " + table + " where " + condition
+		+ " and " + key + " > {after} order by " + key + " limit 1 offset {skip};" },
+	max_age_{ max_age } {}
+
+std::int64_t keyset_pager::count_rows(const runner& run) {
+	auto now = std::chrono::steady_clock::now();
+	bool owner = false;
+	{
+		std::lock_guard<std::mutex> lock{ count_lock_ };
+		bool due = stale_ || now - counted_ >= max_age_;
+		if (total_rows_ >= 0 && (!due || counting_)) {
+			return total_rows_;
+		}
+		// with nothing counted yet, a request coming while another
+		// one counts counts for itself
+		if (!counting_) {
+			owner = counting_ = true;
+			// cleared before the query, so that an invalidation
+			// racing with the query is not lost
+			stale_ = false;
+			added_while_counting_ = 0;
+		}
+	}
+	std::int64_t rows;
+	try {
+		metrics::phase_timer timer{ metrics::phase_db };
+		bserv::db_result db_res = run(count_query_);
+		lgquery << db_res.query();
+		rows = (*db_res.begin())[0].as<std::int64_t>();
+	}
+	catch (...) {
+		if (owner) {
+			std::lock_guard<std::mutex> lock{ count_lock_ };
+			counting_ = false;
+			stale_ = true;
+		}
+		throw;
+	}
+	if (!owner) return rows;
+	std::int64_t total_pages;
+	{
+		std::lock_guard<std::mutex> lock{ count_lock_ };
+		total_rows_ = std::max<std::int64_t>(rows + added_while_counting_, 0);
+		counted_ = now;
+		counting_ = false;
+		rows = total_rows_;
+		total_pages = (rows + page_size - 1) / page_size;
+	}
+	// the pages past the end have moved, or are gone
+	std::unique_lock<std::shared_mutex> lock{ keys_lock_ };
+	after_keys_.erase(
+		after_keys_.upper_bound((int)std::min<std::int64_t>(total_pages, INT_MAX)),
+		after_keys_.end());
+	return rows;
+}
+
+keyset_pager::page keyset_pager::locate(pqxx::transaction_base& tx, int page_id) {
+	return locate([&](const std::string& query) { return tx.exec(query); }, page_id);
+}
+
+keyset_pager::page keyset_pager::locate(std::shared_ptr<bserv::db_connection> conn, int page_id) {
+	return locate([&](const std::string& query) {
+		pqxx::nontransaction tx{ conn->get() };
+		return tx.exec(query);
+	}, page_id);
+}
+
+keyset_pager::page keyset_pager::locate(const runner& run, int page_id) {
+	std::int64_t rows = count_rows(run);
+	page result{
+		(std::size_t)rows,
+		(int)std::min<std::int64_t>((rows + page_size - 1) / page_size, INT_MAX),
+		std::nullopt
+	};
+	if (page_id < 1 || page_id > result.total_pages) {
+		return result;
+	}
+	int from = 1;
+	std::int64_t after = 0;
+	{
+		std::shared_lock<std::shared_mutex> lock{ keys_lock_ };
+		auto it = after_keys_.upper_bound(page_id);
+		if (it != after_keys_.begin()) {
+			--it;
+			from = it->first;
+			after = it->second;
+		}
+	}
+	if (from == page_id) {
+		result.after = after;
+		return result;
+	}
+	// the last key of the page before `page_id`, seeking from the
+	// nearest page whose start is known
+	std::string query = seek_query_;
+	query.replace(query.find("{after}"), 7, std::to_string(after));
+	query.replace(query.find("{skip}"), 6,
+		std::to_string((std::int64_t)(page_id - from) * page_size - 1));
+	{
+		metrics::phase_timer timer{ metrics::phase_db };
+		bserv::db_result db_res = run(query);
+		lgquery << db_res.query();
+		if (db_res.begin() == db_res.end()) {
+			return result;
+		}
+		after = (*db_res.begin())[0].as<std::int64_t>();
+	}
+	{
+		std::unique_lock<std::shared_mutex> lock{ keys_lock_ };
+		after_keys_[page_id] = after;
+	}
+	result.after = after;
+	return result;
+}
+
+void keyset_pager::page_ended(int page_id, std::int64_t last_key) {
+	if (page_id < 1 || page_id == INT_MAX) return;
+	std::unique_lock<std::shared_mutex> lock{ keys_lock_ };
+	after_keys_[page_id + 1] = last_key;
+}
+
+void keyset_pager::add_rows(std::int64_t n) {
+	std::lock_guard<std::mutex> lock{ count_lock_ };
+	if (total_rows_ >= 0) total_rows_ = std::max<std::int64_t>(total_rows_ + n, 0);
+	if (counting_) added_while_counting_ += n;
+}
+
+void keyset_pager::invalidate() {
+	std::lock_guard<std::mutex> lock{ count_lock_ };
+	stale_ = true;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <boost/json.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+#include "bserv/common.hpp"
+
+// builds the `pagination` object used by the listing templates
+// (previous/next, the pages around `page_id` and the ellipses).
+boost::json::object make_pagination(int page_id, int total_pages);
+
+// keyset (seek) pagination over the rows of a table that satisfy a
+// condition, ordered by an integer key (serial, so positive).
+// a page is fetched with `where key > ? order by key limit page_size`,
+// seeking from the last key of the page before it, so it costs the same
+// no matter how deep it is. the pager remembers where the pages it
+// served ended (`page_ended`); a page it has no such key for is reached
+// once from the nearest page before it that it has one for. new rows get
+// larger keys than the others, so the remembered keys stay valid seek
+// points as rows are written.
+// the number of rows is a counter kept by the write paths (`add_rows`).
+// it is recounted after `invalidate` (for changes the caller cannot
+// count) or after `max_age` (for changes made elsewhere), by one request
+// at a time and outside of any lock, the others going on with the old
+// number meanwhile.
+class keyset_pager {
+public:
+	static constexpr int page_size = 10;
+	struct page {
+		std::size_t total_rows;
+		int total_pages;
+		// the key the page starts after, none if the page does not exist
+		std::optional<std::int64_t> after;
+	};
+private:
+	using runner = std::function<bserv::db_result(const std::string&)>;
+	std::string count_query_;
+	std::string seek_query_;
+	std::chrono::steady_clock::duration max_age_;
+	// the key each page starts after, page 1 (after 0) excluded
+	std::shared_mutex keys_lock_;
+	std::map<int, std::int64_t> after_keys_;
+	std::mutex count_lock_;
+	std::int64_t total_rows_ = -1;
+	// the rows added while `counting_`, as the count may not see them
+	std::int64_t added_while_counting_ = 0;
+	bool counting_ = false;
+	bool stale_ = true;
+	std::chrono::steady_clock::time_point counted_;
+	std::int64_t count_rows(const runner& run);
+	page locate(const runner& run, int page_id);
+public:
+	keyset_pager(
+		const std::string& table,
+		const std::string& key,
+		const std::string& condition,
+		std::chrono::steady_clock::duration max_age = std::chrono::seconds{ 60 });
+	page locate(pqxx::transaction_base& tx, int page_id);
+	// runs the queries (if needed) outside of a transaction block
+	page locate(std::shared_ptr<bserv::db_connection> conn, int page_id);
+	// the page `page_id` was served and its last row had `last_key`
+	void page_ended(int page_id, std::int64_t last_key);
+	// `n` rows now satisfy the condition (fewer if negative)
+	void add_rows(std::int64_t n);
+	// the rows are to be counted again
+	void invalidate();
+};
@@ -0,0 +1,76 @@
+#include "password_hashing.h"
+
+#include <atomic>
+
+#include "bserv/common.hpp"
+
+namespace {
+
+	std::size_t hashing_threads_ = 2;
+	std::size_t hashing_queue_ = 64;
+
+	std::atomic<std::size_t> max_in_flight_{ 0 };
+	std::atomic<std::size_t> in_flight_{ 0 };
+	std::atomic<std::uint64_t> refused_{ 0 };
+
+	// one of the `max_in_flight_` hashes, taken before the network
+	// thread blocks on it
+	class in_flight_slot {
+	public:
+		in_flight_slot() {
+			if (++in_flight_ > password_hashing_limit()) {
+				--in_flight_;
+				++refused_;
+				throw pool_saturated{ "too many passwords being hashed" };
+			}
+		}
+		in_flight_slot(const in_flight_slot&) = delete;
+		in_flight_slot& operator=(const in_flight_slot&) = delete;
+		~in_flight_slot() {
+			--in_flight_;
+		}
+	};
+
+}
+
+void init_password_hashing(std::size_t num_threads, std::size_t max_queue) {
+	hashing_threads_ = num_threads;
+	hashing_queue_ = max_queue;
+}
+
+task_pool& get_password_hashing_pool() {
+	static task_pool pool{ hashing_threads_, hashing_queue_ };
+	return pool;
+}
+
+void set_password_hashing_limit(std::size_t max_in_flight) {
+	max_in_flight_ = max_in_flight;
+}
+
+bool verify_password(const std::string& password, const std::string& encoded_password) {
+	in_flight_slot slot;
+	return get_password_hashing_pool().submit([password, encoded_password]() {
+		return bserv::utils::security::check_password(
+			password.c_str(), encoded_password.c_str());
+	}).get();
+}
+
+std::string hash_password(const std::string& password) {
+	in_flight_slot slot;
+	return get_password_hashing_pool().submit([password]() {
+		return std::string{ bserv::utils::security::encode_password(password.c_str()) };
+	}).get();
+}
+
+std::size_t password_hashing_limit() {
+	std::size_t limit = max_in_flight_;
+	return limit != 0 ? limit : hashing_threads_ + hashing_queue_;
+}
+
+std::size_t password_hashes_in_flight() {
+	return in_flight_;
+}
+
+std::uint64_t password_hashes_refused() {
+	return refused_;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "task_pool.h"
+
+// password hashing is deliberately expensive, so it runs on its own
+// bounded pool rather than on the network threads. this caps the cpu
+// a burst of logins can take.
+// the handlers are synchronous, so the network thread waiting for a
+// hash is still blocked. a hash is refused (`pool_saturated`, answered
+// with a 503) when the queue is full, or when `max_in_flight` hashes
+// are already waited for. by default that is the threads plus the
+// queue, so the queue is the bound; a lower limit keeps some network
+// threads free during a burst of logins, at the cost of refusing them
+// sooner.
+
+// must be called before the first hash, otherwise the defaults
+// (2 threads, 64 queued hashes) are used
+void init_password_hashing(std::size_t num_threads, std::size_t max_queue);
+
+task_pool& get_password_hashing_pool();
+
+// the most hashes waited for at once, 0 for the threads plus the
+// queue of the pool (the default)
+void set_password_hashing_limit(std::size_t max_in_flight);
+
+// these block until the hash is computed, and throw
+// `pool_saturated` if too many are in flight or the queue is full
+bool verify_password(const std::string& password, const std::string& encoded_password);
+
+std::string hash_password(const std::string& password);
+
+std::size_t password_hashing_limit();
+std::size_t password_hashes_in_flight();
+// the hashes refused because `max_in_flight` were already waited for
+std::uint64_t password_hashes_refused();
@@ -1,17 +1,122 @@
 #include "rendering.h"
 
 #include <fstream>
+#include <sstream>
+#include <regex>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
 
 #include <boost/beast.hpp>
 #include <inja/inja.hpp>
 
+#include "static_files.h"
+#include "asset_cache.h"
+#include "metrics.h"
+
 std::string template_root_;
 std::string static_root_;
 
+// parsed templates are cached process-wide and shared by all the
+// worker threads. rendering only reads the environment (and the
+// parent templates stored in it), so it is done under a shared lock,
+// while parsing a template or dropping the cache takes the lock
+// exclusively.
+// a cached template is revalidated against the modification time
+// of its file (and of the files it extends/includes) at most once
+// per `template_check_interval_`.
+namespace {
+
+	using file_time = std::filesystem::file_time_type;
+
+	struct cached_template {
+		inja::Template tmpl;
+		// the template file itself and every file it depends on
+		std::vector<std::pair<std::string, file_time>> files;
+		std::atomic<std::int64_t> last_check;
+	};
+
+	const std::chrono::steady_clock::duration template_check_interval_ = std::chrono::seconds{ 1 };
+
+	std::shared_mutex template_lock_;
+	std::unique_ptr<inja::Environment> template_env_;
+	std::unordered_map<std::string, std::unique_ptr<cached_template>> template_cache_;
+
+	std::atomic<std::uint64_t> template_hits_{ 0 };
+	std::atomic<std::uint64_t> template_misses_{ 0 };
+	std::atomic<std::uint64_t> template_reloads_{ 0 };
+	// set by `reload_templates` (which may be called from a signal handler)
+	volatile std::sig_atomic_t template_reload_requested_ = 0;
+
+	std::int64_t steady_now() {
+		return std::chrono::steady_clock::now().time_since_epoch().count();
+	}
+
+	file_time modification_time(const std::string& path) {
+		std::error_code ec;
+		auto t = std::filesystem::last_write_time(path, ec);
+		return ec ? file_time::min() : t;
+	}
+
+	// collects `path` and the files it (transitively) extends or includes.
+	// inja resolves these names relative to the directory of the template.
+	void collect_dependencies(
+		const std::string& path,
+		std::vector<std::pair<std::string, file_time>>& files) {
+		for (auto& file : files)
+			if (file.first == path) return;
+		files.emplace_back(path, modification_time(path));
+		std::ifstream fin{ path, std::ios::binary };
+		std::stringstream ss;
+		ss << fin.rdbuf();
+		std::string content = ss.str();
+		static const std::regex dependency{ R"(\{%-?\s*(?:extends|include)\s+\"([^\"]+)\")" };
+		std::string dir = path.substr(0, path.find_last_of('/') + 1);
+		for (std::sregex_iterator it{ content.begin(), content.end(), dependency }, end;
+			it != end; ++it) {
+			collect_dependencies(dir + (*it)[1].str(), files);
+		}
+	}
+
+	bool is_stale(cached_template& entry) {
+		std::int64_t now = steady_now();
+		std::int64_t last = entry.last_check.load(std::memory_order_relaxed);
+		if (now - last < template_check_interval_.count()) return false;
+		// only one thread needs to do the check
+		if (!entry.last_check.compare_exchange_strong(last, now)) return false;
+		for (auto& file : entry.files)
+			if (modification_time(file.first) != file.second) return true;
+		return false;
+	}
+
+	// the context of a template, timed as serialization
+	inja::json converted(const boost::json::object& context) {
+		metrics::phase_timer timer{ metrics::phase_serialize };
+		return to_inja_json(context);
+	}
+
+	// must be called with `template_lock_` held exclusively
+	void clear_templates() {
+		template_cache_.clear();
+		template_env_ = std::make_unique<inja::Environment>();
+		++template_reloads_;
+	}
+
+}
+
 void init_rendering(const std::string& template_root) {
 	template_root_ = template_root;
 	if (template_root_[template_root_.size() - 1] != '/')
 		template_root_.push_back('/');
+	std::unique_lock<std::shared_mutex> lock{ template_lock_ };
+	clear_templates();
+	template_reloads_ = 0;
 }
 
 void init_static_root(const std::string& static_root) {
@@ -20,19 +125,98 @@ void init_static_root(const std::string& static_root) {
 		static_root_.push_back('/');
 }
 
+void reload_templates() {
+	template_reload_requested_ = 1;
+}
+
+template_cache_stats get_template_cache_stats() {
+	std::shared_lock<std::shared_mutex> lock{ template_lock_ };
+	return {
+		template_hits_.load(),
+		template_misses_.load(),
+		template_reloads_.load(),
+		template_cache_.size()
+	};
+}
+
 std::nullopt_t render(
 	bserv::response_type& response,
 	const std::string& template_file,
 	const boost::json::object& context) {
+	return render(response, template_file, converted(context));
+}
+
+std::uint64_t template_generation() {
+	return template_reloads_.load() + (template_reload_requested_ ? 1 : 0);
+}
+
+std::nullopt_t render(
+	bserv::response_type& response,
+	const std::string& template_file,
+	const inja::json& data) {
 	response.set(bserv::http::field::content_type, "text/html");
-	inja::json data = inja::json::parse(boost::json::serialize(context));
-	response.body() = inja::Environment{}.render_file(template_root_ + template_file, data);
+	response.body() = render_to_string(template_file, data);
 	response.prepare_payload();
 	return std::nullopt;
 }
 
+std::string render_to_string(
+	const std::string& template_file,
+	const boost::json::object& context) {
+	return render_to_string(template_file, converted(context));
+}
+
+std::string render_to_string(
+	const std::string& template_file,
+	const inja::json& data) {
+	metrics::phase_timer timer{ metrics::phase_render };
+	std::string path = template_root_ + template_file;
+	if (template_reload_requested_) {
+		std::unique_lock<std::shared_mutex> lock{ template_lock_ };
+		if (template_reload_requested_) {
+			template_reload_requested_ = 0;
+			clear_templates();
+		}
+	}
+	{
+		std::shared_lock<std::shared_mutex> lock{ template_lock_ };
+		auto it = template_cache_.find(path);
+		if (it != template_cache_.end() && !is_stale(*it->second)) {
+			++template_hits_;
+			return template_env_->render(it->second->tmpl, data);
+		}
+	}
+	std::unique_lock<std::shared_mutex> lock{ template_lock_ };
+	auto it = template_cache_.find(path);
+	if (it != template_cache_.end()) {
+		// another thread might have reparsed it in the meantime
+		bool changed = false;
+		for (auto& file : it->second->files)
+			if (modification_time(file.first) != file.second) changed = true;
+		if (changed) {
+			// the parent templates are stored in the environment,
+			// so everything is parsed again
+			lginfo << "template changed, reloading: " << path;
+			clear_templates();
+			it = template_cache_.end();
+		}
+	}
+	if (it == template_cache_.end()) {
+		++template_misses_;
+		auto entry = std::make_unique<cached_template>();
+		collect_dependencies(path, entry->files);
+		entry->tmpl = template_env_->parse_template(path);
+		entry->last_check = steady_now();
+		it = template_cache_.emplace(path, std::move(entry)).first;
+	}
+	else ++template_hits_;
+	return template_env_->render(it->second->tmpl, data);
+}
+
 std::nullopt_t serve(
+	const bserv::request_type& request,
 	bserv::response_type& response,
 	const std::string& file) {
-	return bserv::utils::file::serve(response, static_root_ + file);
+	if (serve_asset(request, response, file)) return std::nullopt;
+	return serve_file(request, response, static_root_ + file);
 }
@@ -2,21 +2,61 @@
 
 #include <string>
 #include <optional>
+#include <cstdint>
 
 #include <boost/json.hpp>
 #include "bserv/common.hpp"
 
+#include "json_bridge.h"
+
 void init_rendering(const std::string& template_root);
 
 void init_static_root(const std::string& static_root);
 
+struct template_cache_stats {
+	std::uint64_t hits;
+	std::uint64_t misses;
+	std::uint64_t reloads;
+	std::size_t size;
+};
+
+// drops every cached template, they will be parsed again on the
+// next request. it is safe to call this from a signal handler.
+void reload_templates();
+
+template_cache_stats get_template_cache_stats();
+
+// changes whenever the cached templates are dropped, so that output
+// rendered from them can be recognized as outdated
+std::uint64_t template_generation();
+
 std::nullopt_t render(
 	bserv::response_type& response,
 	const std::string& template_path,
 	const boost::json::object& context = {}
 );
 
+// renders with a context that is already an inja data tree,
+// for handlers that build it natively
+std::nullopt_t render(
+	bserv::response_type& response,
+	const std::string& template_path,
+	const inja::json& data
+);
+
+// renders without a response, e.g. a fragment of a page
+std::string render_to_string(
+	const std::string& template_path,
+	const boost::json::object& context = {}
+);
+
+std::string render_to_string(
+	const std::string& template_path,
+	const inja::json& data
+);
+
 std::nullopt_t serve(
+	const bserv::request_type& request,
 	bserv::response_type& response,
 	const std::string& file
 );
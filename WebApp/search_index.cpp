@@ -0,0 +1,346 @@
+#include "search_index.h"
+
+#include <algorithm>
+#include <mutex>
+#include <utility>
+
+namespace {
+
+	// quality of a match between a query term and an indexed term
+	const int typo_match = 1;
+	const int prefix_match = 2;
+	const int exact_match = 3;
+
+	// longer terms are not checked for typos
+	const std::size_t max_typo_term = 32;
+
+	bool is_term_char(unsigned char c) {
+		return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+			|| (c >= '0' && c <= '9') || c >= 0x80;
+	}
+
+	bool is_ascii(const std::string& s) {
+		for (unsigned char c : s)
+			if (c >= 0x80) return false;
+		return true;
+	}
+
+	bool starts_with(const std::string& s, const std::string& prefix) {
+		return s.size() >= prefix.size() && s.compare(0, prefix.size(), prefix) == 0;
+	}
+
+	std::size_t max_distance(const std::string& term) {
+		return term.size() >= 8 ? 2 : 1;
+	}
+
+	// whether `a` and `b` differ by at most one insertion, deletion,
+	// substitution or swap of adjacent characters
+	bool within_one(const std::string& a, const std::string& b) {
+		if (a.size() < b.size()) return within_one(b, a);
+		if (a.size() - b.size() > 1) return false;
+		std::size_t i = 0;
+		while (i < b.size() && a[i] == b[i]) ++i;
+		if (i == b.size()) return true;
+		if (a.size() != b.size()) {
+			return a.compare(i + 1, std::string::npos, b, i, std::string::npos) == 0;
+		}
+		if (a.compare(i + 1, std::string::npos, b, i + 1, std::string::npos) == 0) return true;
+		return i + 1 < a.size() && a[i] == b[i + 1] && a[i + 1] == b[i]
+			&& a.compare(i + 2, std::string::npos, b, i + 2, std::string::npos) == 0;
+	}
+
+	// whether the edit distance between `a` and `b` (counting a swap of
+	// adjacent characters as one edit) is at most `bound`
+	bool within_distance(const std::string& a, const std::string& b, std::size_t bound) {
+		std::size_t n = a.size(), m = b.size();
+		if ((n > m ? n - m : m - n) > bound) return false;
+		if (bound == 1) return within_one(a, b);
+		if (n > max_typo_term || m > max_typo_term) return false;
+		// three rows of the distance matrix
+		std::size_t rows[3][max_typo_term + 1];
+		std::size_t* before = rows[0];
+		std::size_t* previous = rows[1];
+		std::size_t* row = rows[2];
+		for (std::size_t j = 0; j <= m; ++j) previous[j] = j;
+		for (std::size_t i = 1; i <= n; ++i) {
+			row[0] = i;
+			std::size_t row_min = i;
+			for (std::size_t j = 1; j <= m; ++j) {
+				std::size_t d = std::min({
+					previous[j] + 1,
+					row[j - 1] + 1,
+					previous[j - 1] + (a[i - 1] == b[j - 1] ? 0 : 1) });
+				if (i > 1 && j > 1 && a[i - 1] == b[j - 2] && a[i - 2] == b[j - 1])
+					d = std::min(d, before[j - 2] + 1);
+				row[j] = d;
+				row_min = std::min(row_min, d);
+			}
+			if (row_min > bound) return false;
+			std::swap(before, previous);
+			std::swap(previous, row);
+		}
+		return previous[m] <= bound;
+	}
+
+	struct result {
+		int score;
+		std::uint32_t doc;
+	};
+
+	bool better(const result& a, const result& b) {
+		return a.score != b.score ? a.score > b.score : a.doc > b.doc;
+	}
+
+	// a cursor walking a posting list from its end (newest first)
+	struct posting_cursor {
+		const std::vector<std::uint32_t>* postings;
+		std::size_t pos;
+		std::uint32_t doc() const { return (*postings)[pos - 1]; }
+	};
+
+	bool older(const posting_cursor& a, const posting_cursor& b) {
+		return a.doc() < b.doc();
+	}
+
+}
+
+struct search_index::query_term {
+	std::string text;
+	bool typo = false;
+	// (term id, quality), best matches first
+	std::vector<std::pair<std::uint32_t, int>> matches;
+	// the matched term ids, for checking the terms of a track
+	std::vector<bool> matched;
+	std::uint32_t exact = (std::uint32_t)-1;
+	std::size_t cost = 0;
+	int best = 0;
+};
+
+std::vector<std::string> search_index::tokenize(const std::string& text) {
+	std::vector<std::string> terms;
+	std::string term;
+	for (unsigned char c : text) {
+		if (is_term_char(c)) {
+			term.push_back(c >= 'A' && c <= 'Z' ? (char)(c - 'A' + 'a') : (char)c);
+		}
+		else if (!term.empty()) {
+			terms.push_back(std::move(term));
+			term.clear();
+		}
+	}
+	if (!term.empty()) terms.push_back(std::move(term));
+	return terms;
+}
+
+std::uint32_t search_index::find_or_add_term(const std::string& term, bool keep_sorted) {
+	auto it = term_ids_.find(term);
+	if (it != term_ids_.end()) return it->second;
+	auto id = (std::uint32_t)terms_.size();
+	terms_.push_back({ term, {} });
+	term_ids_.emplace(term, id);
+	if (keep_sorted) {
+		auto pos = std::lower_bound(sorted_terms_.begin(), sorted_terms_.end(), term,
+			[this](std::uint32_t a, const std::string& b) { return terms_[a].term < b; });
+		sorted_terms_.insert(pos, id);
+	}
+	else sorted_terms_.push_back(id);
+	return id;
+}
+
+void search_index::add_locked(const track& t, bool keep_sorted) {
+	auto doc = (std::uint32_t)tracks_.size();
+	tracks_.push_back(t);
+	removed_.push_back(false);
+	docs_[t.music_id] = doc;
+	auto words = tokenize(t.music_name);
+	auto musician = tokenize(t.musician);
+	words.insert(words.end(), musician.begin(), musician.end());
+	std::size_t first = doc_terms_.size();
+	for (auto& word : words) {
+		auto id = find_or_add_term(word, keep_sorted);
+		if (std::find(doc_terms_.begin() + first, doc_terms_.end(), id) != doc_terms_.end())
+			continue;
+		doc_terms_.push_back(id);
+		terms_[id].postings.push_back(doc);
+	}
+	doc_offsets_.push_back((std::uint32_t)doc_terms_.size());
+}
+
+void search_index::assign(const std::vector<track>& tracks) {
+	std::unique_lock<std::shared_mutex> lock{ lock_ };
+	tracks_.clear();
+	removed_.clear();
+	doc_terms_.clear();
+	doc_offsets_.assign(1, 0);
+	docs_.clear();
+	terms_.clear();
+	term_ids_.clear();
+	sorted_terms_.clear();
+	num_removed_ = 0;
+	tracks_.reserve(tracks.size());
+	for (auto& t : tracks) {
+		add_locked(t, false);
+	}
+	std::sort(sorted_terms_.begin(), sorted_terms_.end(),
+		[this](std::uint32_t a, std::uint32_t b) { return terms_[a].term < terms_[b].term; });
+}
+
+void search_index::add(const track& t) {
+	std::unique_lock<std::shared_mutex> lock{ lock_ };
+	auto it = docs_.find(t.music_id);
+	if (it != docs_.end()) {
+		removed_[it->second] = true;
+		++num_removed_;
+	}
+	add_locked(t, true);
+}
+
+void search_index::remove(int music_id) {
+	std::unique_lock<std::shared_mutex> lock{ lock_ };
+	auto it = docs_.find(music_id);
+	if (it == docs_.end()) return;
+	removed_[it->second] = true;
+	++num_removed_;
+	docs_.erase(it);
+}
+
+void search_index::expand(query_term& q) const {
+	auto first = std::lower_bound(sorted_terms_.begin(), sorted_terms_.end(), q.text,
+		[this](std::uint32_t a, const std::string& b) { return terms_[a].term < b; });
+	for (auto it = first; it != sorted_terms_.end() && starts_with(terms_[*it].term, q.text); ++it) {
+		q.matches.emplace_back(*it, terms_[*it].term.size() == q.text.size() ? exact_match : prefix_match);
+	}
+	if (q.matches.empty() && q.text.size() >= min_typo_length && is_ascii(q.text)) {
+		// the terms sharing the first character
+		q.typo = true;
+		std::string lower = q.text.substr(0, 1);
+		std::string upper = lower;
+		++upper[0];
+		auto begin = std::lower_bound(sorted_terms_.begin(), sorted_terms_.end(), lower,
+			[this](std::uint32_t a, const std::string& b) { return terms_[a].term < b; });
+		auto end = std::lower_bound(begin, sorted_terms_.end(), upper,
+			[this](std::uint32_t a, const std::string& b) { return terms_[a].term < b; });
+		std::size_t bound = max_distance(q.text);
+		for (auto it = begin; it != end; ++it) {
+			if (within_distance(terms_[*it].term, q.text, bound))
+				q.matches.emplace_back(*it, typo_match);
+		}
+	}
+	std::stable_sort(q.matches.begin(), q.matches.end(),
+		[](const std::pair<std::uint32_t, int>& a, const std::pair<std::uint32_t, int>& b) {
+			return a.second > b.second;
+		});
+	q.matched.assign(terms_.size(), false);
+	for (auto& match : q.matches) {
+		q.matched[match.first] = true;
+		if (match.second == exact_match) q.exact = match.first;
+		q.cost += terms_[match.first].postings.size();
+		q.best = std::max(q.best, match.second);
+	}
+}
+
+int search_index::match_quality(std::uint32_t doc, const query_term& q) const {
+	int quality = 0;
+	for (auto i = doc_offsets_[doc]; i < doc_offsets_[doc + 1]; ++i) {
+		auto id = doc_terms_[i];
+		if (id == q.exact) return exact_match;
+		if (q.matched[id]) quality = q.typo ? typo_match : prefix_match;
+	}
+	return quality;
+}
+
+std::vector<search_index::track> search_index::search(
+	const std::string& query,
+	std::size_t limit) const {
+	std::vector<track> tracks;
+	std::vector<query_term> terms;
+	for (auto& text : tokenize(query)) {
+		if (terms.size() == max_query_terms) break;
+		bool duplicate = false;
+		for (auto& q : terms)
+			if (q.text == text) duplicate = true;
+		if (!duplicate) {
+			terms.emplace_back();
+			terms.back().text = text;
+		}
+	}
+	if (terms.empty() || limit == 0) return tracks;
+
+	std::shared_lock<std::shared_mutex> lock{ lock_ };
+	for (auto& q : terms) {
+		expand(q);
+		if (q.matches.empty()) return tracks;
+	}
+	// the candidates are the tracks matching the most selective term,
+	// the others are checked against the terms of each candidate
+	std::size_t driver = 0;
+	int others_best = 0;
+	for (std::size_t i = 0; i < terms.size(); ++i) {
+		if (terms[i].cost < terms[driver].cost) driver = i;
+		others_best += terms[i].best;
+	}
+	const query_term& d = terms[driver];
+	others_best -= d.best;
+
+	// the worst of the best `limit` results is kept on top
+	std::vector<result> results;
+	std::vector<posting_cursor> cursors;
+	for (std::size_t i = 0; i < d.matches.size();) {
+		// the candidates of one quality, newest first
+		int quality = d.matches[i].second;
+		int bound = quality + others_best;
+		cursors.clear();
+		for (; i < d.matches.size() && d.matches[i].second == quality; ++i) {
+			auto& postings = terms_[d.matches[i].first].postings;
+			if (!postings.empty()) cursors.push_back({ &postings, postings.size() });
+		}
+		std::make_heap(cursors.begin(), cursors.end(), older);
+		std::uint32_t last = (std::uint32_t)-1;
+		while (!cursors.empty()) {
+			std::pop_heap(cursors.begin(), cursors.end(), older);
+			auto& cursor = cursors.back();
+			std::uint32_t doc = cursor.doc();
+			if (--cursor.pos == 0) cursors.pop_back();
+			else std::push_heap(cursors.begin(), cursors.end(), older);
+			if (doc == last) continue;
+			last = doc;
+			if (results.size() == limit && !better({ bound, doc }, results.front())) break;
+			if (removed_[doc]) continue;
+			// tracks matching the driver better were seen already
+			if (!d.typo && match_quality(doc, d) != quality) continue;
+			int score = quality;
+			for (std::size_t j = 0; j < terms.size() && score != 0; ++j) {
+				if (j == driver) continue;
+				int q = match_quality(doc, terms[j]);
+				score = q == 0 ? 0 : score + q;
+			}
+			if (score == 0) continue;
+			result r{ score, doc };
+			if (results.size() < limit) {
+				results.push_back(r);
+				std::push_heap(results.begin(), results.end(), better);
+			}
+			else if (better(r, results.front())) {
+				std::pop_heap(results.begin(), results.end(), better);
+				results.back() = r;
+				std::push_heap(results.begin(), results.end(), better);
+			}
+		}
+	}
+	std::sort(results.begin(), results.end(), better);
+	tracks.reserve(results.size());
+	for (auto& r : results) {
+		tracks.push_back(tracks_[r.doc]);
+	}
+	return tracks;
+}
+
+std::size_t search_index::size() const {
+	std::shared_lock<std::shared_mutex> lock{ lock_ };
+	return tracks_.size() - num_removed_;
+}
+
+std::size_t search_index::num_terms() const {
+	std::shared_lock<std::shared_mutex> lock{ lock_ };
+	return terms_.size();
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// an in-process inverted index over the music catalogue (the music
+// names and the usernames of their musicians), so that searches never
+// touch the database.
+//
+// names are split into lowercase terms (runs of ascii letters/digits
+// or of non-ascii bytes). every query term matches the indexed terms
+// it equals or is a prefix of; a term of at least `min_typo_length`
+// characters which matches nothing that way falls back to the terms
+// within a small edit distance (sharing its first character). a track
+// must match every query term, and the results are ranked by how well
+// the terms matched (exact > prefix > typo), then newest first.
+//
+// tracks are numbered densely in the order they are added (the
+// catalogue is loaded by `music_id`, so newer tracks have larger
+// numbers), the posting lists are sorted arrays of these numbers and
+// every track keeps the ids of its own terms in one shared array, which
+// is how the other query terms are checked. removed tracks are only
+// marked, their numbers stay in the posting lists.
+class search_index {
+public:
+	struct track {
+		int music_id;
+		std::string music_name;
+		std::string musician;
+	};
+	static constexpr std::size_t max_query_terms = 8;
+	static constexpr std::size_t min_typo_length = 4;
+private:
+	struct term_entry {
+		std::string term;
+		std::vector<std::uint32_t> postings;
+	};
+	struct query_term;
+	mutable std::shared_mutex lock_;
+	std::vector<track> tracks_;
+	std::vector<bool> removed_;
+	// the term ids of track `i` are `doc_terms_[doc_offsets_[i] .. doc_offsets_[i + 1])`
+	std::vector<std::uint32_t> doc_terms_;
+	std::vector<std::uint32_t> doc_offsets_{ 0 };
+	std::unordered_map<int, std::uint32_t> docs_;
+	// term ids are stable, `sorted_terms_` orders them by term
+	std::vector<term_entry> terms_;
+	std::unordered_map<std::string, std::uint32_t> term_ids_;
+	std::vector<std::uint32_t> sorted_terms_;
+	std::size_t num_removed_ = 0;
+	std::uint32_t find_or_add_term(const std::string& term, bool keep_sorted);
+	void add_locked(const track& t, bool keep_sorted);
+	void expand(query_term& q) const;
+	int match_quality(std::uint32_t doc, const query_term& q) const;
+public:
+	static std::vector<std::string> tokenize(const std::string& text);
+	// replaces the whole index, `tracks` should be ordered by `music_id`
+	void assign(const std::vector<track>& tracks);
+	void add(const track& t);
+	void remove(int music_id);
+	std::vector<track> search(const std::string& query, std::size_t limit) const;
+	std::size_t size() const;
+	std::size_t num_terms() const;
+};
@@ -0,0 +1,77 @@
+#include "segment_cache.h"
+
+segment_cache::segment_cache(std::size_t max_bytes)
+	: max_bytes_{ max_bytes } {}
+
+void segment_cache::set_max_bytes(std::size_t max_bytes) {
+	std::lock_guard<std::mutex> lock{ lock_ };
+	max_bytes_ = max_bytes;
+	while (bytes_ > max_bytes_) {
+		auto it = entries_.find(lru_.back());
+		bytes_ -= it->second.content->size();
+		entries_.erase(it);
+		lru_.pop_back();
+	}
+}
+
+std::shared_ptr<const std::string> segment_cache::get(int music_id, int part) {
+	std::lock_guard<std::mutex> lock{ lock_ };
+	auto it = entries_.find({ music_id, part });
+	if (it == entries_.end()) {
+		++misses_;
+		return nullptr;
+	}
+	++hits_;
+	lru_.splice(lru_.begin(), lru_, it->second.lru);
+	return it->second.content;
+}
+
+std::shared_ptr<const std::string> segment_cache::put(int music_id, int part, std::string content) {
+	auto shared = std::make_shared<const std::string>(std::move(content));
+	std::lock_guard<std::mutex> lock{ lock_ };
+	// a part bigger than the whole cache is served, but not kept
+	if (shared->size() > max_bytes_) return shared;
+	key_type key{ music_id, part };
+	auto it = entries_.find(key);
+	if (it != entries_.end()) {
+		bytes_ -= it->second.content->size();
+		it->second.content = shared;
+		lru_.splice(lru_.begin(), lru_, it->second.lru);
+	}
+	else {
+		lru_.push_front(key);
+		entries_.emplace(key, entry{ shared, lru_.begin() });
+	}
+	bytes_ += shared->size();
+	while (bytes_ > max_bytes_) {
+		auto last = entries_.find(lru_.back());
+		bytes_ -= last->second.content->size();
+		entries_.erase(last);
+		lru_.pop_back();
+	}
+	return shared;
+}
+
+void segment_cache::erase(int music_id) {
+	std::lock_guard<std::mutex> lock{ lock_ };
+	for (auto it = lru_.begin(); it != lru_.end();) {
+		if (it->first != music_id) {
+			++it;
+			continue;
+		}
+		auto entry_it = entries_.find(*it);
+		bytes_ -= entry_it->second.content->size();
+		entries_.erase(entry_it);
+		it = lru_.erase(it);
+	}
+}
+
+std::size_t segment_cache::size() {
+	std::lock_guard<std::mutex> lock{ lock_ };
+	return entries_.size();
+}
+
+std::size_t segment_cache::bytes() {
+	std::lock_guard<std::mutex> lock{ lock_ };
+	return bytes_;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+// the parts of streamed music (see transcoding.h) held in memory, under
+// the music and the part's number, so that popular music is served
+// without touching the disk. the least recently used parts are dropped
+// once they take more than `max_bytes`.
+class segment_cache {
+public:
+	using key_type = std::pair<int, int>;
+private:
+	struct key_hash {
+		std::size_t operator()(const key_type& key) const {
+			return std::hash<std::uint64_t>{}(
+				((std::uint64_t)(std::uint32_t)key.first << 32) | (std::uint32_t)key.second);
+		}
+	};
+	struct entry {
+		std::shared_ptr<const std::string> content;
+		std::list<key_type>::iterator lru;
+	};
+	std::size_t max_bytes_;
+	std::size_t bytes_ = 0;
+	std::mutex lock_;
+	std::unordered_map<key_type, entry, key_hash> entries_;
+	std::list<key_type> lru_;
+	std::atomic<std::uint64_t> hits_{ 0 };
+	std::atomic<std::uint64_t> misses_{ 0 };
+public:
+	explicit segment_cache(std::size_t max_bytes = 64 * 1024 * 1024);
+	void set_max_bytes(std::size_t max_bytes);
+	std::shared_ptr<const std::string> get(int music_id, int part);
+	std::shared_ptr<const std::string> put(int music_id, int part, std::string content);
+	// drops the parts of `music_id`
+	void erase(int music_id);
+	std::uint64_t hits() const { return hits_; }
+	std::uint64_t misses() const { return misses_; }
+	std::size_t size();
+	std::size_t bytes();
+};
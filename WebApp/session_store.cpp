@@ -0,0 +1,242 @@
+#include "session_store.h"
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+
+#include "bserv/common.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+	const char session_magic[8] = { 'M', 'D', 'B', 'S', 'E', 'S', 'S', '1' };
+
+	// the first page of the file
+	struct file_header {
+		char magic[8];
+		std::uint64_t slot_size;
+		std::uint64_t slots_per_shard;
+		std::uint64_t num_shards;
+	};
+
+	const std::size_t header_size = 4096;
+
+	std::size_t round_up_pow2(std::size_t n) {
+		std::size_t p = 1;
+		while (p < n) p <<= 1;
+		return p;
+	}
+
+}
+
+void session_state::set_username(const std::string& name) {
+	std::size_t size = std::min(name.size(), username_size - 1);
+	std::memcpy(username, name.data(), size);
+	username[size] = '\0';
+}
+
+session_token session_token::generate() {
+	// `random_device` reads the system's entropy source on the
+	// supported platforms, so the tokens cannot be guessed
+	static std::mutex lock;
+	static std::random_device device;
+	std::lock_guard<std::mutex> guard{ lock };
+	session_token token;
+	do {
+		token.hi = ((std::uint64_t)device() << 32) | device();
+		token.lo = ((std::uint64_t)device() << 32) | device();
+	} while (token.hi == 0 && token.lo == 0);
+	return token;
+}
+
+std::optional<session_token> session_token::parse(const std::string& s) {
+	if (s.size() != 32) return std::nullopt;
+	session_token token;
+	for (std::size_t i = 0; i < 32; ++i) {
+		char c = s[i];
+		std::uint64_t digit;
+		if (c >= '0' && c <= '9') digit = c - '0';
+		else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+		else return std::nullopt;
+		std::uint64_t& half = i < 16 ? token.hi : token.lo;
+		half = (half << 4) | digit;
+	}
+	if (token.hi == 0 && token.lo == 0) return std::nullopt;
+	return token;
+}
+
+std::string session_token::to_string() const {
+	static const char digits[] = "0123456789abcdef";
+	std::string s(32, '0');
+	for (int i = 0; i < 16; ++i) {
+		s[15 - i] = digits[(hi >> (4 * i)) & 0xf];
+		s[31 - i] = digits[(lo >> (4 * i)) & 0xf];
+	}
+	return s;
+}
+
+// the memory holding the header and the slots
+class session_store::storage {
+private:
+	char* data_ = nullptr;
+	std::size_t size_ = 0;
+	bool mapped_ = false;
+	std::vector<char> memory_;
+public:
+	// in memory, zeroed
+	explicit storage(std::size_t size) : size_{ size }, memory_(size) {
+		data_ = memory_.data();
+	}
+#ifndef _WIN32
+	// mapped from `path`, which is created (sparse, so unused slots
+	// take no disk space) or reset if it does not have `size` bytes
+	// or does not start with `header`
+	storage(const std::string& path, std::size_t size, const file_header& header)
+		: size_{ size }, mapped_{ true } {
+		int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0600);
+		if (fd < 0) {
+			throw std::runtime_error{ "failed to open the session file " + path };
+		}
+		struct stat st;
+		bool valid = ::fstat(fd, &st) == 0 && (std::size_t)st.st_size == size;
+		if (valid) {
+			file_header existing;
+			valid = ::pread(fd, &existing, sizeof(existing), 0) == (ssize_t)sizeof(existing)
+				&& std::memcmp(&existing, &header, sizeof(header)) == 0;
+		}
+		if (!valid) {
+			if (st.st_size != 0) {
+				lgwarning << "the session file " << path << " does not match, starting afresh";
+			}
+			if (::ftruncate(fd, 0) != 0 || ::ftruncate(fd, (off_t)size) != 0
+				|| ::pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+				::close(fd);
+				throw std::runtime_error{ "failed to create the session file " + path };
+			}
+		}
+		void* data = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (data == MAP_FAILED) {
+			throw std::runtime_error{ "failed to map the session file " + path };
+		}
+		data_ = static_cast<char*>(data);
+	}
+#endif
+	storage(const storage&) = delete;
+	storage& operator=(const storage&) = delete;
+	~storage() {
+#ifndef _WIN32
+		if (mapped_) ::munmap(data_, size_);
+#endif
+	}
+	char* data() const { return data_; }
+};
+
+session_store::session_store(std::size_t capacity, clock::duration idle_timeout)
+	: idle_timeout_{ std::chrono::duration_cast<std::chrono::seconds>(idle_timeout).count() } {
+	slots_per_shard_ = round_up_pow2(std::max<std::size_t>(capacity / num_shards, max_probes));
+	attach(std::make_unique<storage>(header_size + sizeof(slot) * slots_per_shard_ * num_shards));
+}
+
+session_store::~session_store() = default;
+
+void session_store::attach(std::unique_ptr<storage> storage) {
+	// locked in order, while the slots are replaced
+	for (auto& s : shards_) s.lock.lock();
+	storage_ = std::move(storage);
+	slot* slots = reinterpret_cast<slot*>(storage_->data() + header_size);
+	for (std::size_t i = 0; i < num_shards; ++i) {
+		shards_[i].slots = slots + i * slots_per_shard_;
+	}
+	for (auto& s : shards_) s.lock.unlock();
+}
+
+void session_store::open(const std::string& path, std::size_t capacity) {
+#ifndef _WIN32
+	std::size_t slots_per_shard = round_up_pow2(std::max<std::size_t>(capacity / num_shards, max_probes));
+	file_header header{};
+	std::memcpy(header.magic, session_magic, sizeof(session_magic));
+	header.slot_size = sizeof(slot);
+	header.slots_per_shard = slots_per_shard;
+	header.num_shards = num_shards;
+	auto mapped = std::make_unique<storage>(
+		path, header_size + sizeof(slot) * slots_per_shard * num_shards, header);
+	slots_per_shard_ = slots_per_shard;
+	attach(std::move(mapped));
+#else
+	lgwarning << "session files are not supported on this platform, sessions are kept in memory";
+#endif
+}
+
+std::int64_t session_store::now() const {
+	return std::chrono::duration_cast<std::chrono::seconds>(
+		clock::now().time_since_epoch()).count();
+}
+
+session_store::shard& session_store::shard_of(const session_token& token) {
+	return shards_[token.hi % num_shards];
+}
+
+session_store::slot* session_store::find(shard& s, const session_token& token, std::int64_t now) {
+	std::size_t mask = slots_per_shard_ - 1;
+	for (std::size_t i = 0; i < max_probes; ++i) {
+		slot& candidate = s.slots[(token.lo + i) & mask];
+		if (candidate.token.hi == 0 && candidate.token.lo == 0) return nullptr;
+		if (candidate.token == token) {
+			if (now - candidate.last_access >= idle_timeout_) return nullptr;
+			return &candidate;
+		}
+	}
+	return nullptr;
+}
+
+std::optional<session_state> session_store::get(const session_token& token) {
+	auto& s = shard_of(token);
+	auto t = now();
+	std::lock_guard<std::mutex> lock{ s.lock };
+	slot* found = find(s, token, t);
+	if (found == nullptr) return std::nullopt;
+	found->last_access = t;
+	return found->state;
+}
+
+void session_store::put(const session_token& token, const session_state& state) {
+	auto& s = shard_of(token);
+	auto t = now();
+	std::lock_guard<std::mutex> lock{ s.lock };
+	slot* target = find(s, token, t);
+	if (target == nullptr) {
+		// a free or expired slot, otherwise the least recently used one
+		std::size_t mask = slots_per_shard_ - 1;
+		for (std::size_t i = 0; i < max_probes; ++i) {
+			slot& candidate = s.slots[(token.lo + i) & mask];
+			bool never_used = candidate.token.hi == 0 && candidate.token.lo == 0;
+			if (never_used || t - candidate.last_access >= idle_timeout_
+				|| candidate.token == token) {
+				target = &candidate;
+				break;
+			}
+			if (target == nullptr || candidate.last_access < target->last_access) {
+				target = &candidate;
+			}
+		}
+	}
+	target->token = token;
+	target->last_access = t;
+	target->state = state;
+}
+
+void session_store::erase(const session_token& token) {
+	auto& s = shard_of(token);
+	std::lock_guard<std::mutex> lock{ s.lock };
+	slot* found = find(s, token, now());
+	// the token stays, so that the slots after it remain reachable
+	if (found != nullptr) found->last_access = 0;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// what the server keeps about a visitor between requests. it is a
+// plain struct, so reading it is a copy of a few fields rather than
+// string lookups in a json object, and it is stored as is in the
+// session file.
+struct session_state {
+	// 0 if nobody is logged in
+	std::int64_t user_id = 0;
+	bool is_superuser = false;
+	int is_musician = 0;
+	// the music page viewed last, 0 if none
+	std::int64_t music_id = 0;
+	// whether that music is a favorite of the user
+	bool is_favorite = false;
+	// only for display (the navbar), it is cut at `username_size - 1`
+	// bytes. the handlers identify the user by `user_id`.
+	static constexpr std::size_t username_size = 256;
+	char username[username_size] = {};
+
+	bool logged_in() const { return user_id != 0; }
+	std::string get_username() const { return username; }
+	void set_username(const std::string& name);
+};
+
+static_assert(std::is_trivially_copyable<session_state>::value,
+	"session_state is stored in the session file as is");
+
+// a random 128-bit session id, sent to the client in a cookie
+struct session_token {
+	std::uint64_t hi = 0;
+	std::uint64_t lo = 0;
+	static session_token generate();
+	// none unless `s` is 32 hex digits
+	static std::optional<session_token> parse(const std::string& s);
+	std::string to_string() const;
+	bool operator==(const session_token& other) const { return hi == other.hi && lo == other.lo; }
+};
+
+// the sessions, in a fixed-capacity hash table which lives in a file
+// mapped into memory (`open`), so they survive restarts. opening the
+// file reads nothing: the pages of the table are loaded by the system
+// when a session on them is first accessed, so the start-up time does
+// not depend on the number of sessions. without a file (and on windows)
+// the table is kept in memory.
+//
+// the table is split into `num_shards` independently locked parts,
+// chosen by the token, and a token is looked for in at most
+// `max_probes` consecutive slots of its part. sessions expire after
+// `idle_timeout` without a request (the time of the last access is
+// stored with them), and their slots are reused. if all the slots a
+// new session could take are in use, the least recently used of them
+// is taken.
+class session_store {
+public:
+	using clock = std::chrono::system_clock;
+	static constexpr std::size_t num_shards = 64;
+	static constexpr std::size_t max_probes = 32;
+private:
+	struct slot {
+		session_token token;
+		// seconds since the epoch, 0 if the session was erased
+		std::int64_t last_access;
+		session_state state;
+	};
+	struct shard {
+		std::mutex lock;
+		slot* slots = nullptr;
+	};
+	class storage;
+	std::unique_ptr<storage> storage_;
+	std::array<shard, num_shards> shards_;
+	std::size_t slots_per_shard_ = 0;
+	std::int64_t idle_timeout_;
+	void attach(std::unique_ptr<storage> storage);
+	// the slot of `token` in `s`, or nullptr. must be called with the lock of `s` held.
+	slot* find(shard& s, const session_token& token, std::int64_t now);
+	shard& shard_of(const session_token& token);
+	std::int64_t now() const;
+public:
+	explicit session_store(
+		std::size_t capacity = 1 << 14,
+		clock::duration idle_timeout = std::chrono::minutes{ 30 });
+	~session_store();
+	// keeps the sessions in `path`, with room for (about) `capacity`
+	// sessions. an existing file made for another capacity or layout
+	// is started afresh.
+	void open(const std::string& path, std::size_t capacity);
+	std::size_t capacity() const { return slots_per_shard_ * num_shards; }
+	// none if there is no such session or it has expired
+	std::optional<session_state> get(const session_token& token);
+	// stores `state` as session `token`, (re)creating it if needed
+	void put(const session_token& token, const session_state& state);
+	void erase(const session_token& token);
+};
@@ -0,0 +1,170 @@
+#include "statements.h"
+
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_set>
+
+namespace {
+
+	std::vector<const statement_info*>& statements() {
+		static std::vector<const statement_info*> statements_;
+		return statements_;
+	}
+
+	// the (underlying) connections the statements are prepared on.
+	// the pools close connections (see db_pool.h), and remove them from
+	// here with `forget_prepared` first, as a new connection may be
+	// opened at the same address.
+	std::shared_mutex prepared_lock_;
+	std::unordered_set<const void*> prepared_connections_;
+
+}
+
+statement_info::statement_info(
+	const char* name,
+	const char* sql,
+	std::size_t num_params)
+	: name_{ name }, sql_{ sql }, num_params_{ num_params } {
+	statements().push_back(this);
+}
+
+const std::vector<const statement_info*>& get_statements() {
+	return statements();
+}
+
+std::shared_ptr<bserv::db_connection> prepared(
+	std::shared_ptr<bserv::db_connection> conn) {
+	const void* key = &conn->get();
+	{
+		std::shared_lock<std::shared_mutex> lock{ prepared_lock_ };
+		if (prepared_connections_.count(key)) return conn;
+	}
+	// a connection is only used by one request at a time,
+	// so there is no need to hold the lock while preparing
+	for (auto statement : statements()) {
+		conn->get().prepare(statement->name(), statement->sql());
+	}
+	lginfo << "prepared " << statements().size() << " statements on a new connection";
+	std::unique_lock<std::shared_mutex> lock{ prepared_lock_ };
+	prepared_connections_.insert(key);
+	return conn;
+}
+
+void forget_prepared(bserv::db_connection& conn) {
+	std::unique_lock<std::shared_mutex> lock{ prepared_lock_ };
+	prepared_connections_.erase(&conn.get());
+}
+
+namespace stmt {
+
+	// users
+	const prepared_statement<1> get_user{ "get_user",
+		"select * from auth_user where username = $1" };
+	const prepared_statement<1> get_user_by_id{ "get_user_by_id",
+		"select * from auth_user where id = $1" };
+	const prepared_statement<7> insert_user{ "insert_user",
+		"insert into auth_user "
+		"(username, password, is_superuser, first_name, last_name, email, is_active) "
+		"values ($1, $2, $3, $4, $5, $6, $7)" };
+	const prepared_statement<1> deactivate_user{ "deactivate_user",
+		"update auth_user set is_active = false where username = $1" };
+	const prepared_statement<1> apply_for_musician{ "apply_for_musician",
+		"update auth_user set is_musician = 1 where id = $1" };
+	const prepared_statement<2> set_musician{ "set_musician",
+		"update auth_user set is_musician = $1 where id = $2" };
+	const prepared_statement<2> set_first_name{ "set_first_name",
+		"update auth_user set first_name = $1 where id = $2" };
+	const prepared_statement<2> set_last_name{ "set_last_name",
+		"update auth_user set last_name = $1 where id = $2" };
+	const prepared_statement<2> set_email{ "set_email",
+		"update auth_user set email = $1 where id = $2" };
+	const prepared_statement<2> list_users{ "list_users",
+		"select * from auth_user where is_active = true and id > $1 order by id limit $2" };
+	const prepared_statement<2> list_applicants{ "list_applicants",
+		"select * from auth_user where is_musician = 1 and is_active = true "
+		"and id > $1 order by id limit $2" };
+
+	// music
+	const prepared_statement<3> insert_music{ "insert_music",
+		"insert into music (musician_id, music_name, music_path) values ($1, $2, $3) "
+		"returning music_id" };
+	const prepared_statement<1> get_music{ "get_music",
+		"select music_id, username musician, music_name, music_path, music.is_active "
+		"from music join auth_user on music.musician_id = auth_user.id where music_id = $1" };
+	const prepared_statement<1> get_music_owner{ "get_music_owner",
+		"select musician_id from music where music_id = $1" };
+	const prepared_statement<1> deactivate_music{ "deactivate_music",
+		"update music set is_active = false where music_id = $1 and is_active = true" };
+	const prepared_statement<2> list_music{ "list_music",
+		"select music_id, username musician, music_name, music_path, music.is_active "
+		"from music join auth_user on music.musician_id = auth_user.id "
+		"where music.is_active = true and music_id > $1 order by music_id limit $2" };
+	const prepared_statement<1> list_user_music{ "list_user_music",
+		"select music_id, username, music_name, music_path, music.is_active "
+		"from music join auth_user on music.musician_id = auth_user.id "
+		"where id = $1 and music.is_active = true order by music_id" };
+
+	// comments
+	const prepared_statement<4> insert_comment{ "insert_comment",
+		"insert into comment (user_id, music_id, comment_time, comment_content) "
+		"values ($1, $2, to_timestamp($3), $4)" };
+	const prepared_statement<2> list_comments{ "list_comments",
+		"select comment_id, username, comment_time, comment_content "
+		"from comment join auth_user on comment.user_id = auth_user.id "
+		"where music_id = $1 order by comment_time desc, comment_id desc limit $2" };
+	const prepared_statement<4> list_comments_before{ "list_comments_before",
+		"select comment_id, username, comment_time, comment_content "
+		"from comment join auth_user on comment.user_id = auth_user.id "
+		"where music_id = $1 and (comment_time, comment_id) < ($2::timestamp, $3) "
+		"order by comment_time desc, comment_id desc limit $4" };
+	const prepared_statement<1> get_comment_owner{ "get_comment_owner",
+		"select user_id, music_id from comment where comment_id = $1" };
+	const prepared_statement<1> delete_comment{ "delete_comment",
+		"delete from comment where comment_id = $1" };
+
+	// favorites
+	const prepared_statement<2> get_favorite{ "get_favorite",
+		"select create_time from favorite where user_id = $1 and music_id = $2" };
+	const prepared_statement<3> insert_favorite{ "insert_favorite",
+		"insert into favorite values ($1, $2, to_timestamp($3))" };
+	const prepared_statement<2> delete_favorite{ "delete_favorite",
+		"delete from favorite where user_id = $1 and music_id = $2" };
+	const prepared_statement<1> list_favorites{ "list_favorites",
+		"select favorite.music_id, username, music_name, music_path, music.is_active "
+		"from favorite join music on favorite.music_id = music.music_id "
+		"join auth_user on music.musician_id = auth_user.id "
+		"where user_id = $1 and music.is_active = true order by create_time desc" };
+
+	// pages
+	// the music (as `get_music`), its first comments (as `list_comments`,
+	// at most $3) and whether user $2 likes it
+	const prepared_statement<3> music_page{ "music_page",
+		"select "
+		"(select json_build_object('music_id', music_id, 'musician', username, "
+		"'music_name', music_name, 'music_path', music_path, 'is_active', music.is_active) "
+		"from music join auth_user on music.musician_id = auth_user.id where music_id = $1), "
+		"(select coalesce(json_agg(json_build_object('comment_id', comment_id, 'username', username, "
+		"'comment_time', comment_time::text, 'comment_content', comment_content) "
+		"order by comment_time desc, comment_id desc), '[]') "
+		"from (select comment_id, username, comment_time, comment_content "
+		"from comment join auth_user on comment.user_id = auth_user.id "
+		"where music_id = $1 order by comment_time desc, comment_id desc limit $3) c), "
+		"exists (select 1 from favorite where user_id = $2 and music_id = $1)" };
+	// the user (as `get_user_by_id`), its favorites (as `list_favorites`)
+	// and its music (as `list_user_music`)
+	const prepared_statement<1> profile_page{ "profile_page",
+		"select "
+		"(select row_to_json(auth_user) from auth_user where id = $1), "
+		"(select coalesce(json_agg(json_build_object('music_id', favorite.music_id, 'musician', username, "
+		"'music_name', music_name, 'music_path', music_path, 'is_active', music.is_active) "
+		"order by create_time desc), '[]') "
+		"from favorite join music on favorite.music_id = music.music_id "
+		"join auth_user on music.musician_id = auth_user.id "
+		"where user_id = $1 and music.is_active = true), "
+		"(select coalesce(json_agg(json_build_object('music_id', music_id, 'musician', username, "
+		"'music_name', music_name, 'music_path', music_path, 'is_active', music.is_active) "
+		"order by music_id), '[]') "
+		"from music join auth_user on music.musician_id = auth_user.id "
+		"where id = $1 and music.is_active = true)" };
+
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/json.hpp>
+#include "bserv/common.hpp"
+
+#include "metrics.h"
+
+// named prepared statements.
+// every statement is prepared once on each pooled connection (see
+// `prepared`), with `pqxx::connection::prepare`, and afterwards executed
+// by name with its parameters bound rather than formatted into the
+// query text, so postgresql neither parses nor plans it again for each
+// request.
+// handlers refer to the statements through the constants in `stmt`,
+// and the number of parameters is checked at compile time.
+
+class statement_info {
+private:
+	std::string name_;
+	std::string sql_;
+	std::size_t num_params_;
+public:
+	statement_info(const char* name, const char* sql, std::size_t num_params);
+	const std::string& name() const { return name_; }
+	const std::string& sql() const { return sql_; }
+	std::size_t num_params() const { return num_params_; }
+};
+
+template <std::size_t N>
+class prepared_statement : public statement_info {
+public:
+	// `sql` refers to the parameters as $1 ... $N
+	prepared_statement(const char* name, const char* sql)
+		: statement_info{ name, sql, N } {}
+};
+
+// all the statements, in the order they were defined
+const std::vector<const statement_info*>& get_statements();
+
+// makes sure the statements are prepared on `conn` (the first time a
+// pooled connection is seen), and returns it
+std::shared_ptr<bserv::db_connection> prepared(
+	std::shared_ptr<bserv::db_connection> conn);
+
+// forgets that `conn`, which is being closed, was prepared
+void forget_prepared(bserv::db_connection& conn);
+
+// a transaction on a pooled connection. `bserv::db_transaction` only
+// runs query text, with the parameters formatted into it, so the
+// handlers use this one to execute the prepared statements.
+class db_work {
+private:
+	std::shared_ptr<bserv::db_connection> conn_;
+	pqxx::work tx_;
+public:
+	explicit db_work(std::shared_ptr<bserv::db_connection> conn)
+		: conn_{ std::move(conn) }, tx_{ conn_->get() } {}
+	pqxx::work& get() { return tx_; }
+	void commit() { tx_.commit(); }
+	void abort() { tx_.abort(); }
+};
+
+namespace statement_params {
+
+	// a parameter as libpqxx binds it
+	template <typename Param>
+	const Param& bind(const Param& param) { return param; }
+
+	inline std::string bind(const boost::json::string& param) {
+		return { param.data(), param.size() };
+	}
+
+}
+
+template <std::size_t N, typename ...Params>
+bserv::db_result exec_prepared(
+	db_work& tx,
+	const prepared_statement<N>& statement,
+	const Params& ...params) {
+	static_assert(sizeof...(Params) == N,
+		"wrong number of parameters for the prepared statement");
+	metrics::phase_timer timer{ metrics::phase_db };
+	return tx.get().exec_prepared(statement.name(), statement_params::bind(params)...);
+}
+
+// runs `statement` on its own, outside of a transaction block: a
+// single statement is atomic anyway, and this saves the round trips of
+// `begin` and of the `commit`/`rollback`. the read-only pages fetch
+// everything they show with one such statement.
+template <std::size_t N, typename ...Params>
+bserv::db_result exec_single(
+	std::shared_ptr<bserv::db_connection> conn,
+	const prepared_statement<N>& statement,
+	const Params& ...params) {
+	static_assert(sizeof...(Params) == N,
+		"wrong number of parameters for the prepared statement");
+	metrics::phase_timer timer{ metrics::phase_db };
+	pqxx::nontransaction tx{ conn->get() };
+	return tx.exec_prepared(statement.name(), statement_params::bind(params)...);
+}
+
+namespace stmt {
+
+	// users
+	extern const prepared_statement<1> get_user;
+	extern const prepared_statement<1> get_user_by_id;
+	extern const prepared_statement<7> insert_user;
+	extern const prepared_statement<1> deactivate_user;
+	extern const prepared_statement<1> apply_for_musician;
+	extern const prepared_statement<2> set_musician;
+	extern const prepared_statement<2> set_first_name;
+	extern const prepared_statement<2> set_last_name;
+	extern const prepared_statement<2> set_email;
+	extern const prepared_statement<2> list_users;
+	extern const prepared_statement<2> list_applicants;
+
+	// music
+	extern const prepared_statement<3> insert_music;
+	extern const prepared_statement<1> get_music;
+	extern const prepared_statement<1> get_music_owner;
+	extern const prepared_statement<1> deactivate_music;
+	extern const prepared_statement<2> list_music;
+	extern const prepared_statement<1> list_user_music;
+
+	// comments
+	extern const prepared_statement<4> insert_comment;
+	extern const prepared_statement<2> list_comments;
+	extern const prepared_statement<4> list_comments_before;
+	extern const prepared_statement<1> get_comment_owner;
+	extern const prepared_statement<1> delete_comment;
+
+	// favorites
+	extern const prepared_statement<2> get_favorite;
+	extern const prepared_statement<3> insert_favorite;
+	extern const prepared_statement<2> delete_favorite;
+	extern const prepared_statement<1> list_favorites;
+
+	// whole pages, as json (see `exec_single`)
+	extern const prepared_statement<3> music_page;
+	extern const prepared_statement<1> profile_page;
+
+}
@@ -0,0 +1,393 @@
+#include "static_files.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <ctime>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#include <boost/beast.hpp>
+
+#include "blob_store.h"
+#include "metrics.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+	struct byte_range {
+		std::uint64_t first;
+		std::uint64_t last; // inclusive
+	};
+
+	struct file_info {
+		std::uint64_t size;
+		std::string etag;
+		std::string last_modified;
+		// the content digest of a stored blob, empty for other files
+		std::string digest;
+	};
+
+	const char multipart_boundary[] = "3d6b6a416f9b5_MusicDatabase_range";
+
+	file_info stat_file(const std::string& path) {
+		std::error_code ec;
+		if (!std::filesystem::is_regular_file(path, ec)) {
+			throw bserv::url_not_found_exception{};
+		}
+		auto size = std::filesystem::file_size(path, ec);
+		auto mtime = std::filesystem::last_write_time(path, ec);
+		if (ec) {
+			throw bserv::url_not_found_exception{};
+		}
+		// `file_time_type` has no portable conversion to `system_clock` in c++17
+		auto modified = std::chrono::time_point_cast<std::chrono::system_clock::duration>(
+			mtime - std::filesystem::file_time_type::clock::now()
+			+ std::chrono::system_clock::now());
+		std::ostringstream etag;
+		// a stored blob is named after its content
+		std::string digest = blob_digest(path);
+		if (digest != "") etag << '"' << digest << '"';
+		else etag << '"' << std::hex << size << '-'
+			<< mtime.time_since_epoch().count() << '"';
+		return {
+			(std::uint64_t)size,
+			etag.str(),
+			http_date(std::chrono::system_clock::to_time_t(modified)),
+			digest
+		};
+	}
+
+	bool parse_number(const std::string& s, std::uint64_t& value) {
+		if (s.empty() || s.size() > 19) return false;
+		value = 0;
+		for (char c : s) {
+			if (c < '0' || c > '9') return false;
+			value = value * 10 + (c - '0');
+		}
+		return true;
+	}
+
+	std::string header_value(const bserv::request_type& request, bserv::http::field name) {
+		auto value = request[name];
+		return { value.data(), value.size() };
+	}
+
+	std::string trim(const std::string& s) {
+		auto first = s.find_first_not_of(" \t");
+		if (first == std::string::npos) return "";
+		auto last = s.find_last_not_of(" \t");
+		return s.substr(first, last - first + 1);
+	}
+
+	// parses `bytes=a-b, c-, -n` against a file of `size` bytes.
+	// returns false if the header is malformed (it is then ignored),
+	// unsatisfiable ranges are simply left out of `ranges`.
+	bool parse_ranges(
+		const std::string& header,
+		std::uint64_t size,
+		std::vector<byte_range>& ranges) {
+		std::string value = trim(header);
+		if (value.compare(0, 6, "bytes=") != 0) return false;
+		std::stringstream ss{ value.substr(6) };
+		std::string spec;
+		while (std::getline(ss, spec, ',')) {
+			spec = trim(spec);
+			auto dash = spec.find('-');
+			if (dash == std::string::npos) return false;
+			std::string first_str = spec.substr(0, dash);
+			std::string last_str = spec.substr(dash + 1);
+			std::uint64_t first, last;
+			if (first_str.empty()) {
+				// suffix range: the last `n` bytes
+				if (!parse_number(last_str, last)) return false;
+				if (last == 0 || size == 0) continue;
+				if (last > size) last = size;
+				ranges.push_back({ size - last, size - 1 });
+				continue;
+			}
+			if (!parse_number(first_str, first)) return false;
+			if (last_str.empty()) {
+				// open-ended: the server may send less than the rest of
+				// the file, the client asks again from where it stopped
+				if (first >= size) continue;
+				last = std::min(size - 1, first + (std::uint64_t)max_range_chunk - 1);
+			}
+			else {
+				if (!parse_number(last_str, last)) return false;
+				if (last < first) return false;
+				if (first >= size) continue;
+			}
+			if (last >= size) last = size - 1;
+			ranges.push_back({ first, last });
+		}
+		return true;
+	}
+
+	// sorts `ranges` and merges the overlapping and adjacent ones, so
+	// that ranges repeating the same bytes cannot make the response
+	// larger than the file
+	void coalesce(std::vector<byte_range>& ranges) {
+		std::sort(ranges.begin(), ranges.end(), [](const byte_range& a, const byte_range& b) {
+			return a.first < b.first;
+		});
+		std::vector<byte_range> merged;
+		for (auto& range : ranges) {
+			if (!merged.empty() && range.first <= merged.back().last + 1) {
+				merged.back().last = std::max(merged.back().last, range.last);
+			}
+			else merged.push_back(range);
+		}
+		ranges = std::move(merged);
+	}
+
+	bool use_mmap_ = true;
+
+#ifndef _WIN32
+	// a read-only, shared mapping of a whole file. its pages belong to
+	// the page cache, so they are neither read into nor kept on the heap.
+	class mapped_file {
+	private:
+		void* data_ = MAP_FAILED;
+		std::size_t size_;
+	public:
+		mapped_file(const std::string& path, std::size_t size) : size_{ size } {
+			int fd = ::open(path.c_str(), O_RDONLY);
+			if (fd < 0) {
+				throw bserv::url_not_found_exception{};
+			}
+			data_ = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+			::close(fd);
+			if (data_ == MAP_FAILED) {
+				throw std::runtime_error{ "failed to map static file" };
+			}
+#ifdef POSIX_MADV_SEQUENTIAL
+			::posix_madvise(data_, size_, POSIX_MADV_SEQUENTIAL);
+#endif
+		}
+		mapped_file(const mapped_file&) = delete;
+		mapped_file& operator=(const mapped_file&) = delete;
+		~mapped_file() {
+			if (data_ != MAP_FAILED) ::munmap(data_, size_);
+		}
+		const char* data() const { return static_cast<const char*>(data_); }
+		std::size_t size() const { return size_; }
+	};
+
+	// recently used mappings, keyed by path and etag (so a replaced
+	// file is mapped again). a mapping stays alive while a request
+	// still uses it, even after it is evicted.
+	constexpr std::size_t max_mappings = 64;
+	std::mutex mappings_lock_;
+	std::list<std::pair<std::string, std::shared_ptr<const mapped_file>>> mappings_;
+
+	std::shared_ptr<const mapped_file> get_mapping(
+		const std::string& path,
+		const file_info& info) {
+		std::string key = path + info.etag;
+		std::lock_guard<std::mutex> lock{ mappings_lock_ };
+		for (auto it = mappings_.begin(); it != mappings_.end(); ++it) {
+			if (it->first == key) {
+				mappings_.splice(mappings_.begin(), mappings_, it);
+				return it->second;
+			}
+		}
+		auto mapping = std::make_shared<const mapped_file>(path, (std::size_t)info.size);
+		mappings_.emplace_front(key, mapping);
+		if (mappings_.size() > max_mappings) mappings_.pop_back();
+		return mapping;
+	}
+#endif
+
+	// reads slices of a static file, from a shared mapping of it where
+	// that is available and with plain reads otherwise. only blobs are
+	// mapped: they never change, while truncating any other file under
+	// its mapping would make the copy out of it raise SIGBUS.
+	class file_source {
+	private:
+#ifndef _WIN32
+		std::shared_ptr<const mapped_file> mapping_;
+#endif
+		std::ifstream fin_;
+	public:
+		file_source(const std::string& path, const file_info& info) {
+#ifndef _WIN32
+			if (use_mmap_ && info.size > 0 && info.digest != "") {
+				mapping_ = get_mapping(path, info);
+				return;
+			}
+#endif
+			fin_.open(path, std::ios::in | std::ios::binary);
+			if (!fin_) {
+				throw bserv::url_not_found_exception{};
+			}
+		}
+		void read(const byte_range& range, std::string& body) {
+			auto length = range.last - range.first + 1;
+#ifndef _WIN32
+			if (mapping_) {
+				if (range.last >= mapping_->size()) {
+					throw std::runtime_error{ "static file changed while serving" };
+				}
+				body.append(mapping_->data() + range.first, (std::size_t)length);
+				return;
+			}
+#endif
+			auto offset = body.size();
+			body.resize(offset + length);
+			fin_.seekg((std::streamoff)range.first);
+			fin_.read(&body[offset], (std::streamsize)length);
+			if ((std::uint64_t)fin_.gcount() != length) {
+				throw std::runtime_error{ "failed to read static file" };
+			}
+		}
+	};
+
+	std::string content_range(const byte_range& range, std::uint64_t size) {
+		return "bytes " + std::to_string(range.first) + "-"
+			+ std::to_string(range.last) + "/" + std::to_string(size);
+	}
+
+}
+
+std::string mime_type(const std::string& path) {
+	auto pos = path.find_last_of('.');
+	std::string ext = pos == std::string::npos ? "" : path.substr(pos);
+	for (auto& c : ext) c = (char)std::tolower((unsigned char)c);
+	if (ext == ".htm" || ext == ".html") return "text/html";
+	if (ext == ".css") return "text/css";
+	if (ext == ".txt") return "text/plain";
+	if (ext == ".js") return "application/javascript";
+	if (ext == ".json") return "application/json";
+	if (ext == ".xml") return "application/xml";
+	if (ext == ".map") return "application/json";
+	if (ext == ".png") return "image/png";
+	if (ext == ".jpe" || ext == ".jpeg" || ext == ".jpg") return "image/jpeg";
+	if (ext == ".gif") return "image/gif";
+	if (ext == ".ico") return "image/vnd.microsoft.icon";
+	if (ext == ".svg" || ext == ".svgz") return "image/svg+xml";
+	if (ext == ".mp3") return "audio/mpeg";
+	if (ext == ".m4a") return "audio/mp4";
+	if (ext == ".aac") return "audio/aac";
+	if (ext == ".ogg" || ext == ".oga") return "audio/ogg";
+	if (ext == ".opus") return "audio/opus";
+	if (ext == ".wav") return "audio/wav";
+	if (ext == ".flac") return "audio/flac";
+	return "application/octet-stream";
+}
+
+std::string http_date(std::time_t t) {
+	std::tm tm{};
+#ifdef _WIN32
+	gmtime_s(&tm, &t);
+#else
+	gmtime_r(&t, &tm);
+#endif
+	char buf[64];
+	std::strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+	return buf;
+}
+
+std::string last_modified(const std::string& path) {
+	return stat_file(path).last_modified;
+}
+
+void set_static_mmap(bool enabled) {
+	use_mmap_ = enabled;
+}
+
+std::nullopt_t serve_file(
+	const bserv::request_type& request,
+	bserv::response_type& response,
+	const std::string& path) {
+	if (path.find("..") != std::string::npos) {
+		throw bserv::url_not_found_exception{};
+	}
+	file_info info = stat_file(path);
+	std::string type = mime_type(path);
+	response.set(bserv::http::field::accept_ranges, "bytes");
+	response.set(bserv::http::field::etag, info.etag);
+	response.set(bserv::http::field::last_modified, info.last_modified);
+	if (info.digest != "") {
+		response.set(bserv::http::field::cache_control, "public, max-age=31536000, immutable");
+	}
+
+	if (header_value(request, bserv::http::field::if_none_match).find(info.etag) != std::string::npos) {
+		response.result(bserv::http::status::not_modified);
+		response.body().clear();
+		response.prepare_payload();
+		return std::nullopt;
+	}
+
+	std::vector<byte_range> ranges;
+	bool use_ranges = false;
+	std::string range_header = header_value(request, bserv::http::field::range);
+	if (!range_header.empty()
+		&& request.method() == bserv::http::verb::get) {
+		use_ranges = true;
+		// the range only applies if the representation is unchanged
+		std::string validator = trim(header_value(request, bserv::http::field::if_range));
+		if (!validator.empty()) {
+			use_ranges = validator == info.etag || validator == info.last_modified;
+		}
+		if (use_ranges) {
+			use_ranges = parse_ranges(range_header, info.size, ranges);
+		}
+		if (use_ranges && ranges.size() > max_ranges) {
+			use_ranges = false;
+			ranges.clear();
+		}
+		coalesce(ranges);
+	}
+
+	file_source source{ path, info };
+	response.body().clear();
+	if (!use_ranges) {
+		response.set(bserv::http::field::content_type, type);
+		if (info.size > 0) source.read({ 0, info.size - 1 }, response.body());
+	}
+	else if (ranges.empty()) {
+		response.result(bserv::http::status::range_not_satisfiable);
+		response.set(bserv::http::field::content_range,
+			"bytes */" + std::to_string(info.size));
+	}
+	else if (ranges.size() == 1) {
+		response.result(bserv::http::status::partial_content);
+		response.set(bserv::http::field::content_type, type);
+		response.set(bserv::http::field::content_range,
+			content_range(ranges[0], info.size));
+		source.read(ranges[0], response.body());
+	}
+	else {
+		response.result(bserv::http::status::partial_content);
+		response.set(bserv::http::field::content_type,
+			std::string{ "multipart/byteranges; boundary=" } + multipart_boundary);
+		std::string& body = response.body();
+		for (auto& range : ranges) {
+			body += "\r\n--";
+			body += multipart_boundary;
+			body += "\r\nContent-Type: " + type;
+			body += "\r\nContent-Range: " + content_range(range, info.size);
+			body += "\r\n\r\n";
+			source.read(range, body);
+		}
+		body += "\r\n--";
+		body += multipart_boundary;
+		body += "--\r\n";
+	}
+	metrics::static_bytes().add((std::int64_t)response.body().size());
+	response.prepare_payload();
+	return std::nullopt;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <ctime>
+#include <string>
+#include <optional>
+
+#include "bserv/common.hpp"
+
+// an open-ended range (`bytes=N-`) is answered with at most this many
+// bytes, as rfc 9110 allows, and the client asks for the rest with
+// further range requests, as the audio element does. closed and suffix
+// ranges are answered in full (overlapping and adjacent ranges are
+// merged first), so they never cost more than the whole file.
+constexpr std::size_t max_range_chunk = 1024 * 1024;
+
+// at most this many ranges are accepted in a request, otherwise the
+// range header is ignored
+constexpr std::size_t max_ranges = 16;
+
+// on posix systems stored blobs (see blob_store.h) are served from
+// shared read-only mappings (enabled by default): slices are copied
+// straight from the page cache into the response, without read calls
+// or an intermediate buffer. other static files may change under a
+// mapping, so they are read. bserv responses are string bodies, so
+// that one copy remains. it is bounded for range requests, but a GET
+// without a Range header copies the whole file into the heap.
+void set_static_mmap(bool enabled);
+
+// the content type of a file, from its extension
+std::string mime_type(const std::string& path);
+
+// `t` as an http date, e.g. for `Last-Modified`
+std::string http_date(std::time_t t);
+
+// the `Last-Modified` of the file at `path`
+std::string last_modified(const std::string& path);
+
+// serves the file at `path` (already resolved against the static
+// root), supporting single and multiple byte ranges (206 / 416),
+// `If-Range` and `If-None-Match` validation against the ETag.
+std::nullopt_t serve_file(
+	const bserv::request_type& request,
+	bserv::response_type& response,
+	const std::string& path);
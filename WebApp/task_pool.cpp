@@ -0,0 +1,51 @@
+#include "task_pool.h"
+
+task_pool::task_pool(std::size_t num_threads, std::size_t max_queue)
+	: max_queue_{ max_queue } {
+	if (num_threads == 0) num_threads = 1;
+	for (std::size_t i = 0; i < num_threads; ++i) {
+		threads_.emplace_back([this]() { run(); });
+	}
+}
+
+task_pool::~task_pool() {
+	{
+		std::lock_guard<std::mutex> lock{ lock_ };
+		stopping_ = true;
+	}
+	cv_.notify_all();
+	for (auto& thread : threads_) thread.join();
+}
+
+void task_pool::push(std::function<void()> task) {
+	{
+		std::lock_guard<std::mutex> lock{ lock_ };
+		if (stopping_ || queue_.size() >= max_queue_) {
+			++rejected_;
+			throw pool_saturated{ "task queue is full" };
+		}
+		queue_.push_back(std::move(task));
+		depth_ = queue_.size();
+		if (depth_ > max_depth_) max_depth_ = depth_.load();
+	}
+	cv_.notify_one();
+}
+
+void task_pool::run() {
+	while (true) {
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock{ lock_ };
+			cv_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+			if (queue_.empty()) return;
+			task = std::move(queue_.front());
+			queue_.pop_front();
+			depth_ = queue_.size();
+			++busy_;
+		}
+		// exceptions are passed on through the task's future
+		task();
+		--busy_;
+		++completed_;
+	}
+}
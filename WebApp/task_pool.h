@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// thrown by `task_pool::submit` when the queue is full
+struct pool_saturated : std::runtime_error {
+	using std::runtime_error::runtime_error;
+};
+
+// a fixed set of threads, separate from bserv's network threads,
+// that run tasks from a bounded queue.
+// when `max_queue` tasks are already waiting, `submit` fails at once
+// (backpressure) instead of letting the queue grow.
+class task_pool {
+private:
+	std::mutex lock_;
+	std::condition_variable cv_;
+	std::deque<std::function<void()>> queue_;
+	std::vector<std::thread> threads_;
+	std::size_t max_queue_;
+	bool stopping_ = false;
+	std::atomic<std::size_t> depth_{ 0 };
+	std::atomic<std::size_t> max_depth_{ 0 };
+	std::atomic<std::size_t> busy_{ 0 };
+	std::atomic<std::uint64_t> completed_{ 0 };
+	std::atomic<std::uint64_t> rejected_{ 0 };
+	void push(std::function<void()> task);
+	void run();
+public:
+	task_pool(std::size_t num_threads, std::size_t max_queue);
+	task_pool(const task_pool&) = delete;
+	task_pool& operator=(const task_pool&) = delete;
+	// waits for the queued tasks to finish
+	~task_pool();
+	template <typename Func>
+	std::future<std::invoke_result_t<Func>> submit(Func&& func) {
+		using result_type = std::invoke_result_t<Func>;
+		auto task = std::make_shared<std::packaged_task<result_type()>>(
+			std::forward<Func>(func));
+		auto future = task->get_future();
+		push([task]() { (*task)(); });
+		return future;
+	}
+	std::size_t num_threads() const { return threads_.size(); }
+	std::size_t max_queue() const { return max_queue_; }
+	// tasks waiting in the queue
+	std::size_t queue_depth() const { return depth_; }
+	// the deepest the queue has been
+	std::size_t max_queue_depth() const { return max_depth_; }
+	// tasks being run
+	std::size_t busy() const { return busy_; }
+	std::uint64_t completed() const { return completed_; }
+	std::uint64_t rejected() const { return rejected_; }
+};
@@ -0,0 +1,328 @@
+#include "transcoding.h"
+
+#include <algorithm>
+#include <cmath>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <sstream>
+#include <unordered_map>
+
+#include <boost/json.hpp>
+
+#include "bserv/common.hpp"
+
+#include "mp3.h"
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
+
+namespace {
+
+	transcoding_options options_;
+
+	std::shared_mutex cache_lock_;
+	// null for the files known to have no sidecar yet
+	std::unordered_map<std::string, std::shared_ptr<const media_info>> cache_;
+
+	std::atomic<std::uint64_t> transcoded_{ 0 };
+	std::atomic<std::uint64_t> failures_{ 0 };
+
+	// the waveform has this many points, the peaks of equal stretches
+	const std::size_t waveform_points = 100;
+	// the rate the audio is decoded at for the waveform
+	const int waveform_sample_rate = 8000;
+
+	std::string stem(const std::string& music_file) {
+		return music_file.substr(0, music_file.find('.'));
+	}
+
+	std::string sidecar_file(const std::string& music_file) {
+		return stem(music_file) + ".json";
+	}
+
+	// the names given to uploads (see blob_store.h), so that the names
+	// written into ffmpeg's command line need no escaping
+	bool is_plain_name(const std::string& music_file) {
+		if (music_file.empty() || music_file[0] == '.') return false;
+		if (std::count(music_file.begin(), music_file.end(), '.') > 1) return false;
+		return std::all_of(music_file.begin(), music_file.end(), [](unsigned char c) {
+			return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+				|| (c >= '0' && c <= '9') || c == '.' || c == '_' || c == '-' || c == '/';
+		});
+	}
+
+	std::string in_quotes(const std::string& path) {
+		return "\"" + path + "\"";
+	}
+
+	std::optional<std::string> read_file(const std::string& path) {
+		std::ifstream fin{ path, std::ios::binary };
+		if (!fin) return std::nullopt;
+		return std::string{ std::istreambuf_iterator<char>{ fin }, std::istreambuf_iterator<char>{} };
+	}
+
+	void write_file_atomically(const std::string& path, const std::string& content) {
+		std::string temp = path + ".tmp";
+		{
+			std::ofstream fout{ temp, std::ios::binary | std::ios::trunc };
+			fout << content;
+			if (!fout) throw std::runtime_error{ "failed to write " + temp };
+		}
+		std::filesystem::rename(temp, path);
+	}
+
+	// decodes `path` to mono pcm through ffmpeg, returns the peaks and
+	// the number of samples
+	std::pair<std::vector<double>, std::uint64_t> decode_waveform(const std::string& path) {
+		std::string command = in_quotes(options_.ffmpeg) + " -v error -nostdin -i " + in_quotes(path)
+			+ " -vn -ac 1 -ar " + std::to_string(waveform_sample_rate) + " -f s16le -";
+#ifdef _WIN32
+		FILE* pipe = popen(command.c_str(), "rb");
+#else
+		FILE* pipe = popen(command.c_str(), "r");
+#endif
+		if (pipe == nullptr) throw std::runtime_error{ "failed to run ffmpeg" };
+		// the peak of every tenth of a second, reduced to `waveform_points` at the end
+		const std::size_t block = waveform_sample_rate / 10;
+		std::vector<int> blocks;
+		std::uint64_t samples = 0;
+		int peak = 0;
+		std::int16_t buffer[4096];
+		std::size_t n;
+		while ((n = std::fread(buffer, sizeof(std::int16_t), std::size(buffer), pipe)) > 0) {
+			for (std::size_t i = 0; i < n; ++i) {
+				peak = std::max(peak, std::abs((int)buffer[i]));
+				if (++samples % block == 0) {
+					blocks.push_back(peak);
+					peak = 0;
+				}
+			}
+		}
+		if (samples % block != 0) blocks.push_back(peak);
+		if (pclose(pipe) != 0) throw std::runtime_error{ "ffmpeg failed to decode " + path };
+		std::vector<double> waveform;
+		if (blocks.empty()) return { waveform, samples };
+		std::size_t points = std::min(waveform_points, blocks.size());
+		for (std::size_t i = 0; i < points; ++i) {
+			auto first = blocks.begin() + i * blocks.size() / points;
+			auto last = blocks.begin() + (i + 1) * blocks.size() / points;
+			waveform.push_back(*std::max_element(first, last) / 32768.0);
+		}
+		return { waveform, samples };
+	}
+
+	void encode_rendition(const std::string& source, const std::string& target, int bitrate) {
+		std::string temp = target + ".tmp";
+		std::string command = in_quotes(options_.ffmpeg) + " -v error -nostdin -y -i " + in_quotes(source)
+			+ " -vn -map_metadata -1 -codec:a libmp3lame -b:a " + std::to_string(bitrate)
+			+ "k -f mp3 " + in_quotes(temp);
+		if (std::system(command.c_str()) != 0) {
+			std::filesystem::remove(temp);
+			throw std::runtime_error{ "ffmpeg failed to encode " + target };
+		}
+		std::filesystem::rename(temp, target);
+	}
+
+	// writes the segments of the mp3 file `data` and their playlist,
+	// returns how many there are
+	std::size_t write_segments(const std::string& music_file, std::string_view data) {
+		auto segments = mp3::split(data, options_.segment_seconds);
+		if (segments.empty()) return 0;
+		double longest = 0;
+		std::ostringstream playlist;
+		playlist.precision(6);
+		playlist << std::fixed;
+		for (std::size_t i = 0; i < segments.size(); ++i) {
+			write_file_atomically(options_.music_dir + segment_file(music_file, i),
+				std::string{ data.substr(segments[i].offset, segments[i].length) });
+			longest = std::max(longest, segments[i].duration);
+		}
+		playlist << "#EXTM3U\n"
+			<< "#EXT-X-VERSION:3\n"
+			<< "#EXT-X-PLAYLIST-TYPE:VOD\n"
+			<< "#EXT-X-TARGETDURATION:" << (int)std::ceil(longest) << "\n"
+			<< "#EXT-X-MEDIA-SEQUENCE:0\n";
+		for (std::size_t i = 0; i < segments.size(); ++i) {
+			playlist << "#EXTINF:" << segments[i].duration << ",\n" << i << "\n";
+		}
+		playlist << "#EXT-X-ENDLIST\n";
+		// written last, so that the segments it lists exist
+		write_file_atomically(options_.music_dir + playlist_file(music_file), playlist.str());
+		return segments.size();
+	}
+
+	boost::json::object to_json(const media_info& info) {
+		boost::json::array renditions;
+		for (int bitrate : info.renditions) renditions.push_back(bitrate);
+		boost::json::array waveform;
+		for (double peak : info.waveform) waveform.push_back(peak);
+		return {
+			{"duration", info.duration},
+			{"bitrate", info.bitrate},
+			{"renditions", renditions},
+			{"waveform", waveform},
+			{"segments", info.segments}
+		};
+	}
+
+	double as_double(const boost::json::value& value) {
+		return value.is_double() ? value.as_double() : (double)value.as_int64();
+	}
+
+	media_info from_json(const boost::json::object& obj) {
+		media_info info;
+		info.duration = as_double(obj.at("duration"));
+		info.bitrate = (int)obj.at("bitrate").as_int64();
+		for (auto& bitrate : obj.at("renditions").as_array()) {
+			info.renditions.push_back((int)bitrate.as_int64());
+		}
+		for (auto& peak : obj.at("waveform").as_array()) {
+			info.waveform.push_back(as_double(peak));
+		}
+		if (obj.contains("segments")) {
+			info.segments = (std::size_t)obj.at("segments").as_int64();
+		}
+		return info;
+	}
+
+	void process(const std::string& music_file) {
+		std::string path = options_.music_dir + music_file;
+		try {
+			media_info info;
+			auto data = read_file(path);
+			if (!data.has_value()) throw std::runtime_error{ "failed to read " + path };
+			auto mp3_info = mp3::probe(data.value());
+			if (mp3_info.has_value()) {
+				info.duration = mp3_info.value().duration;
+				info.bitrate = mp3_info.value().bitrate;
+				if (options_.segment_seconds > 0) {
+					info.segments = write_segments(music_file, data.value());
+				}
+			}
+			data.reset();
+			if (!options_.ffmpeg.empty() && is_plain_name(music_file)) {
+				auto [waveform, samples] = decode_waveform(path);
+				info.waveform = std::move(waveform);
+				if (!mp3_info.has_value()) info.duration = (double)samples / waveform_sample_rate;
+				for (int bitrate : options_.bitrates) {
+					if (info.bitrate != 0 && bitrate >= info.bitrate) continue;
+					encode_rendition(path, options_.music_dir + rendition_file(music_file, bitrate), bitrate);
+					info.renditions.push_back(bitrate);
+				}
+				std::sort(info.renditions.begin(), info.renditions.end());
+			}
+			write_file_atomically(options_.music_dir + sidecar_file(music_file),
+				boost::json::serialize(to_json(info)));
+			{
+				std::unique_lock<std::shared_mutex> lock{ cache_lock_ };
+				cache_[music_file] = std::make_shared<const media_info>(std::move(info));
+			}
+			++transcoded_;
+		}
+		catch (const std::exception& e) {
+			++failures_;
+			lgwarning << "failed to process " << music_file << ": " << e.what();
+		}
+	}
+
+}
+
+void init_transcoding(const transcoding_options& options) {
+	options_ = options;
+}
+
+task_pool& get_transcoding_pool() {
+	static task_pool pool{ options_.num_threads, options_.max_queue };
+	return pool;
+}
+
+bool submit_transcoding(const std::string& music_file) {
+	try {
+		get_transcoding_pool().submit([music_file]() { process(music_file); });
+		return true;
+	}
+	catch (const pool_saturated&) {
+		return false;
+	}
+}
+
+void backfill_transcoding() {
+	std::vector<std::string> pending;
+	std::error_code ec;
+	// the shard directories of the blob store included
+	for (const auto& file : std::filesystem::recursive_directory_iterator{ options_.music_dir, ec }) {
+		if (!file.is_regular_file()) continue;
+		std::string filename = file.path().filename().string();
+		// renditions, segments and unfinished uploads have more dots
+		if (filename[0] == '.' || std::count(filename.begin(), filename.end(), '.') > 1) continue;
+		auto extension = file.path().extension();
+		if (extension == ".json" || extension == ".m3u8") continue;
+		std::string name = std::filesystem::relative(file.path(), options_.music_dir).generic_string();
+		if (!std::filesystem::exists(options_.music_dir + sidecar_file(name))) {
+			pending.push_back(name);
+		}
+	}
+	if (pending.empty()) return;
+	lginfo << "processing " << pending.size() << " music files without a sidecar";
+	try {
+		get_transcoding_pool().submit([pending]() {
+			for (const auto& name : pending) {
+				if (!submit_transcoding(name)) process(name);
+			}
+		});
+	}
+	catch (const pool_saturated&) {
+		lgwarning << "transcoding queue full, the music files without a sidecar are left for the next start";
+	}
+}
+
+std::shared_ptr<const media_info> get_media_info(const std::string& music_file) {
+	{
+		std::shared_lock<std::shared_mutex> lock{ cache_lock_ };
+		auto it = cache_.find(music_file);
+		if (it != cache_.end()) return it->second;
+	}
+	std::shared_ptr<const media_info> info;
+	auto content = read_file(options_.music_dir + sidecar_file(music_file));
+	if (content.has_value()) {
+		try {
+			info = std::make_shared<const media_info>(
+				from_json(boost::json::parse(content.value()).as_object()));
+		}
+		catch (const std::exception& e) {
+			lgwarning << "invalid sidecar of " << music_file << ": " << e.what();
+		}
+	}
+	std::unique_lock<std::shared_mutex> lock{ cache_lock_ };
+	// a job may have finished meanwhile
+	return cache_.emplace(music_file, info).first->second;
+}
+
+std::string rendition_file(const std::string& music_file, int bitrate) {
+	return stem(music_file) + "." + std::to_string(bitrate) + "k.mp3";
+}
+
+std::string playlist_file(const std::string& music_file) {
+	return stem(music_file) + ".m3u8";
+}
+
+std::string segment_file(const std::string& music_file, std::size_t segment) {
+	return stem(music_file) + "." + std::to_string(segment) + ".mp3";
+}
+
+std::uint64_t transcoded() {
+	return transcoded_;
+}
+
+std::uint64_t transcoding_failures() {
+	return failures_;
+}
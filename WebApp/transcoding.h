@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "task_pool.h"
+
+// uploaded music is processed in the background, on a bounded pool of
+// its own (as password hashing is), so that neither an upload nor a
+// listener waits for it.
+//
+// processing `<name>.<ext>` writes the sidecar `<name>.json` next to it
+// (`<name>` may be a path below the music directory):
+//   {"duration": seconds, "bitrate": kbit/s, "renditions": [kbit/s, ...],
+//    "waveform": [peaks between 0 and 1, ...]}
+// the duration and bitrate of mp3 files come from their frame headers
+// (see mp3.h). with `ffmpeg` configured, the file is also encoded again
+// at each of `bitrates` below its own, as `<name>.<kbit/s>k.mp3`, and
+// decoded for the waveform (and the duration of other formats).
+// without it, the sidecar only has what the headers tell.
+//
+// mp3 files are also cut into segments of `segment_seconds` (see
+// `mp3::split`), `<name>.<n>.mp3`, listed by the hls playlist
+// `<name>.m3u8`. the playlist refers to segment n as just `n`, so it
+// is served from a path whose sibling `n` serves the segment.
+
+struct media_info {
+	double duration = 0;
+	int bitrate = 0;
+	// ascending
+	std::vector<int> renditions;
+	std::vector<double> waveform;
+	// the segments the file was cut into, 0 if it was not
+	std::size_t segments = 0;
+};
+
+struct transcoding_options {
+	std::string music_dir;
+	// the ffmpeg executable, none if empty
+	std::string ffmpeg;
+	std::vector<int> bitrates{ 64, 128 };
+	// 0 to not cut the files into segments
+	double segment_seconds = 10;
+	std::size_t num_threads = 1;
+	std::size_t max_queue = 64;
+};
+
+// must be called before the first job
+void init_transcoding(const transcoding_options& options);
+
+task_pool& get_transcoding_pool();
+
+// queues the processing of `music_file` (a name in the music
+// directory), false if the queue is full
+bool submit_transcoding(const std::string& music_file);
+
+// queues the music files without a sidecar, e.g. those uploaded while
+// the queue was full. when the queue is full it processes them itself,
+// so it never drops one.
+void backfill_transcoding();
+
+// the sidecar of `music_file`, null if it has not been processed
+std::shared_ptr<const media_info> get_media_info(const std::string& music_file);
+
+// the name of the rendition of `music_file` at `bitrate`
+std::string rendition_file(const std::string& music_file, int bitrate);
+
+// the names of the playlist and of the segments of `music_file`
+std::string playlist_file(const std::string& music_file);
+std::string segment_file(const std::string& music_file, std::size_t segment);
+
+// files processed, and those which failed
+std::uint64_t transcoded();
+std::uint64_t transcoding_failures();
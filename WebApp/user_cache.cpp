@@ -0,0 +1,99 @@
+#include "user_cache.h"
+
+#include <functional>
+#include <mutex>
+
+user_cache::user_cache(clock::duration ttl)
+	: ttl_{ ttl.count() } {}
+
+void user_cache::set_ttl(clock::duration ttl) {
+	ttl_ = ttl.count();
+}
+
+user_cache::username_shard& user_cache::shard_of(const std::string& username) {
+	return username_shards_[std::hash<std::string>{}(username) % num_shards];
+}
+
+user_cache::id_shard& user_cache::shard_of(std::int64_t id) {
+	return id_shards_[(std::uint64_t)id % num_shards];
+}
+
+std::optional<boost::json::object> user_cache::get(const std::string& username) {
+	auto& shard = shard_of(username);
+	bool expired = false;
+	{
+		std::shared_lock<std::shared_mutex> lock{ shard.lock };
+		auto it = shard.users.find(username);
+		if (it != shard.users.end()) {
+			if (clock::now() < it->second.expires) {
+				++hits_;
+				return it->second.user;
+			}
+			expired = true;
+		}
+	}
+	if (expired) {
+		std::unique_lock<std::shared_mutex> lock{ shard.lock };
+		auto it = shard.users.find(username);
+		// it may have been put again meanwhile
+		if (it != shard.users.end() && clock::now() >= it->second.expires) {
+			shard.users.erase(it);
+		}
+	}
+	++misses_;
+	return std::nullopt;
+}
+
+std::optional<boost::json::object> user_cache::get(std::int64_t id) {
+	std::string username;
+	{
+		auto& shard = shard_of(id);
+		std::shared_lock<std::shared_mutex> lock{ shard.lock };
+		auto it = shard.usernames.find(id);
+		if (it == shard.usernames.end()) {
+			++misses_;
+			return std::nullopt;
+		}
+		username = it->second;
+	}
+	return get(username);
+}
+
+void user_cache::put(const boost::json::object& user, std::uint64_t generation) {
+	std::int64_t id = user.at("id").as_int64();
+	std::string username = user.at("username").as_string().c_str();
+	// the id is mapped first, so that an `invalidate(id)` which misses
+	// the mapping has bumped the generation before the check below
+	{
+		auto& shard = shard_of(id);
+		std::unique_lock<std::shared_mutex> lock{ shard.lock };
+		shard.usernames[id] = username;
+	}
+	auto& shard = shard_of(username);
+	std::unique_lock<std::shared_mutex> lock{ shard.lock };
+	// checked under the lock: an invalidation either bumped the
+	// generation before, or erases the entry after it is inserted
+	if (generation != generation_) return;
+	shard.users[username] = { user, clock::now() + clock::duration{ ttl_.load() } };
+}
+
+void user_cache::invalidate(const std::string& username) {
+	++generation_;
+	auto& shard = shard_of(username);
+	std::unique_lock<std::shared_mutex> lock{ shard.lock };
+	shard.users.erase(username);
+}
+
+void user_cache::invalidate(std::int64_t id) {
+	++generation_;
+	std::string username;
+	{
+		auto& shard = shard_of(id);
+		std::unique_lock<std::shared_mutex> lock{ shard.lock };
+		auto it = shard.usernames.find(id);
+		if (it == shard.usernames.end()) return;
+		username = std::move(it->second);
+		shard.usernames.erase(it);
+	}
+	invalidate(username);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <boost/json.hpp>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+// an in-process cache of `auth_user` rows, which can be looked up by
+// username or by id.
+// entries expire after `ttl`, and the write paths invalidate the
+// rows they change, so role changes take effect immediately.
+// the entries are spread over independently locked shards, so that
+// lookups from different worker threads rarely contend.
+class user_cache {
+public:
+	using clock = std::chrono::steady_clock;
+private:
+	static constexpr std::size_t num_shards = 16;
+	struct entry {
+		boost::json::object user;
+		clock::time_point expires;
+	};
+	struct username_shard {
+		std::shared_mutex lock;
+		std::unordered_map<std::string, entry> users;
+	};
+	struct id_shard {
+		std::shared_mutex lock;
+		std::unordered_map<std::int64_t, std::string> usernames;
+	};
+	std::array<username_shard, num_shards> username_shards_;
+	std::array<id_shard, num_shards> id_shards_;
+	std::atomic<clock::rep> ttl_;
+	std::atomic<std::uint64_t> hits_{ 0 };
+	std::atomic<std::uint64_t> misses_{ 0 };
+	std::atomic<std::uint64_t> generation_{ 0 };
+	username_shard& shard_of(const std::string& username);
+	id_shard& shard_of(std::int64_t id);
+public:
+	explicit user_cache(clock::duration ttl = std::chrono::seconds{ 30 });
+	void set_ttl(clock::duration ttl);
+	std::optional<boost::json::object> get(const std::string& username);
+	std::optional<boost::json::object> get(std::int64_t id);
+	// bumped by every invalidation
+	std::uint64_t generation() const { return generation_; }
+	// `user` is a row converted by `orm_user`, loaded after
+	// `generation` was read. it is dropped if something was
+	// invalidated in the meantime, since it might be stale.
+	void put(const boost::json::object& user, std::uint64_t generation);
+	void invalidate(const std::string& username);
+	void invalidate(std::int64_t id);
+	std::uint64_t hits() const { return hits_; }
+	std::uint64_t misses() const { return misses_; }
+};
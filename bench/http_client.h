@@ -0,0 +1,96 @@
+#pragma once
+
+// a minimal blocking http client for the load generators,
+// one keep-alive connection per client.
+
+#include <chrono>
+#include <map>
+#include <string>
+
+#include <boost/asio.hpp>
+#include <boost/beast.hpp>
+
+class http_client {
+private:
+	boost::asio::io_context ioc_;
+	boost::beast::tcp_stream stream_;
+	boost::asio::ip::tcp::resolver::results_type endpoints_;
+	std::string host_;
+	std::map<std::string, std::string> cookies_;
+	boost::beast::flat_buffer buffer_;
+	bool connected_ = false;
+public:
+	using request_type = boost::beast::http::request<boost::beast::http::string_body>;
+	using response_type = boost::beast::http::response<boost::beast::http::string_body>;
+
+	http_client(const std::string& host, const std::string& port)
+		: stream_{ ioc_ }, host_{ host } {
+		boost::asio::ip::tcp::resolver resolver{ ioc_ };
+		endpoints_ = resolver.resolve(host, port);
+	}
+
+	// sends the request (with the cookies the server has set for this
+	// client) and waits for the response
+	response_type send(request_type& req) {
+		req.set(boost::beast::http::field::host, host_);
+		req.keep_alive(true);
+		if (!cookies_.empty()) {
+			std::string cookie;
+			for (auto& kv : cookies_) {
+				if (!cookie.empty()) cookie += "; ";
+				cookie += kv.first + "=" + kv.second;
+			}
+			req.set(boost::beast::http::field::cookie, cookie);
+		}
+		req.prepare_payload();
+		for (int attempt = 0; ; ++attempt) {
+			try {
+				if (!connected_) {
+					stream_.connect(endpoints_);
+					connected_ = true;
+				}
+				boost::beast::http::write(stream_, req);
+				response_type res;
+				boost::beast::http::read(stream_, buffer_, res);
+				auto set_cookies = res.equal_range(boost::beast::http::field::set_cookie);
+				for (auto it = set_cookies.first; it != set_cookies.second; ++it) {
+					std::string value{ it->value().data(), it->value().size() };
+					value = value.substr(0, value.find(';'));
+					auto eq = value.find('=');
+					if (eq != std::string::npos) cookies_[value.substr(0, eq)] = value.substr(eq + 1);
+				}
+				if (!res.keep_alive()) close();
+				return res;
+			}
+			catch (const boost::system::system_error&) {
+				// the server may close idle keep-alive connections
+				close();
+				if (attempt > 0) throw;
+			}
+		}
+	}
+
+	response_type get(const std::string& target,
+		const std::string& range = "") {
+		request_type req{ boost::beast::http::verb::get, target, 11 };
+		if (!range.empty()) req.set(boost::beast::http::field::range, range);
+		return send(req);
+	}
+
+	response_type post(const std::string& target,
+		const std::string& body,
+		const std::string& content_type) {
+		request_type req{ boost::beast::http::verb::post, target, 11 };
+		req.set(boost::beast::http::field::content_type, content_type);
+		req.body() = body;
+		return send(req);
+	}
+
+	void close() {
+		boost::beast::error_code ec;
+		stream_.socket().shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+		stream_.socket().close(ec);
+		buffer_.clear();
+		connected_ = false;
+	}
+};
@@ -0,0 +1,372 @@
+// drives a weighted mix of the WebApp routes against a running server
+// whose database was seeded with seed.sql, and reports the throughput
+// and the latency percentiles of every route. the results can be
+// written as json and compared with those of an earlier build, so that
+// regressions are caught before they are deployed.
+//
+// usage: load_bench <host> <port> <password> [options]
+//   --clients <n>          concurrent clients (default 16)
+//   --seconds <n>          measured duration (default 30)
+//   --warmup <n>           seconds run before measuring (default 5)
+//   --users <n>            seeded users, bench_1 ... bench_<n> (default 1000)
+//   --music <first>-<last> seeded music ids (default 1-10000)
+//   --static <target>      static file read with range requests
+//                          (default /statics/css/bootstrap.min.css)
+//   --upload-size <bytes>  size of the uploaded music files (default 262144)
+//   --json <file>          writes the results to `file`
+//   --baseline <file>      compares with the results of an earlier run,
+//                          and fails if a route got slower (p99) or
+//                          slower to serve (throughput) by more than
+//   --tolerance <ratio>    (default 0.1)
+//
+// `password` is the password of the seeded users (that of `superuser`).
+// uploads add music to the database and files to the music directory
+// of the server, so the database should be seeded again between runs
+// that are compared.
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/json.hpp>
+
+#include "http_client.h"
+
+struct options {
+	std::string host;
+	std::string port;
+	std::string password;
+	int clients = 16;
+	int seconds = 30;
+	int warmup = 5;
+	int users = 1000;
+	int first_music = 1;
+	int last_music = 10000;
+	std::string static_target = "/statics/css/bootstrap.min.css";
+	std::size_t upload_size = 256 * 1024;
+	std::string json_file;
+	std::string baseline_file;
+	double tolerance = 0.1;
+};
+
+// what a client keeps between its requests
+struct client_state {
+	const options& opts;
+	http_client client;
+	std::mt19937 rng;
+	std::string username;
+	std::size_t static_size = 0;
+	client_state(const options& opts, int id)
+		: opts{ opts }, client{ opts.host, opts.port }, rng{ (unsigned)id * 7919u + 1 },
+		username{ "bench_" + std::to_string(id % opts.users + 1) } {}
+	int random(int first, int last) {
+		return std::uniform_int_distribution<int>{ first, last }(rng);
+	}
+};
+
+using response_type = http_client::response_type;
+
+// a kind of request. `run` may prepare it with other requests, and then
+// resets `start` to when the measured request is sent.
+struct scenario {
+	const char* name;
+	int weight;
+	std::function<response_type(client_state&, std::chrono::steady_clock::time_point& start)> run;
+};
+
+std::string url_encode(const std::string& s) {
+	std::ostringstream out;
+	out << std::hex << std::uppercase;
+	for (unsigned char c : s) {
+		if (std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') out << c;
+		else out << '%' << std::setw(2) << std::setfill('0') << (int)c;
+	}
+	return out.str();
+}
+
+response_type login(client_state& state) {
+	return state.client.post("/form_login",
+		"username=" + url_encode(state.username) + "&password=" + url_encode(state.opts.password),
+		"application/x-www-form-urlencoded");
+}
+
+int random_music(client_state& state) {
+	return state.random(state.opts.first_music, state.opts.last_music);
+}
+
+std::vector<scenario> make_scenarios() {
+	using time_point = std::chrono::steady_clock::time_point;
+	return {
+		{ "index", 10, [](client_state& state, time_point&) {
+			return state.client.get("/");
+		} },
+		{ "music_repo", 15, [](client_state& state, time_point&) {
+			int pages = std::max(1, (state.opts.last_music - state.opts.first_music + 1) / 10);
+			return state.client.get("/music_repo/" + std::to_string(state.random(1, pages)));
+		} },
+		{ "music", 30, [](client_state& state, time_point&) {
+			return state.client.get("/music/" + std::to_string(random_music(state)));
+		} },
+		{ "form_login", 3, [](client_state& state, time_point&) {
+			return login(state);
+		} },
+		{ "form_post_comment", 8, [](client_state& state, time_point& start) {
+			// the comment goes to the music viewed last
+			state.client.get("/music/" + std::to_string(random_music(state)));
+			start = std::chrono::steady_clock::now();
+			return state.client.post("/form_post_comment",
+				"load_bench comment " + std::to_string(state.rng()), "text/plain");
+		} },
+		{ "statics_range", 30, [](client_state& state, time_point&) {
+			std::size_t size = std::max<std::size_t>(state.static_size, 1);
+			std::size_t first = std::uniform_int_distribution<std::size_t>{ 0, size - 1 }(state.rng);
+			std::string range;
+			switch (state.random(0, 2)) {
+			case 0: // what the audio element sends
+				range = "bytes=" + std::to_string(first) + "-";
+				break;
+			case 1:
+				range = "bytes=" + std::to_string(first) + "-"
+					+ std::to_string(std::min(size - 1, first + 16383));
+				break;
+			default:
+				range = "bytes=0-1023," + std::to_string(first) + "-"
+					+ std::to_string(std::min(size - 1, first + 1023));
+			}
+			return state.client.get(state.opts.static_target, range);
+		} },
+		{ "form_add_music", 1, [](client_state& state, time_point& start) {
+			static const std::string boundary = "----load-bench-boundary-7f3a9c";
+			std::string body = "--" + boundary + "\r\n"
+				"Content-Disposition: form-data; name=\"music_name\"\r\n\r\n"
+				"load bench upload " + std::to_string(state.rng()) + "\r\n"
+				"--" + boundary + "\r\n"
+				"Content-Disposition: form-data; name=\"music_file\"; filename=\"bench.mp3\"\r\n"
+				"Content-Type: audio/mpeg\r\n\r\n";
+			std::size_t header_size = body.size();
+			body.resize(header_size + state.opts.upload_size);
+			for (std::size_t i = header_size; i < body.size(); ++i) body[i] = (char)(state.rng() & 0x7f);
+			body += "\r\n--" + boundary + "--\r\n";
+			start = std::chrono::steady_clock::now();
+			return state.client.post("/form_add_music", body,
+				"multipart/form-data; boundary=" + boundary);
+		} },
+	};
+}
+
+struct route_result {
+	std::string name;
+	long requests = 0;
+	long errors = 0;
+	double throughput = 0;
+	double p50 = 0;
+	double p99 = 0;
+	double p999 = 0;
+};
+
+route_result summarize(const std::string& name, std::vector<double>& samples, long errors, int seconds) {
+	route_result result;
+	result.name = name;
+	result.requests = (long)samples.size();
+	result.errors = errors;
+	result.throughput = (double)samples.size() / seconds;
+	std::sort(samples.begin(), samples.end());
+	auto percentile = [&](double p) {
+		if (samples.empty()) return 0.0;
+		return samples[std::min(samples.size() - 1, (std::size_t)(samples.size() * p))];
+	};
+	result.p50 = percentile(0.5);
+	result.p99 = percentile(0.99);
+	result.p999 = percentile(0.999);
+	return result;
+}
+
+boost::json::object to_json(const route_result& r) {
+	return {
+		{"requests", r.requests},
+		{"errors", r.errors},
+		{"throughput", r.throughput},
+		{"p50_ms", r.p50},
+		{"p99_ms", r.p99},
+		{"p999_ms", r.p999}
+	};
+}
+
+double number(const boost::json::value& v) {
+	if (v.is_double()) return v.get_double();
+	if (v.is_uint64()) return (double)v.get_uint64();
+	return (double)v.as_int64();
+}
+
+// prints how every route compares to `baseline_file`, and returns
+// whether none of them regressed beyond the tolerance
+bool compare(const options& opts, const std::vector<route_result>& results) {
+	std::ifstream fin{ opts.baseline_file, std::ios::binary };
+	std::stringstream ss;
+	ss << fin.rdbuf();
+	boost::json::object baseline = boost::json::parse(ss.str()).as_object();
+	const auto& routes = baseline["routes"].as_object();
+	bool ok = true;
+	std::cout << "\ncompared with " << opts.baseline_file << ":" << std::endl;
+	for (const auto& r : results) {
+		auto it = routes.find(r.name);
+		if (it == routes.end()) continue;
+		const auto& before = it->value().as_object();
+		double p99 = number(before.at("p99_ms"));
+		double throughput = number(before.at("throughput"));
+		double p99_change = p99 > 0 ? r.p99 / p99 - 1 : 0;
+		double throughput_change = throughput > 0 ? r.throughput / throughput - 1 : 0;
+		bool regressed = p99_change > opts.tolerance || throughput_change < -opts.tolerance;
+		ok = ok && !regressed;
+		std::cout << std::left << std::setw(20) << r.name << std::right << std::showpos
+			<< " p99 " << std::setw(7) << p99_change * 100 << "%"
+			<< "  throughput " << std::setw(7) << throughput_change * 100 << "%"
+			<< std::noshowpos << (regressed ? "  REGRESSED" : "") << std::endl;
+	}
+	return ok;
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 4) {
+		std::cerr << "usage: " << argv[0] << " <host> <port> <password> [--clients n] [--seconds n]"
+			" [--warmup n] [--users n] [--music first-last] [--static target] [--upload-size bytes]"
+			" [--json file] [--baseline file] [--tolerance ratio]" << std::endl;
+		return EXIT_FAILURE;
+	}
+	options opts;
+	opts.host = argv[1];
+	opts.port = argv[2];
+	opts.password = argv[3];
+	for (int i = 4; i + 1 < argc; i += 2) {
+		std::string name = argv[i], value = argv[i + 1];
+		if (name == "--clients") opts.clients = std::atoi(value.c_str());
+		else if (name == "--seconds") opts.seconds = std::atoi(value.c_str());
+		else if (name == "--warmup") opts.warmup = std::atoi(value.c_str());
+		else if (name == "--users") opts.users = std::atoi(value.c_str());
+		else if (name == "--music") {
+			opts.first_music = std::atoi(value.c_str());
+			opts.last_music = std::atoi(value.substr(value.find('-') + 1).c_str());
+		}
+		else if (name == "--static") opts.static_target = value;
+		else if (name == "--upload-size") opts.upload_size = (std::size_t)std::atoll(value.c_str());
+		else if (name == "--json") opts.json_file = value;
+		else if (name == "--baseline") opts.baseline_file = value;
+		else if (name == "--tolerance") opts.tolerance = std::atof(value.c_str());
+		else {
+			std::cerr << "unknown option " << name << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	auto scenarios = make_scenarios();
+	std::vector<int> weights;
+	for (auto& s : scenarios) weights.push_back(s.weight);
+	std::discrete_distribution<std::size_t> pick_scenario{ weights.begin(), weights.end() };
+
+	std::atomic<bool> measuring{ false }, stop{ false };
+	std::mutex results_lock;
+	std::vector<std::vector<double>> samples(scenarios.size());
+	std::vector<long> errors(scenarios.size());
+	std::atomic<long> setup_errors{ 0 };
+
+	std::vector<std::thread> threads;
+	for (int id = 0; id < opts.clients; ++id) {
+		threads.emplace_back([&, id]() {
+			client_state state{ opts, id };
+			std::vector<std::vector<double>> my_samples(scenarios.size());
+			std::vector<long> my_errors(scenarios.size());
+			try {
+				login(state);
+				state.static_size = state.client.get(opts.static_target).body().size();
+			}
+			catch (const std::exception&) {
+				++setup_errors;
+				return;
+			}
+			auto pick = pick_scenario;
+			while (!stop) {
+				std::size_t s = pick(state.rng);
+				auto start = std::chrono::steady_clock::now();
+				bool failed = false;
+				try {
+					auto res = scenarios[s].run(state, start);
+					failed = res.result_int() >= 500;
+				}
+				catch (const std::exception&) {
+					failed = true;
+				}
+				std::chrono::duration<double, std::milli> elapsed =
+					std::chrono::steady_clock::now() - start;
+				if (!measuring) continue;
+				if (failed) ++my_errors[s];
+				else my_samples[s].push_back(elapsed.count());
+			}
+			std::lock_guard<std::mutex> lock{ results_lock };
+			for (std::size_t s = 0; s < scenarios.size(); ++s) {
+				samples[s].insert(samples[s].end(), my_samples[s].begin(), my_samples[s].end());
+				errors[s] += my_errors[s];
+			}
+		});
+	}
+	std::this_thread::sleep_for(std::chrono::seconds{ opts.warmup });
+	measuring = true;
+	std::this_thread::sleep_for(std::chrono::seconds{ opts.seconds });
+	measuring = false;
+	stop = true;
+	for (auto& thread : threads) thread.join();
+
+	std::vector<route_result> results;
+	std::vector<double> all_samples;
+	long all_errors = 0;
+	for (std::size_t s = 0; s < scenarios.size(); ++s) {
+		all_samples.insert(all_samples.end(), samples[s].begin(), samples[s].end());
+		all_errors += errors[s];
+		results.push_back(summarize(scenarios[s].name, samples[s], errors[s], opts.seconds));
+	}
+	route_result total = summarize("total", all_samples, all_errors, opts.seconds);
+
+	std::cout << opts.clients << " clients, " << opts.seconds << " s";
+	if (setup_errors > 0) std::cout << ", " << setup_errors << " clients failed to start";
+	std::cout << "\n" << std::left << std::setw(20) << "route" << std::right
+		<< std::setw(10) << "requests" << std::setw(10) << "req/s"
+		<< std::setw(10) << "p50 ms" << std::setw(10) << "p99 ms"
+		<< std::setw(10) << "p999 ms" << std::setw(8) << "errors" << std::endl;
+	std::cout << std::fixed << std::setprecision(2);
+	results.push_back(total);
+	for (auto& r : results) {
+		std::cout << std::left << std::setw(20) << r.name << std::right
+			<< std::setw(10) << r.requests << std::setw(10) << r.throughput
+			<< std::setw(10) << r.p50 << std::setw(10) << r.p99
+			<< std::setw(10) << r.p999 << std::setw(8) << r.errors << std::endl;
+	}
+	std::cout.unsetf(std::ios::fixed);
+
+	if (!opts.json_file.empty()) {
+		boost::json::object routes;
+		for (auto& r : results) routes[r.name] = to_json(r);
+		boost::json::object out{
+			{"clients", opts.clients},
+			{"seconds", opts.seconds},
+			{"routes", routes}
+		};
+		std::ofstream fout{ opts.json_file, std::ios::binary };
+		fout << boost::json::serialize(out) << std::endl;
+	}
+	if (!opts.baseline_file.empty() && !compare(opts, results)) {
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,96 @@
+// drives a burst of logins against a running WebApp while other
+// clients fetch a static file, and reports the login throughput
+// (and how many logins were refused with a 503) next to the latency
+// of the static requests. with more login clients than the hashing
+// threads plus `hash-queue-size` (or a lower `hash-in-flight`), the
+// extra logins should be refused.
+//
+// usage: login_bench <host> <port> <username> <password>
+//        [login-clients] [static-clients] [seconds]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "http_client.h"
+
+int main(int argc, char* argv[]) {
+	if (argc < 5) {
+		std::cerr << "usage: " << argv[0] << " <host> <port> <username> <password>"
+			" [login-clients] [static-clients] [seconds]" << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::string host = argv[1], port = argv[2];
+	std::string body = std::string{ "{\"username\": \"" } + argv[3]
+		+ "\", \"password\": \"" + argv[4] + "\"}";
+	int login_clients = argc > 5 ? std::atoi(argv[5]) : 8;
+	int static_clients = argc > 6 ? std::atoi(argv[6]) : 2;
+	int seconds = argc > 7 ? std::atoi(argv[7]) : 10;
+
+	std::atomic<bool> stop{ false };
+	std::atomic<long> logins{ 0 }, refused{ 0 }, errors{ 0 };
+	std::mutex samples_lock;
+	std::vector<double> static_samples;
+
+	std::vector<std::thread> threads;
+	for (int i = 0; i < login_clients; ++i) {
+		threads.emplace_back([&]() {
+			http_client client{ host, port };
+			while (!stop) {
+				try {
+					auto res = client.post("/login", body, "application/json");
+					if (res.result_int() == 503) ++refused;
+					else ++logins;
+				}
+				catch (const std::exception&) {
+					++errors;
+				}
+			}
+		});
+	}
+	for (int i = 0; i < static_clients; ++i) {
+		threads.emplace_back([&]() {
+			http_client client{ host, port };
+			std::vector<double> samples;
+			while (!stop) {
+				auto start = std::chrono::steady_clock::now();
+				try {
+					client.get("/statics/css/comment.css");
+				}
+				catch (const std::exception&) {
+					++errors;
+					continue;
+				}
+				std::chrono::duration<double, std::milli> elapsed =
+					std::chrono::steady_clock::now() - start;
+				samples.push_back(elapsed.count());
+			}
+			std::lock_guard<std::mutex> lock{ samples_lock };
+			static_samples.insert(static_samples.end(), samples.begin(), samples.end());
+		});
+	}
+	std::this_thread::sleep_for(std::chrono::seconds{ seconds });
+	stop = true;
+	for (auto& thread : threads) thread.join();
+
+	std::sort(static_samples.begin(), static_samples.end());
+	auto percentile = [&](double p) {
+		if (static_samples.empty()) return 0.0;
+		return static_samples[std::min(static_samples.size() - 1,
+			(std::size_t)(static_samples.size() * p))];
+	};
+	std::cout << "logins: " << logins << " (" << (double)logins / seconds << "/s)"
+		<< "\nrefused (503): " << refused
+		<< "\nerrors: " << errors
+		<< "\nstatic requests: " << static_samples.size()
+		<< "\nstatic p50: " << percentile(0.5) << " ms"
+		<< "\nstatic p99: " << percentile(0.99) << " ms"
+		<< "\nstatic max: " << (static_samples.empty() ? 0.0 : static_samples.back()) << " ms" << std::endl;
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,72 @@
+// measures what the instrumentation of the routes (see
+// WebApp/metrics.h) adds to a request: a call through
+// `instrumented<&handler>` with a db, a render and a serialization
+// phase, against the same handler called directly, on several threads
+// at once.
+//
+// usage: metrics_bench [threads] [requests per thread]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "metrics.h"
+
+// stands for a handler: the phases are empty, so that only the
+// instrumentation is measured
+int handler(int value) {
+	{
+		metrics::phase_timer timer{ metrics::phase_db };
+		value = value * 31 + 7;
+	}
+	{
+		metrics::phase_timer timer{ metrics::phase_render };
+		value ^= value >> 3;
+	}
+	{
+		metrics::phase_timer timer{ metrics::phase_serialize };
+		value += 1;
+	}
+	return value;
+}
+
+// the cpu time of a call: the threads beyond the number of cores
+// only take turns
+template <typename Func>
+double nanoseconds_per_call(int num_threads, int iterations, Func func) {
+	std::vector<std::thread> threads;
+	// the results are summed up, so that the calls cannot be left out
+	std::atomic<long long> sink{ 0 };
+	auto start = std::chrono::steady_clock::now();
+	for (int t = 0; t < num_threads; ++t) {
+		threads.emplace_back([&, t]() {
+			long long sum = 0;
+			for (int i = 0; i < iterations; ++i) sum += func(i + t);
+			sink += sum;
+		});
+	}
+	for (auto& thread : threads) thread.join();
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	double cores = std::min<unsigned>(num_threads, std::max(1u, std::thread::hardware_concurrency()));
+	return elapsed.count() * cores / ((double)iterations * num_threads);
+}
+
+int main(int argc, char* argv[]) {
+	int num_threads = argc > 1 ? std::atoi(argv[1]) : 4;
+	int iterations = argc > 2 ? std::atoi(argv[2]) : 10000000;
+	metrics::instrumented<&handler>::metrics = &metrics::add_route("/bench");
+
+	double direct = nanoseconds_per_call(num_threads, iterations, &handler);
+	double instrumented = nanoseconds_per_call(num_threads, iterations,
+		&metrics::instrumented<&handler>::call);
+	std::cout << num_threads << " threads" << std::endl
+		<< "direct: " << direct << " ns/request" << std::endl
+		<< "instrumented: " << instrumented << " ns/request" << std::endl
+		<< "overhead: " << instrumented - direct << " ns/request, "
+		<< (instrumented - direct) / 1000 << "% of a 100 us request" << std::endl;
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,195 @@
+// measures the database time of the music, profile and listing pages:
+// the statements the handlers used to run one after the other inside a
+// transaction, against the single statement they run now (see
+// `stmt::music_page` and `stmt::profile_page` in WebApp/statements.cpp).
+// the difference is mostly round trips, so it grows with the latency to
+// the database; to simulate a remote database on one machine, e.g.
+//
+//   tc qdisc add dev lo root netem delay 1ms    (and `del` to undo it)
+//
+// usage: page_bench <conn-str> [iterations] [music_id] [user_id]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <pqxx/pqxx>
+
+struct latency {
+	double mean;
+	double p50;
+	double p99;
+};
+
+template <typename Func>
+latency measure(int iterations, Func&& func) {
+	std::vector<double> samples;
+	samples.reserve(iterations);
+	for (int i = 0; i < iterations; ++i) {
+		auto start = std::chrono::steady_clock::now();
+		func();
+		std::chrono::duration<double, std::micro> elapsed =
+			std::chrono::steady_clock::now() - start;
+		samples.push_back(elapsed.count());
+	}
+	std::sort(samples.begin(), samples.end());
+	double sum = 0;
+	for (double sample : samples) sum += sample;
+	return {
+		sum / samples.size(),
+		samples[samples.size() / 2],
+		samples[std::min(samples.size() - 1, samples.size() * 99 / 100)]
+	};
+}
+
+void report(const std::string& name, const latency& before, const latency& after) {
+	std::cout << name << std::endl
+		<< "  statements: mean " << before.mean << " us, p50 " << before.p50
+		<< " us, p99 " << before.p99 << " us" << std::endl
+		<< "  one statement: mean " << after.mean << " us, p50 " << after.p50
+		<< " us, p99 " << after.p99 << " us" << std::endl
+		<< "  mean latency drop: " << (1 - after.mean / before.mean) * 100 << "%" << std::endl;
+}
+
+// as in WebApp/statements.cpp
+const char* statements[] = {
+	"prepare bench_get_music as "
+	"select music_id, username musician, music_name, music_path, music.is_active "
+	"from music join auth_user on music.musician_id = auth_user.id where music_id = $1",
+
+	"prepare bench_list_comments as "
+	"select comment_id, username, comment_time, comment_content "
+	"from comment join auth_user on comment.user_id = auth_user.id "
+	"where music_id = $1 order by comment_time desc, comment_id desc limit $2",
+
+	"prepare bench_get_favorite as "
+	"select create_time from favorite where user_id = $1 and music_id = $2",
+
+	"prepare bench_get_user_by_id as "
+	"select * from auth_user where id = $1",
+
+	"prepare bench_list_favorites as "
+	"select favorite.music_id, username, music_name, music_path, music.is_active "
+	"from favorite join music on favorite.music_id = music.music_id "
+	"join auth_user on music.musician_id = auth_user.id "
+	"where user_id = $1 and music.is_active = true order by create_time desc",
+
+	"prepare bench_list_user_music as "
+	"select music_id, username, music_name, music_path, music.is_active "
+	"from music join auth_user on music.musician_id = auth_user.id "
+	"where id = $1 and music.is_active = true order by music_id",
+
+	"prepare bench_list_music as "
+	"select music_id, username musician, music_name, music_path, music.is_active "
+	"from music join auth_user on music.musician_id = auth_user.id "
+	"where music.is_active = true and music_id >= $1 order by music_id limit $2",
+
+	"prepare bench_music_page as "
+	"select "
+	"(select json_build_object('music_id', music_id, 'musician', username, "
+	"'music_name', music_name, 'music_path', music_path, 'is_active', music.is_active) "
+	"from music join auth_user on music.musician_id = auth_user.id where music_id = $1), "
+	"(select coalesce(json_agg(json_build_object('comment_id', comment_id, 'username', username, "
+	"'comment_time', comment_time::text, 'comment_content', comment_content) "
+	"order by comment_time desc, comment_id desc), '[]') "
+	"from (select comment_id, username, comment_time, comment_content "
+	"from comment join auth_user on comment.user_id = auth_user.id "
+	"where music_id = $1 order by comment_time desc, comment_id desc limit $3) c), "
+	"exists (select 1 from favorite where user_id = $2 and music_id = $1)",
+
+	"prepare bench_profile_page as "
+	"select "
+	"(select row_to_json(auth_user) from auth_user where id = $1), "
+	"(select coalesce(json_agg(json_build_object('music_id', favorite.music_id, 'musician', username, "
+	"'music_name', music_name, 'music_path', music_path, 'is_active', music.is_active) "
+	"order by create_time desc), '[]') "
+	"from favorite join music on favorite.music_id = music.music_id "
+	"join auth_user on music.musician_id = auth_user.id "
+	"where user_id = $1 and music.is_active = true), "
+	"(select coalesce(json_agg(json_build_object('music_id', music_id, 'musician', username, "
+	"'music_name', music_name, 'music_path', music_path, 'is_active', music.is_active) "
+	"order by music_id), '[]') "
+	"from music join auth_user on music.musician_id = auth_user.id "
+	"where id = $1 and music.is_active = true)",
+};
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		std::cerr << "usage: " << argv[0]
+			<< " <conn-str> [iterations] [music_id] [user_id]" << std::endl;
+		return EXIT_FAILURE;
+	}
+	int iterations = argc > 2 ? std::atoi(argv[2]) : 10000;
+	std::string music_id = argc > 3 ? argv[3] : "1";
+	std::string user_id = argc > 4 ? argv[4] : "1";
+	// as in WebApp/handlers.cpp: a page of comments (and one more),
+	// a page of the listings
+	const std::string comments_limit = "21";
+	const std::string page_size = "10";
+	try {
+		pqxx::connection conn{ argv[1] };
+		pqxx::nontransaction tx{ conn };
+		for (auto statement : statements) tx.exec(statement);
+		std::size_t rows = 0;
+
+		// the music page used two transactions: `load_music`, then the
+		// comments and the favorite
+		auto music_before = [&]() {
+			tx.exec("begin");
+			rows += tx.exec("execute bench_get_music(" + music_id + ")").size();
+			tx.exec("rollback");
+			tx.exec("begin");
+			rows += tx.exec("execute bench_list_comments(" + music_id + ", " + comments_limit + ")").size();
+			rows += tx.exec("execute bench_get_favorite(" + user_id + ", " + music_id + ")").size();
+			tx.exec("rollback");
+		};
+		auto music_after = [&]() {
+			rows += tx.exec("execute bench_music_page(" + music_id + ", " + user_id + ", "
+				+ comments_limit + ")").size();
+		};
+		auto profile_before = [&]() {
+			tx.exec("begin");
+			rows += tx.exec("execute bench_get_user_by_id(" + user_id + ")").size();
+			rows += tx.exec("execute bench_list_favorites(" + user_id + ")").size();
+			rows += tx.exec("execute bench_list_user_music(" + user_id + ")").size();
+			tx.exec("rollback");
+		};
+		auto profile_after = [&]() {
+			rows += tx.exec("execute bench_profile_page(" + user_id + ")").size();
+		};
+		auto listing_before = [&]() {
+			tx.exec("begin");
+			rows += tx.exec("execute bench_list_music(" + music_id + ", " + page_size + ")").size();
+			tx.exec("rollback");
+		};
+		auto listing_after = [&]() {
+			rows += tx.exec("execute bench_list_music(" + music_id + ", " + page_size + ")").size();
+		};
+
+		// warm up the connection and the plan cache
+		for (int i = 0; i < 100; ++i) {
+			music_before();
+			music_after();
+			profile_before();
+			profile_after();
+			listing_before();
+			listing_after();
+		}
+		std::cout << "iterations: " << iterations << std::endl;
+		auto before = measure(iterations, music_before);
+		report("music page", before, measure(iterations, music_after));
+		before = measure(iterations, profile_before);
+		report("profile page", before, measure(iterations, profile_after));
+		before = measure(iterations, listing_before);
+		report("music_repo page", before, measure(iterations, listing_after));
+		tx.exec("deallocate all");
+		return rows == 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+}
@@ -0,0 +1,101 @@
+// compares the two ways of handing a render context to inja:
+// serializing the `boost::json` context and parsing the text again,
+// and converting it directly with `to_inja_json`.
+//
+// usage: render_bench [iterations] [comments] [template_root]
+// if `template_root` is given, `music.html` is rendered as well.
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include <boost/json.hpp>
+#include <inja/inja.hpp>
+
+#include "json_bridge.h"
+
+boost::json::object make_music_context(int num_comments) {
+	boost::json::object user{
+		{"id", 42},
+		{"username", "listener42"},
+		{"password", "KZfaabUkFFUZLArn$w5XUUH3i2eohBk26uvvUujjPtzo9yV1hNeCVp/P5k64="},
+		{"is_superuser", false},
+		{"first_name", "First"},
+		{"last_name", "Last"},
+		{"email", "listener42@example.com"},
+		{"is_active", true},
+		{"is_musician", 0}
+	};
+	boost::json::object music{
+		{"music_name", "Some Track Name"},
+		{"musician", "musician7"},
+		{"music_path", "/statics/musics/17.mp3"},
+		{"music_id", 17}
+	};
+	boost::json::array comments;
+	for (int i = 0; i < num_comments; ++i) {
+		comments.push_back({
+			{"comment_id", num_comments - i},
+			{"username", "user" + std::to_string(i % 97)},
+			{"comment_time", "2022-12-31 12:34:56.789012"},
+			{"comment_content", "this is comment number " + std::to_string(i)
+				+ ", long enough to look like a real one."}
+		});
+	}
+	return {
+		{"user", user},
+		{"music", music},
+		{"comments", comments},
+		{"is_favorite", true},
+		{"success", true},
+		{"message", "comment posted"}
+	};
+}
+
+template <typename Func>
+double measure(int iterations, Func&& func) {
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; ++i)
+		func();
+	std::chrono::duration<double, std::micro> elapsed =
+		std::chrono::steady_clock::now() - start;
+	return elapsed.count() / iterations;
+}
+
+int main(int argc, char* argv[]) {
+	int iterations = argc > 1 ? std::atoi(argv[1]) : 2000;
+	int num_comments = argc > 2 ? std::atoi(argv[2]) : 300;
+	boost::json::object context = make_music_context(num_comments);
+
+	std::size_t sink = 0;
+	double round_trip = measure(iterations, [&]() {
+		inja::json data = inja::json::parse(boost::json::serialize(context));
+		sink += data.size();
+	});
+	double direct = measure(iterations, [&]() {
+		inja::json data = to_inja_json(context);
+		sink += data.size();
+	});
+	if (inja::json::parse(boost::json::serialize(context)) != to_inja_json(context)) {
+		std::cerr << "the two conversions disagree" << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::cout << "comments: " << num_comments
+		<< "\niterations: " << iterations
+		<< "\nserialize + parse: " << round_trip << " us/op"
+		<< "\nto_inja_json: " << direct << " us/op"
+		<< "\nspeedup: " << round_trip / direct << "x" << std::endl;
+
+	if (argc > 3) {
+		std::string template_root = argv[3];
+		if (template_root.back() != '/') template_root.push_back('/');
+		inja::Environment env;
+		inja::Template tmpl = env.parse_template(template_root + "music.html");
+		double rendering = measure(iterations, [&]() {
+			sink += env.render(tmpl, to_inja_json(context)).size();
+		});
+		std::cout << "render music.html (cached template): " << rendering << " us/op" << std::endl;
+	}
+	return sink == 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
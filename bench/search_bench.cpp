@@ -0,0 +1,133 @@
+// builds the search index (see WebApp/search_index.h) over a synthetic
+// catalogue and measures the latency of exact, prefix, multi-term and
+// misspelled queries, and of incremental updates.
+//
+// usage: search_bench [tracks] [queries]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "search_index.h"
+
+struct latency {
+	double mean;
+	double p50;
+	double p99;
+};
+
+template <typename Func>
+latency measure(int iterations, Func&& func) {
+	std::vector<double> samples;
+	samples.reserve(iterations);
+	for (int i = 0; i < iterations; ++i) {
+		auto start = std::chrono::steady_clock::now();
+		func(i);
+		std::chrono::duration<double, std::micro> elapsed =
+			std::chrono::steady_clock::now() - start;
+		samples.push_back(elapsed.count());
+	}
+	std::sort(samples.begin(), samples.end());
+	double sum = 0;
+	for (double sample : samples) sum += sample;
+	return {
+		sum / samples.size(),
+		samples[samples.size() / 2],
+		samples[std::min(samples.size() - 1, samples.size() * 99 / 100)]
+	};
+}
+
+void report(const std::string& name, const latency& l) {
+	std::cout << name << ": mean " << l.mean << " us, p50 " << l.p50
+		<< " us, p99 " << l.p99 << " us" << std::endl;
+}
+
+// pronounceable pseudo-words, so that prefixes are shared the way
+// they are in real titles
+std::string make_word(std::mt19937& rng) {
+	static const char* syllables[] = {
+		"la", "lo", "ve", "mi", "ra", "no", "ka", "si", "tu", "de",
+		"ri", "ma", "so", "ne", "ta", "li", "ko", "be", "da", "ru",
+		"on", "el", "an", "ar", "in", "er", "us", "or", "en", "is"
+	};
+	std::uniform_int_distribution<int> count{ 2, 4 };
+	std::uniform_int_distribution<int> pick{ 0, 29 };
+	std::string word;
+	for (int i = count(rng); i > 0; --i) word += syllables[pick(rng)];
+	return word;
+}
+
+int main(int argc, char* argv[]) {
+	int num_tracks = argc > 1 ? std::atoi(argv[1]) : 1000000;
+	int iterations = argc > 2 ? std::atoi(argv[2]) : 10000;
+	std::mt19937 rng{ 42 };
+
+	// a skewed vocabulary of title words and a pool of musicians
+	std::vector<std::string> words(20000), musicians(50000);
+	for (auto& word : words) word = make_word(rng);
+	for (auto& musician : musicians) musician = make_word(rng) + std::to_string(rng() % 100);
+	std::uniform_real_distribution<double> uniform{ 0, 1 };
+	auto zipf_word = [&]() -> const std::string& {
+		return words[(std::size_t)(words.size() * uniform(rng) * uniform(rng))];
+	};
+	std::uniform_int_distribution<int> title_length{ 1, 4 };
+	std::uniform_int_distribution<std::size_t> pick_musician{ 0, musicians.size() - 1 };
+
+	std::vector<search_index::track> tracks;
+	tracks.reserve(num_tracks);
+	for (int i = 1; i <= num_tracks; ++i) {
+		std::string name = zipf_word();
+		for (int j = title_length(rng) - 1; j > 0; --j) name += " " + zipf_word();
+		tracks.push_back({ i, name, musicians[pick_musician(rng)] });
+	}
+
+	search_index index;
+	auto start = std::chrono::steady_clock::now();
+	index.assign(tracks);
+	std::chrono::duration<double, std::milli> build = std::chrono::steady_clock::now() - start;
+	std::cout << "indexed " << index.size() << " tracks, " << index.num_terms()
+		<< " terms in " << build.count() << " ms" << std::endl;
+
+	// queries are taken from the catalogue, so that they match something
+	std::vector<const search_index::track*> samples(iterations);
+	for (auto& sample : samples) sample = &tracks[rng() % tracks.size()];
+	auto first_word = [&](int i) {
+		return search_index::tokenize(samples[i]->music_name)[0];
+	};
+	std::size_t found = 0;
+	auto run = [&](const std::string& name, auto make_query) {
+		std::vector<std::string> queries(iterations);
+		for (int i = 0; i < iterations; ++i) queries[i] = make_query(i);
+		found = 0;
+		report(name, measure(iterations, [&](int i) {
+			found += index.search(queries[i], 20).size();
+		}));
+		std::cout << "  mean results: " << (double)found / iterations << std::endl;
+	};
+	run("exact term", [&](int i) { return first_word(i); });
+	run("prefix (3 chars)", [&](int i) { return first_word(i).substr(0, 3); });
+	run("title + musician", [&](int i) {
+		return first_word(i) + " " + samples[i]->musician.substr(0, 5);
+	});
+	run("whole title", [&](int i) { return samples[i]->music_name; });
+	run("misspelled term", [&](int i) {
+		std::string word = first_word(i);
+		if (word.size() >= search_index::min_typo_length) {
+			std::swap(word[word.size() / 2], word[word.size() / 2 + 1]);
+		}
+		return word;
+	});
+
+	int next_id = num_tracks + 1;
+	report("add", measure(iterations, [&](int i) {
+		index.add({ next_id++, samples[i]->music_name + " remix", samples[i]->musician });
+	}));
+	report("remove", measure(iterations, [&](int i) {
+		index.remove(samples[i]->music_id);
+	}));
+	return EXIT_SUCCESS;
+}
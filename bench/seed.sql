@@ -0,0 +1,89 @@
+-- synthetic data for load_bench, loaded into the database created by
+-- db.sql (before the server starts, since it builds its search index
+-- and caches from the database):
+--
+--   psql -d bserv -v users=1000 -v music=10000 -v comments=200000 -v favorites=50000 -f seed.sql
+--
+-- the users are named bench_1 ... bench_<users>, are musicians (so
+-- they may upload), and share the password of `superuser`. running
+-- the script again replaces the previous bench data.
+
+\if :{?users}
+\else
+\set users 1000
+\endif
+\if :{?music}
+\else
+\set music 10000
+\endif
+\if :{?comments}
+\else
+\set comments 200000
+\endif
+\if :{?favorites}
+\else
+\set favorites 50000
+\endif
+
+BEGIN;
+
+DELETE FROM favorite WHERE user_id IN (SELECT id FROM auth_user WHERE username LIKE 'bench\_%');
+DELETE FROM comment WHERE user_id IN (SELECT id FROM auth_user WHERE username LIKE 'bench\_%');
+DELETE FROM favorite WHERE music_id IN (SELECT music_id FROM music WHERE musician_id IN
+    (SELECT id FROM auth_user WHERE username LIKE 'bench\_%'));
+DELETE FROM comment WHERE music_id IN (SELECT music_id FROM music WHERE musician_id IN
+    (SELECT id FROM auth_user WHERE username LIKE 'bench\_%'));
+DELETE FROM music WHERE musician_id IN (SELECT id FROM auth_user WHERE username LIKE 'bench\_%');
+DELETE FROM auth_user WHERE username LIKE 'bench\_%';
+
+INSERT INTO auth_user (username, password, is_superuser, first_name, last_name, email, is_active, is_musician)
+SELECT 'bench_' || i, (SELECT password FROM auth_user WHERE username = 'superuser'),
+    false, 'Bench', 'User ' || i, 'bench_' || i || '@example.com', true, 2
+FROM generate_series(1, :users) AS i;
+
+-- titles from a small vocabulary, so that the search has shared terms
+INSERT INTO music (musician_id, music_name, music_path, is_active)
+SELECT (SELECT min(id) FROM auth_user WHERE username LIKE 'bench\_%') + (i % :users),
+    (ARRAY['love', 'night', 'summer', 'blue', 'river', 'dream', 'fire', 'rain', 'city', 'heart'])[1 + i % 10]
+        || ' ' || (ARRAY['song', 'waltz', 'blues', 'theme', 'dance', 'ballad', 'march'])[1 + (i / 10) % 7]
+        || ' ' || i,
+    'bench.mp3', true
+FROM generate_series(1, :music) AS i;
+
+CREATE TEMPORARY TABLE bench_music AS
+SELECT music_id, row_number() OVER (ORDER BY music_id) - 1 AS n
+FROM music WHERE music_path = 'bench.mp3';
+
+CREATE TEMPORARY TABLE bench_users AS
+SELECT id, row_number() OVER (ORDER BY id) - 1 AS n
+FROM auth_user WHERE username LIKE 'bench\_%';
+
+-- skewed towards the first tracks, as popular tracks are
+INSERT INTO comment (user_id, music_id, comment_time, comment_content)
+SELECT u.id, m.music_id, now() - (s.i || ' seconds')::interval, 'bench comment ' || s.i
+FROM (SELECT i, floor(:music * power(random(), 3))::int AS k
+    FROM generate_series(1, :comments) AS i) AS s
+JOIN bench_users u ON u.n = s.i % :users
+JOIN bench_music m ON m.n = s.k;
+
+INSERT INTO favorite (user_id, music_id, create_time)
+SELECT DISTINCT ON (u.id, m.music_id) u.id, m.music_id, now()
+FROM (SELECT i, floor(:music * power(random(), 3))::int AS k
+    FROM generate_series(1, :favorites) AS i) AS s
+JOIN bench_users u ON u.n = s.i % :users
+JOIN bench_music m ON m.n = s.k
+ON CONFLICT DO NOTHING;
+
+-- the summary columns the server loads its counts from
+UPDATE music SET
+    favorite_count = (SELECT count(*) FROM favorite WHERE favorite.music_id = music.music_id),
+    comment_count = (SELECT count(*) FROM comment WHERE comment.music_id = music.music_id)
+WHERE music_id IN (SELECT music_id FROM bench_music);
+
+COMMIT;
+
+ANALYZE;
+
+SELECT (SELECT count(*) FROM bench_users) AS users,
+    (SELECT min(music_id) FROM bench_music) AS first_music_id,
+    (SELECT max(music_id) FROM bench_music) AS last_music_id;
@@ -0,0 +1,84 @@
+// measures the per-query latency of a simple query, with the username
+// quoted into its text, against the same query executed through a named
+// prepared statement with the username bound, the way the handlers run
+// `get_user` (see WebApp/statements.h).
+//
+// usage: statement_bench <conn-str> [iterations] [username]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <pqxx/pqxx>
+
+struct latency {
+	double mean;
+	double p50;
+	double p99;
+};
+
+template <typename Func>
+latency measure(int iterations, Func&& func) {
+	std::vector<double> samples;
+	samples.reserve(iterations);
+	for (int i = 0; i < iterations; ++i) {
+		auto start = std::chrono::steady_clock::now();
+		func();
+		std::chrono::duration<double, std::micro> elapsed =
+			std::chrono::steady_clock::now() - start;
+		samples.push_back(elapsed.count());
+	}
+	std::sort(samples.begin(), samples.end());
+	double sum = 0;
+	for (double sample : samples) sum += sample;
+	return {
+		sum / samples.size(),
+		samples[samples.size() / 2],
+		samples[std::min(samples.size() - 1, samples.size() * 99 / 100)]
+	};
+}
+
+void report(const std::string& name, const latency& l) {
+	std::cout << name << ": mean " << l.mean << " us, p50 " << l.p50
+		<< " us, p99 " << l.p99 << " us" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		std::cerr << "usage: " << argv[0] << " <conn-str> [iterations] [username]" << std::endl;
+		return EXIT_FAILURE;
+	}
+	int iterations = argc > 2 ? std::atoi(argv[2]) : 10000;
+	std::string username = argc > 3 ? argv[3] : "superuser";
+	try {
+		pqxx::connection conn{ argv[1] };
+		conn.prepare("bench_get_user", "select * from auth_user where username = $1");
+		pqxx::nontransaction tx{ conn };
+		std::string quoted = tx.quote(username);
+		std::size_t rows = 0;
+		// warm up the connection and the plan cache
+		for (int i = 0; i < 100; ++i) {
+			rows += tx.exec("select * from auth_user where username = " + quoted).size();
+			rows += tx.exec_prepared("bench_get_user", username).size();
+		}
+		auto simple = measure(iterations, [&]() {
+			rows += tx.exec("select * from auth_user where username = " + quoted).size();
+		});
+		auto prepared = measure(iterations, [&]() {
+			rows += tx.exec_prepared("bench_get_user", username).size();
+		});
+		std::cout << "iterations: " << iterations << std::endl;
+		report("simple query", simple);
+		report("prepared statement", prepared);
+		std::cout << "mean latency drop: "
+			<< (1 - prepared.mean / simple.mean) * 100 << "%" << std::endl;
+		return rows == 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+}
@@ -0,0 +1,17 @@
+-- adds the favorite and comment counts of the music to a database
+-- created by an earlier db.sql, and fills them in:
+--   psql bserv < db-music-counts.sql
+-- it can be run again, it only recounts.
+
+BEGIN;
+
+ALTER TABLE music ADD COLUMN IF NOT EXISTS favorite_count int DEFAULT 0 NOT NULL;
+ALTER TABLE music ADD COLUMN IF NOT EXISTS comment_count int DEFAULT 0 NOT NULL;
+
+UPDATE music SET favorite_count = coalesce(f.n, 0), comment_count = coalesce(c.n, 0)
+FROM music m
+LEFT JOIN (SELECT music_id, count(*) AS n FROM favorite GROUP BY music_id) f USING (music_id)
+LEFT JOIN (SELECT music_id, count(*) AS n FROM comment GROUP BY music_id) c USING (music_id)
+WHERE music.music_id = m.music_id;
+
+COMMIT;
@@ -18,7 +18,13 @@ CREATE TABLE music (
     musician_id int references auth_user(id),
     music_name character varying(255) NOT NULL,
     music_path character varying(255) NOT NULL,
-    is_active boolean DEFAULT true NOT NULL
+    is_active boolean DEFAULT true NOT NULL,
+    -- maintained by the server, which keeps them in memory, writes
+    -- them back periodically and recounts them when it starts.
+    -- databases created before these columns are upgraded with
+    -- db-music-counts.sql
+    favorite_count int DEFAULT 0 NOT NULL,
+    comment_count int DEFAULT 0 NOT NULL
 );
 CREATE TABLE comment (
     comment_id serial PRIMARY KEY,
@@ -27,6 +33,7 @@ CREATE TABLE comment (
     comment_time timestamp NOT NULL,
     comment_content character varying(1023)
 );
+CREATE INDEX comment_music_time_idx ON comment (music_id, comment_time DESC, comment_id DESC);
 CREATE TABLE favorite (
     user_id int references auth_user(id),
     music_id int references music(music_id),